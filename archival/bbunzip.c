@@ -280,13 +280,17 @@ int uncompress_main(int argc UNUSED_PARAM, char **argv)
  * Ken Turkowski, Dave Mack and Peter Jannesen.
  */
 //usage:#define gunzip_trivial_usage
-//usage:       "[-cfkt] [FILE]..."
+//usage:       "[-cfkt] "IF_FEATURE_GZIP_INDEX("[--index=IDX [--index-span=MB]] ")"[FILE]..."
 //usage:#define gunzip_full_usage "\n\n"
 //usage:       "Decompress FILEs (or stdin)\n"
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
 //usage:     "\n	-t	Test file integrity"
+//usage:	IF_FEATURE_GZIP_INDEX(
+//usage:     "\n	--index=IDX	Save checkpoints for random access to FILE (implies -k)"
+//usage:     "\n	--index-span=MB	Distance between checkpoints (default 1)"
+//usage:	)
 //usage:
 //usage:#define gunzip_example_usage
 //usage:       "$ ls -la /tmp/BusyBox*\n"
@@ -320,6 +324,16 @@ int uncompress_main(int argc UNUSED_PARAM, char **argv)
 //config:	bool "Enable long options"
 //config:	default y
 //config:	depends on (GUNZIP || ZCAT) && LONG_OPTS
+//config:
+//config:config FEATURE_GZIP_INDEX
+//config:	bool "Build index for random access (--index=FILE)"
+//config:	default y
+//config:	depends on FEATURE_GUNZIP_LONG_OPTIONS
+//config:	help
+//config:	"gunzip --index=IDX FILE.gz" saves the decompressor state
+//config:	every MB of output (32 kb each). With such an index,
+//config:	"tar -xzf FILE.gz --index=IDX MEMBER" jumps close to MEMBER
+//config:	instead of decompressing everything before it.
 
 //applet:IF_GUNZIP(APPLET(gunzip, BB_DIR_BIN, BB_SUID_DROP))
 //               APPLET_ODDNAME:name  main    location    suid_type     help
@@ -358,9 +372,32 @@ static const char gunzip_longopts[] ALIGN1 =
 	"force\0"               No_argument       "f"
 	"test\0"                No_argument       "t"
 	"no-name\0"             No_argument       "n"
+	IF_FEATURE_GZIP_INDEX(
+	"index\0"               Required_argument "\xff"
+	"index-span\0"          Required_argument "\xfe"
+	)
 	;
 #endif
 
+#if ENABLE_FEATURE_GZIP_INDEX
+enum { OPT_INDEX = 1 << (BBUNPK_OPTSTRLEN + 3) };
+static const char *index_name;
+static uint64_t index_span;
+
+static IF_DESKTOP(long long) int FAST_FUNC unpack_gz_stream_with_index(transformer_state_t *xstate)
+{
+	IF_DESKTOP(long long) int status;
+
+	xstate->gz_index = gz_index_create(index_name, index_span);
+	status = unpack_gz_stream(xstate);
+	if (status >= 0)
+		gz_index_finish(xstate->gz_index, xstate->src_fd);
+	else
+		unlink(index_name);
+	return status;
+}
+#endif
+
 /*
  * Linux kernel build uses gzip -d -n. We accept and ignore it.
  * Man page says:
@@ -377,8 +414,12 @@ static const char gunzip_longopts[] ALIGN1 =
 int gunzip_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int gunzip_main(int argc UNUSED_PARAM, char **argv)
 {
+#if ENABLE_FEATURE_GZIP_INDEX
+	const char *span = "1";
+#endif
 #if ENABLE_FEATURE_GUNZIP_LONG_OPTIONS
-	getopt32long(argv, BBUNPK_OPTSTR "dtn", gunzip_longopts);
+	getopt32long(argv, BBUNPK_OPTSTR "dtn" IF_FEATURE_GZIP_INDEX("\xff:\xfe:"), gunzip_longopts
+			IF_FEATURE_GZIP_INDEX(, &index_name, &span));
 #else
 	getopt32(argv, BBUNPK_OPTSTR "dtn");
 #endif
@@ -391,6 +432,17 @@ int gunzip_main(int argc UNUSED_PARAM, char **argv)
 	if (ENABLE_ZCAT && (!ENABLE_GUNZIP || applet_name[1] == 'c'))
 		option_mask32 |= BBUNPK_OPT_STDOUT | BBUNPK_SEAMLESS_MAGIC;
 
+#if ENABLE_FEATURE_GZIP_INDEX
+	if (option_mask32 & OPT_INDEX) {
+		/* Checkpoints point into one FILE, which must stay */
+		if (argv[0] && argv[1])
+			bb_show_usage();
+		index_span = (uint64_t)xatou_range(span, 1, 1024 * 1024) << 20;
+		option_mask32 &= ~BBUNPK_SEAMLESS_MAGIC;
+		option_mask32 |= BBUNPK_OPT_KEEP;
+		return bbunpack(argv, unpack_gz_stream_with_index, make_new_name_gunzip, /*unused:*/ NULL);
+	}
+#endif
 	return bbunpack(argv, unpack_gz_stream, make_new_name_gunzip, /*unused:*/ NULL);
 }
 #endif /* FEATURE_GZIP_DECOMPRESS */
@@ -50,7 +50,7 @@
 //kbuild:lib-$(CONFIG_BZIP2) += bzip2.o
 
 //usage:#define bzip2_trivial_usage
-//usage:       "[OPTIONS] [FILE]..."
+//usage:       "[OPTIONS] [-p N] [FILE]..."
 //usage:#define bzip2_full_usage "\n\n"
 //usage:       "Compress FILEs (or stdin) with bzip2 algorithm\n"
 //usage:     "\n	-1..9	Compression level"
@@ -61,6 +61,7 @@
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
+//usage:     "\n	-p N	Compress in N threads"
 
 #include "libbb.h"
 #include "bb_archive.h"
@@ -116,6 +117,18 @@ enum {
  * (delete incomplete .bz2 file)
  */
 
+static int write_out(void *wbuf, int n)
+{
+	int n2 = full_write(STDOUT_FILENO, wbuf, n);
+	if (n2 != n) {
+		if (n2 >= 0)
+			errno = 0; /* prevent bogus error message */
+		bb_simple_perror_msg(n2 >= 0 ? "short write" : bb_msg_write_error);
+		return -1;
+	}
+	return n;
+}
+
 /* Returns:
  * -1 on errors
  * total written bytes so far otherwise
@@ -123,7 +136,7 @@ enum {
 static
 IF_DESKTOP(long long) int bz_write(bz_stream *strm, void* rbuf, ssize_t rlen, void *wbuf)
 {
-	int n, n2, ret;
+	int n, ret;
 
 	strm->avail_in = rlen;
 	strm->next_in = rbuf;
@@ -140,15 +153,8 @@ IF_DESKTOP(long long) int bz_write(bz_stream *strm, void* rbuf, ssize_t rlen, vo
 		}
 
 		n = IOBUF_SIZE - strm->avail_out;
-		if (n) {
-			n2 = full_write(STDOUT_FILENO, wbuf, n);
-			if (n2 != n) {
-				if (n2 >= 0)
-					errno = 0; /* prevent bogus error message */
-				bb_simple_perror_msg(n2 >= 0 ? "short write" : bb_msg_write_error);
-				return -1;
-			}
-		}
+		if (n && write_out(wbuf, n) < 0)
+			return -1;
 
 		if (ret == BZ_STREAM_END)
 			break;
@@ -158,6 +164,159 @@ IF_DESKTOP(long long) int bz_write(bz_stream *strm, void* rbuf, ssize_t rlen, vo
 	return 0 IF_DESKTOP( + strm->total_out );
 }
 
+#if ENABLE_FEATURE_USE_THREADS
+/* bzip2 -p N: blocks are filled (run-length encoded and CRCed) by the
+ * main thread just as without -p, then sorted and Huffman coded
+ * by workers, each block in an EState of its own. A block's bit stream
+ * does not end on a byte boundary: the main thread appends the blocks
+ * to the output at the current bit position, in order, and combines
+ * their CRCs into the stream CRC. The result is the same as without -p.
+ */
+enum { BLOCKS_PER_THREAD = 2 };
+
+struct bz_block {
+	bb_task task;
+	bz_stream strm; /* strm.state is the EState of this block */
+};
+
+static bb_pool *bz_pool;
+static unsigned bz_max_blocks;
+
+/* Worker thread: compress one block to s->zbits[] */
+static void FAST_FUNC compress_block(bb_task *task)
+{
+	EState *s = ((struct bz_block *)task)->strm.state;
+
+	s->blockNo = 2; /* not 1: no stream header */
+	BZ2_bsInitWrite(s);
+	BZ2_compressBlock(s, /*is_last_block:*/ 0);
+	/* Whole bytes go to zbits[], less than 8 bits stay in bsBuff */
+	while (s->bsLive >= 8) {
+		*s->posZ++ = (uint8_t)(s->bsBuff >> 24);
+		s->bsBuff <<= 8;
+		s->bsLive -= 8;
+	}
+}
+
+/* Write out whole bytes collected in w->zbits[] */
+static int flush_zbits(EState *w)
+{
+	if (write_out(w->zbits, w->posZ - w->zbits) < 0)
+		return -1;
+	w->strm->total_out += w->posZ - w->zbits;
+	w->posZ = w->zbits;
+	return 0;
+}
+
+/* Wait for the block, append its bits to the ones in w.
+ * Returns -1 on write errors */
+static int write_block(struct bz_block *b, EState *w)
+{
+	EState *s = b->strm.state;
+	uint8_t *p;
+
+	bb_pool_wait(bz_pool, &b->task);
+	w->combinedCRC = (w->combinedCRC << 1) | (w->combinedCRC >> 31);
+	w->combinedCRC ^= s->blockCRC;
+	for (p = s->zbits; p < s->posZ; p++) {
+		bsW(w, 8, *p);
+		if (w->posZ - w->zbits >= IOBUF_SIZE && flush_zbits(w) < 0)
+			return -1;
+	}
+	if (s->bsLive)
+		bsW(w, s->bsLive, s->bsBuff >> (32 - s->bsLive));
+	return 0;
+}
+
+static
+IF_DESKTOP(long long) int compress_parallel(unsigned level, char *rbuf)
+{
+	struct bz_block *blocks;
+	bz_stream wstrm;
+	EState *s, *w;
+	unsigned i, first, count;
+	ssize_t len;
+	int ret = -1;
+
+	blocks = xzalloc(bz_max_blocks * sizeof(blocks[0]));
+	for (i = 0; i < bz_max_blocks; i++) {
+		BZ2_bzCompressInit(&blocks[i].strm, level);
+		blocks[i].task.run = compress_block;
+	}
+	/* Only the bit writer of this one is used */
+	w = xzalloc(sizeof(*w));
+	w->strm = &wstrm;
+	wstrm.total_out = 0;
+	w->zbits = w->posZ = xmalloc(IOBUF_SIZE + 8);
+	BZ2_bsInitWrite(w);
+	bsPutU32(w, BZ_HDR_BZh0 + level);
+
+	first = count = 0;
+	s = blocks[0].strm.state;
+	do {
+		len = full_read(STDIN_FILENO, rbuf, IOBUF_SIZE);
+		if (len < 0) {
+			bb_simple_perror_msg(bb_msg_read_error);
+			goto ret;
+		}
+		s->strm->next_in = rbuf;
+		s->strm->avail_in = len;
+		for (;;) {
+			EState *next;
+
+			copy_input_until_stop(s);
+			if (len == 0)
+				flush_RL(s); /* EOF, this is the last block */
+			else if (s->nblock < s->nblockMAX)
+				break; /* need more input */
+			if (s->nblock == 0)
+				break;
+			bb_pool_submit(bz_pool, &blocks[(first + count) % bz_max_blocks].task);
+			count++;
+			if (count == bz_max_blocks) {
+				if (write_block(&blocks[first], w) < 0)
+					goto ret;
+				first = (first + 1) % bz_max_blocks;
+				count--;
+			}
+			next = blocks[(first + count) % bz_max_blocks].strm.state;
+			prepare_new_block(next);
+			/* The run being counted, and the rest of input, go on */
+			next->state_in_ch = s->state_in_ch;
+			next->state_in_len = s->state_in_len;
+			next->strm->next_in = s->strm->next_in;
+			next->strm->avail_in = s->strm->avail_in;
+			s = next;
+		}
+	} while (len != 0);
+
+	while (count) {
+		if (write_block(&blocks[first], w) < 0)
+			goto ret;
+		first = (first + 1) % bz_max_blocks;
+		count--;
+	}
+	/* zbits[] may be almost full, the trailer does not fit in the slack */
+	if (flush_zbits(w) < 0)
+		goto ret;
+	bsPutU32(w, 0x17724538);
+	bsPutU16(w, 0x5090);
+	bsPutU32(w, w->combinedCRC);
+	bsFinishWrite(w);
+	if (flush_zbits(w) >= 0)
+		ret = 0;
+ ret:
+	/* On errors, workers may be still busy with our blocks */
+	bb_pool_wait(bz_pool, NULL);
+	for (i = 0; i < bz_max_blocks; i++)
+		BZ2_bzCompressEnd(&blocks[i].strm);
+	free(blocks);
+	free(w->zbits);
+	free(w);
+	return ret IF_DESKTOP( + (ret == 0 ? wstrm.total_out : 0));
+}
+#endif
+
 static
 IF_DESKTOP(long long) int FAST_FUNC compressStream(transformer_state_t *xstate UNUSED_PARAM)
 {
@@ -182,6 +341,14 @@ IF_DESKTOP(long long) int FAST_FUNC compressStream(transformer_state_t *xstate U
 		opt >>= 1;
 	}
 
+#if ENABLE_FEATURE_USE_THREADS
+	if (bz_pool) {
+		total = compress_parallel(level, rbuf);
+		free(iobuf);
+		return total;
+	}
+#endif
+
 	BZ2_bzCompressInit(strm, level);
 
 	while (1) {
@@ -210,6 +377,7 @@ int bzip2_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int bzip2_main(int argc UNUSED_PARAM, char **argv)
 {
 	unsigned opt;
+	unsigned nthreads = 0;
 
 	/* standard bzip2 flags
 	 * -d --decompress force decompression
@@ -224,12 +392,14 @@ int bzip2_main(int argc UNUSED_PARAM, char **argv)
 	 * -1 .. -9      set block size to 100k .. 900k
 	 * --fast        alias for -1
 	 * --best        alias for -9
+	 * -p N          compress in N threads (like in gzip)
 	 */
 
 	opt = getopt32(argv, "^"
 		/* Must match BBUNPK_foo constants! */
-		BBUNPK_OPTSTR IF_FEATURE_BZIP2_DECOMPRESS("dt") "zs123456789"
+		BBUNPK_OPTSTR IF_FEATURE_BZIP2_DECOMPRESS("dt") "zs123456789p:+"
 		"\0" "s2" /* -s means -2 (compatibility) */
+		, &nthreads
 	);
 #if ENABLE_FEATURE_BZIP2_DECOMPRESS /* bunzip2_main may not be visible... */
 	if (opt & (BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST)) /* -d and/or -t */
@@ -240,6 +410,14 @@ int bzip2_main(int argc UNUSED_PARAM, char **argv)
 	option_mask32 = opt & ~(BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST);
 #endif
 
+#if ENABLE_FEATURE_USE_THREADS
+	/* -p1 is the same as no -p */
+	if (nthreads > 1) {
+		bz_pool = bb_pool_new(nthreads);
+		bz_max_blocks = nthreads * BLOCKS_PER_THREAD;
+	}
+#endif
+
 	argv += optind;
 	return bbunpack(argv, compressStream, append_ext, "bz2");
 }
@@ -50,8 +50,8 @@ aa:      85.1% -- replaced with aa.gz
 //config:	default n
 //config:	depends on GZIP
 //config:	help
-//config:	Enable support for compression levels 4-9. The default level
-//config:	is 6. If levels 1-3 are specified, 4 is used.
+//config:	Enable support for compression levels 1-9. The default level
+//config:	is 6. Levels 1-3 use a faster, non-lazy match search.
 //config:	If this option is not selected, -N options are ignored and -6
 //config:	is used.
 //config:
@@ -69,7 +69,7 @@ aa:      85.1% -- replaced with aa.gz
 //kbuild:lib-$(CONFIG_GZIP) += gzip.o
 
 //usage:#define gzip_trivial_usage
-//usage:       "[-cfk" IF_FEATURE_GZIP_DECOMPRESS("dt") IF_FEATURE_GZIP_LEVELS("123456789") "] [FILE]..."
+//usage:       "[-cfk" IF_FEATURE_GZIP_DECOMPRESS("dt") IF_FEATURE_GZIP_LEVELS("123456789") "] [-p N] [FILE]..."
 //usage:#define gzip_full_usage "\n\n"
 //usage:       "Compress FILEs (or stdin)\n"
 //usage:	IF_FEATURE_GZIP_LEVELS(
@@ -82,6 +82,7 @@ aa:      85.1% -- replaced with aa.gz
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
+//usage:     "\n	-p N	Compress in N threads"
 //usage:
 //usage:#define gzip_example_usage
 //usage:       "$ ls -la /tmp/busybox*\n"
@@ -92,6 +93,9 @@ aa:      85.1% -- replaced with aa.gz
 
 #include "libbb.h"
 #include "bb_archive.h"
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 
 /* ===========================================================================
  */
@@ -259,7 +263,7 @@ enum {
 
 #if !ENABLE_FEATURE_GZIP_LEVELS
 
-	comp_level_minus4 = 6 - 4,
+	comp_level = 6,
 	max_chain_length = 128,
 /* To speed up deflation, hash chains are never searched beyond this length.
  * A higher limit improves compression ratio but degrades the speed.
@@ -294,6 +298,8 @@ enum {
 #endif /* ENABLE_FEATURE_GZIP_LEVELS */
 };
 
+struct gz_chunk;
+
 struct globals {
 /* =========================================================================== */
 /* global buffers, allocated once */
@@ -335,16 +341,27 @@ struct globals {
 #define head (G1.prev + WSIZE) /* hash head (see deflate.c) */
 
 #if ENABLE_FEATURE_GZIP_LEVELS
-	unsigned comp_level_minus4;	/* can be a byte */
-	unsigned max_chain_length;
-	unsigned max_lazy_match;
-	unsigned good_match;
-	unsigned nice_match;
-#define comp_level_minus4 (G1.comp_level_minus4)
-#define max_chain_length  (G1.max_chain_length)
-#define max_lazy_match    (G1.max_lazy_match)
-#define good_match        (G1.good_match)
-#define nice_match        (G1.nice_match)
+	struct {
+		unsigned comp_level;	/* can be a byte */
+		unsigned max_chain_length;
+		unsigned max_lazy_match;
+		unsigned good_match;
+		unsigned nice_match;
+	} level;
+#define comp_level        (G1.level.comp_level)
+#define max_chain_length  (G1.level.max_chain_length)
+#define max_lazy_match    (G1.level.max_lazy_match)
+#define good_match        (G1.level.good_match)
+#define nice_match        (G1.level.nice_match)
+/* deflate_fast() uses max_lazy_match as: */
+#define max_insert_length max_lazy_match
+#endif
+
+#if ENABLE_FEATURE_USE_THREADS
+	/* -p N: */
+	bb_pool *pool;
+	struct gz_chunk *chunks; /* ring of chunks in flight */
+	unsigned max_chunks;
 #endif
 
 /* =========================================================================== */
@@ -353,6 +370,11 @@ struct globals {
 	uint32_t crc;	/* shift register contents */
 	/*uint32_t *crc_32_tab;*/
 
+#if ENABLE_FEATURE_USE_THREADS
+	/* -p N: the chunk this thread is compressing, or NULL */
+	struct gz_chunk *chunk;
+#endif
+
 /* window position at the beginning of the current output block. Gets
  * negative when the window is moved backwards.
  */
@@ -414,7 +436,41 @@ struct globals {
 #endif
 };
 
-#define G1 (*(ptr_to_globals - 1))
+#if ENABLE_FEATURE_USE_THREADS
+/* With -p N, every thread deflates with state of its own.
+ * This points to its G2, and G1 is right before it */
+static __thread char *gz_ptr;
+#else
+# define gz_ptr ((char*)ptr_to_globals)
+#endif
+#define G1 (*((struct globals*)gz_ptr - 1))
+
+#if ENABLE_FEATURE_USE_THREADS
+/* gzip -p N: like pigz, input is cut into chunks which are deflated
+ * in parallel, each with the last WSIZE bytes of the previous chunk
+ * as the dictionary. All chunks but the last end with an empty
+ * stored block, which aligns them to a byte boundary: then their
+ * concatenation is one deflate stream. CRC32s of the chunks are
+ * combined into the CRC32 of the whole input.
+ */
+enum {
+	CHUNK_SIZE = 128 * 1024,
+	CHUNKS_PER_THREAD = 2,
+};
+
+struct gz_chunk {
+	bb_task task;
+	uch *buf;          /* dict_len bytes of dictionary, then len bytes of input */
+	unsigned dict_len;
+	unsigned len;
+	unsigned in_pos;   /* how much of input is consumed */
+	smallint last;
+	uch *out;          /* compressed data */
+	size_t out_len;
+	size_t out_size;
+	uint32_t crc;
+};
+#endif
 
 /* ===========================================================================
  * Write the output buffer outbuf[0..outcnt-1] and update bytes_out.
@@ -425,6 +481,18 @@ static void flush_outbuf(void)
 	if (G1.outcnt == 0)
 		return;
 
+#if ENABLE_FEATURE_USE_THREADS
+	if (G1.chunk) {
+		struct gz_chunk *c = G1.chunk;
+
+		if (c->out_len + G1.outcnt > c->out_size) {
+			c->out_size = (c->out_len + G1.outcnt) * 2;
+			c->out = xrealloc(c->out, c->out_size);
+		}
+		memcpy(c->out + c->out_len, G1.outbuf, G1.outcnt);
+		c->out_len += G1.outcnt;
+	} else
+#endif
 	xwrite(ofd, (char *) G1.outbuf, G1.outcnt);
 	G1.outcnt = 0;
 }
@@ -523,6 +591,15 @@ static unsigned file_read(void *buf, unsigned size)
 
 	Assert(G1.insize == 0, "l_buf not empty");
 
+#if ENABLE_FEATURE_USE_THREADS
+	if (G1.chunk) {
+		struct gz_chunk *c = G1.chunk;
+
+		len = MIN(size, c->len - c->in_pos);
+		memcpy(buf, c->buf + c->dict_len + c->in_pos, len);
+		c->in_pos += len;
+	} else
+#endif
 	len = safe_read(ifd, buf, size);
 	if (len == (unsigned)(-1) || len == 0)
 		return len;
@@ -628,6 +705,27 @@ static void copy_block(const char *buf, unsigned len, int header)
 		flush_outbuf_if_32bit_optimized();
 }
 
+/* ===========================================================================
+ * Subtract WSIZE from hash chain links, links which fall out
+ * of the window become 0 (end of chain).
+ */
+static void slide_hash(ush *p, unsigned n)
+{
+#if defined(__SSE2__)
+	__m128i wsize = _mm_set1_epi16(WSIZE);
+
+	/* Eight links at a time, with unsigned saturating subtract */
+	for (; n >= 8; n -= 8, p += 8) {
+		__m128i v = _mm_loadu_si128((void *)p);
+		_mm_storeu_si128((void *)p, _mm_subs_epu16(v, wsize));
+	}
+#endif
+	for (; n != 0; n--, p++) {
+		unsigned m = *p;
+		*p = (Pos) (m >= WSIZE ? m - WSIZE : 0);
+	}
+}
+
 /* ===========================================================================
  * Fill the window when the lookahead becomes insufficient.
  * Updates strstart and lookahead, and sets eofile if end of input file.
@@ -638,7 +736,7 @@ static void copy_block(const char *buf, unsigned len, int header)
  */
 static void fill_window(void)
 {
-	unsigned n, m;
+	unsigned n;
 	unsigned more =	WINDOW_SIZE - G1.lookahead - G1.strstart;
 	/* Amount of free space at the end of the window. */
 
@@ -662,17 +760,11 @@ static void fill_window(void)
 
 		G1.block_start -= WSIZE;
 
-		for (n = 0; n < HASH_SIZE; n++) {
-			m = head[n];
-			head[n] = (Pos) (m >= WSIZE ? m - WSIZE : 0);
-		}
-		for (n = 0; n < WSIZE; n++) {
-			m = G1.prev[n];
-			G1.prev[n] = (Pos) (m >= WSIZE ? m - WSIZE : 0);
-			/* If n is not on any hash chain, prev[n] is garbage but
-			 * its value will never be used.
-			 */
-		}
+		/* Slide prev[] and head[] (which follows it).
+		 * If n is not on any hash chain, prev[n] is garbage but
+		 * its value will never be used.
+		 */
+		slide_hash(G1.prev, WSIZE + HASH_SIZE);
 		more += WSIZE;
 	}
 	/* At this point, more >= 2 */
@@ -723,9 +815,19 @@ static int longest_match(IPos cur_match)
 #if HASH_BITS < 8 || MAX_MATCH != 258
 #  error Code too clever
 #endif
+#if BB_UNALIGNED_MEMACCESS_OK
+	/* Candidates are checked two bytes at a time (at the start
+	 * and at the end of the best match so far), then compared
+	 * a word at a time */
+	uint16_t scan_start, scan_end;
+
+	move_from_unaligned16(scan_start, scan);
+	move_from_unaligned16(scan_end, scan + best_len - 1);
+#else
 	uch *strend = G1.window + G1.strstart + MAX_MATCH;
 	uch scan_end1 = scan[best_len - 1];
 	uch scan_end = scan[best_len];
+#endif
 
 	/* Do not waste too much time if we already have a good match: */
 	if (G1.prev_length >= good_match) {
@@ -737,6 +839,34 @@ static int longest_match(IPos cur_match)
 		Assert(cur_match < G1.strstart, "no future");
 		match = G1.window + cur_match;
 
+#if BB_UNALIGNED_MEMACCESS_OK
+		{
+			uint16_t v;
+
+			move_from_unaligned16(v, match + best_len - 1);
+			if (v != scan_end)
+				continue;
+			move_from_unaligned16(v, match);
+			if (v != scan_start)
+				continue;
+		}
+		/* scan[2] and match[2] are equal, see below. From there,
+		 * MAX_MATCH-2 bytes are a whole number of words */
+		len = 2;
+		do {
+			unsigned long diff, w;
+
+			move_from_unaligned_long(diff, scan + len);
+			move_from_unaligned_long(w, match + len);
+			diff ^= w;
+			if (diff) {
+				/* the first differing byte */
+				len += (BB_LITTLE_ENDIAN ? __builtin_ctzl(diff) : __builtin_clzl(diff)) / 8;
+				break;
+			}
+			len += sizeof(long);
+		} while (len < MAX_MATCH);
+#else
 		/* Skip to next match if the match length cannot increase
 		 * or if the match length is less than 2:
 		 */
@@ -766,14 +896,19 @@ static int longest_match(IPos cur_match)
 
 		len = MAX_MATCH - (int) (strend - scan);
 		scan = strend - MAX_MATCH;
+#endif
 
 		if (len > best_len) {
 			G1.match_start = cur_match;
 			best_len = len;
 			if (len >= nice_match)
 				break;
+#if BB_UNALIGNED_MEMACCESS_OK
+			move_from_unaligned16(scan_end, scan + best_len - 1);
+#else
 			scan_end1 = scan[best_len - 1];
 			scan_end = scan[best_len];
+#endif
 		}
 	} while ((cur_match = G1.prev[cur_match & WMASK]) > limit
 			 && --chain_length != 0);
@@ -1063,7 +1198,7 @@ struct globals2 {
 //	ulg compressed_len;      /* total bit length of compressed file */
 };
 
-#define G2ptr ((struct globals2*)(ptr_to_globals))
+#define G2ptr ((struct globals2*)gz_ptr)
 #define G2 (*G2ptr)
 
 /* ===========================================================================
@@ -1805,7 +1940,105 @@ do { \
 	head[G1.ins_h] = (s); \
 } while (0)
 
-static NOINLINE void deflate(void)
+/* End of input: flush the last block. If last is not set,
+ * then with an empty stored block instead of an end-of-file block */
+static void flush_end(int last)
+{
+	FLUSH_BLOCK(last);
+	if (!last) {
+		send_bits(STORED_BLOCK << 1, 3);
+		copy_block(NULL, 0, 1); /* (aligns to byte boundary) */
+	}
+}
+
+#if ENABLE_FEATURE_GZIP_LEVELS
+/* ===========================================================================
+ * Processes a new input file and return its compressed length. This
+ * function does not perform lazy evaluation of matches and inserts
+ * new strings in the dictionary only for unmatched strings or for short
+ * matches. It is used only for the fast compression options.
+ */
+static NOINLINE void deflate_fast(int last)
+{
+	IPos hash_head;		/* head of the hash chain */
+	int flush;			/* set if current block must be flushed */
+	unsigned match_length = 0;	/* length of best match */
+
+	G1.prev_length = MIN_MATCH - 1;
+	while (G1.lookahead != 0) {
+		/* Insert the string window[strstart .. strstart+2] in the
+		 * dictionary, and set hash_head to the head of the hash chain:
+		 */
+		INSERT_STRING(G1.strstart, hash_head);
+
+		/* Find the longest match, discarding those <= prev_length.
+		 * At this point we have always match_length < MIN_MATCH
+		 */
+		if (hash_head != 0 && G1.strstart - hash_head <= MAX_DIST) {
+			/* To simplify the code, we prevent matches with the string
+			 * of window index 0 (in particular we have to avoid a match
+			 * of the string with itself at the start of the input file).
+			 */
+			match_length = longest_match(hash_head);
+			/* longest_match() sets match_start */
+			if (match_length > G1.lookahead)
+				match_length = G1.lookahead;
+		}
+		if (match_length >= MIN_MATCH) {
+			check_match(G1.strstart, G1.match_start, match_length);
+			flush = ct_tally(G1.strstart - G1.match_start, match_length - MIN_MATCH);
+			G1.lookahead -= match_length;
+
+			/* Insert new strings in the hash table only if the match length
+			 * is not too large. This saves time but degrades compression.
+			 */
+			if (match_length <= max_insert_length) {
+				match_length--; /* string at strstart already in hash table */
+				do {
+					G1.strstart++;
+					INSERT_STRING(G1.strstart, hash_head);
+					/* strstart never exceeds WSIZE-MAX_MATCH, so there are
+					 * always MIN_MATCH bytes ahead. If lookahead < MIN_MATCH
+					 * these bytes are garbage, but it does not matter since
+					 * the next lookahead bytes will be emitted as literals.
+					 */
+				} while (--match_length != 0);
+				G1.strstart++;
+			} else {
+				G1.strstart += match_length;
+				match_length = 0;
+				G1.ins_h = G1.window[G1.strstart];
+				UPDATE_HASH(G1.ins_h, G1.window[G1.strstart + 1]);
+				/* If lookahead < MIN_MATCH, ins_h is garbage, but it does
+				 * not matter since it will be recomputed at next deflate call.
+				 */
+			}
+		} else {
+			/* No match, output a literal byte */
+			Tracevv((stderr, "%c", G1.window[G1.strstart]));
+			flush = ct_tally(0, G1.window[G1.strstart]);
+			G1.lookahead--;
+			G1.strstart++;
+		}
+		if (flush) {
+			FLUSH_BLOCK(0);
+			G1.block_start = G1.strstart;
+		}
+
+		/* Make sure that we always have enough lookahead, except
+		 * at the end of the input file. We need MAX_MATCH bytes
+		 * for the next match, plus MIN_MATCH bytes to insert the
+		 * string following the next match.
+		 */
+		fill_window_if_needed();
+	}
+	flush_end(last);
+}
+#endif
+
+/* If last is not set, the data ends with an empty stored block
+ * instead of an end-of-file block */
+static NOINLINE void deflate(int last)
 {
 	IPos hash_head;		/* head of hash chain */
 	IPos prev_match;	/* previous match */
@@ -1813,6 +2046,13 @@ static NOINLINE void deflate(void)
 	int match_available = 0;	/* set if previous match exists */
 	unsigned match_length = MIN_MATCH - 1;	/* length of best match */
 
+#if ENABLE_FEATURE_GZIP_LEVELS
+	if (comp_level <= 3) {
+		deflate_fast(last); /* optimized for speed */
+		return;
+	}
+#endif
+
 	/* Process the input block. */
 	while (G1.lookahead != 0) {
 		/* Insert the string window[strstart .. strstart+2] in the
@@ -1906,7 +2146,7 @@ static NOINLINE void deflate(void)
 	if (match_available)
 		ct_tally(0, G1.window[G1.strstart - 1]);
 
-	FLUSH_BLOCK(1);	/* eof */
+	flush_end(last);
 }
 
 /* ===========================================================================
@@ -1920,9 +2160,10 @@ static void bi_init(void)
 }
 
 /* ===========================================================================
- * Initialize the "longest match" routines for a new file
+ * Initialize the "longest match" routines for a new file.
+ * The first dict_len bytes of window are a preset dictionary.
  */
-static void lm_init(void)
+static void lm_init(unsigned dict_len)
 {
 	unsigned j;
 
@@ -1932,11 +2173,11 @@ static void lm_init(void)
 
 	/* ??? reduce max_chain_length for binary files */
 
-	//G1.strstart = 0; // globals are zeroed in pack_gzip()
-	//G1.block_start = 0L; // globals are zeroed in pack_gzip()
+	G1.strstart = dict_len;
+	G1.block_start = dict_len;
 
-	G1.lookahead = file_read(G1.window,
-			sizeof(int) <= 2 ? (unsigned) WSIZE : 2 * WSIZE);
+	G1.lookahead = file_read(G1.window + dict_len,
+			(sizeof(int) <= 2 ? (unsigned) WSIZE : 2 * WSIZE) - dict_len);
 
 	if (G1.lookahead == 0 || G1.lookahead == (unsigned) -1) {
 		G1.eofile = 1;
@@ -1956,6 +2197,13 @@ static void lm_init(void)
 	/* If lookahead < MIN_MATCH, ins_h is garbage, but this is
 	 * not important since only literal bytes will be emitted.
 	 */
+
+	/* Put strings of the dictionary into hash chains */
+	for (j = 0; j < dict_len; j++) {
+		IPos hash_head;
+		INSERT_STRING(j, hash_head);
+		(void)hash_head;
+	}
 }
 
 /* ===========================================================================
@@ -2055,6 +2303,186 @@ static void ct_init(void)
 	init_block();
 }
 
+/* ===========================================================================
+ * Reinit G1.xxx except pointers to allocated buffers, and entire G2
+ */
+static void init_state(void)
+{
+	memset(&G1.crc, 0, (sizeof(G1) - offsetof(struct globals, crc)) + sizeof(G2));
+
+	/* Clear input and output buffers */
+	//G1.outcnt = 0;
+#ifdef DEBUG
+	//G1.insize = 0;
+#endif
+	//G1.isize = 0;
+
+	/* Reinit G2.xxx */
+	G2.l_desc.dyn_tree     = G2.dyn_ltree;
+	G2.l_desc.static_tree  = G2.static_ltree;
+	G2.l_desc.extra_bits   = extra_lbits;
+	G2.l_desc.extra_base   = LITERALS + 1;
+	G2.l_desc.elems        = L_CODES;
+	G2.l_desc.max_length   = MAX_BITS;
+	//G2.l_desc.max_code     = 0;
+	G2.d_desc.dyn_tree     = G2.dyn_dtree;
+	G2.d_desc.static_tree  = G2.static_dtree;
+	G2.d_desc.extra_bits   = extra_dbits;
+	//G2.d_desc.extra_base   = 0;
+	G2.d_desc.elems        = D_CODES;
+	G2.d_desc.max_length   = MAX_BITS;
+	//G2.d_desc.max_code     = 0;
+	G2.bl_desc.dyn_tree    = G2.bl_tree;
+	//G2.bl_desc.static_tree = NULL;
+	G2.bl_desc.extra_bits  = extra_blbits,
+	//G2.bl_desc.extra_base  = 0;
+	G2.bl_desc.elems       = BL_CODES;
+	G2.bl_desc.max_length  = MAX_BL_BITS;
+	//G2.bl_desc.max_code    = 0;
+}
+
+/* Allocate G1 and G2, and all buffers. Returns pointer to G2 */
+static char *alloc_state(void)
+{
+	struct globals *g1 = xzalloc(sizeof(struct globals) + sizeof(struct globals2));
+
+	ALLOC(uch, g1->l_buf, INBUFSIZ);
+	ALLOC(uch, g1->outbuf, OUTBUFSIZ);
+	ALLOC(ush, g1->d_buf, DIST_BUFSIZE);
+	ALLOC(uch, g1->window, 2L * WSIZE);
+	ALLOC(ush, g1->prev, 1L << BITS);
+	return (char *)(g1 + 1);
+}
+
+#if ENABLE_FEATURE_USE_THREADS
+/* Worker thread: deflate one chunk into c->out */
+static void FAST_FUNC deflate_chunk(bb_task *task)
+{
+	struct gz_chunk *c = (struct gz_chunk *)task;
+
+	if (!gz_ptr) {
+		/* First chunk in this thread */
+		gz_ptr = alloc_state();
+# if ENABLE_FEATURE_GZIP_LEVELS
+		/* same as in main thread */
+		G1.level = ((struct globals *)ptr_to_globals - 1)->level;
+# endif
+	}
+	init_state();
+	G1.chunk = c;
+	c->in_pos = 0;
+	c->out_len = 0;
+
+	G1.crc = ~0;
+	ct_init();
+	memcpy(G1.window, c->buf, c->dict_len);
+	lm_init(c->dict_len);
+	deflate(c->last);
+	flush_outbuf();
+	c->crc = ~G1.crc;
+}
+
+/* Multiply a and b modulo CRC32 polynomial (bit-reflected, as CRC32 is) */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = (uint32_t)1 << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				return p;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ 0xedb88320 : b >> 1;
+	}
+}
+
+/* CRC32 of A followed by B, from CRC32 of A, of B and length of B.
+ * Appending len2 zero bytes multiplies crc1 by x^(8*len2) */
+static uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+	uint32_t p = (uint32_t)1 << 31;   /* x^0 */
+	uint32_t x2n = (uint32_t)1 << 23; /* x^8, squared every step */
+
+	while (len2) {
+		if (len2 & 1)
+			p = multmodp(x2n, p);
+		x2n = multmodp(x2n, x2n);
+		len2 >>= 1;
+	}
+	return multmodp(p, crc1) ^ crc2;
+}
+
+static unsigned read_chunk(uch *buf)
+{
+	ssize_t len = full_read(ifd, buf, CHUNK_SIZE);
+	if (len < 0)
+		bb_simple_perror_msg_and_die(bb_msg_read_error);
+	return len;
+}
+
+/* Wait for the chunk to be compressed, write it out.
+ * Returns CRC32 of all input so far */
+static uint32_t write_chunk(struct gz_chunk *c, uint32_t crc)
+{
+	bb_pool_wait(G1.pool, &c->task);
+	xwrite(ofd, c->out, c->out_len);
+	G1.isize += c->len;
+	return crc32_combine(crc, c->crc, c->len);
+}
+
+/* Main thread of -p N: read chunks, give them to workers,
+ * write compressed chunks in order. Sets G1.crc and G1.isize */
+static void deflate_parallel(void)
+{
+	struct gz_chunk *c;
+	unsigned first, count;
+	uint32_t crc;
+
+	flush_outbuf(); /* header */
+
+	first = count = 0;
+	crc = 0;
+	c = &G1.chunks[0];
+	c->dict_len = 0;
+	c->len = read_chunk(c->buf);
+	for (;;) {
+		struct gz_chunk *next;
+		unsigned dict_len;
+
+		/* Need two free slots: for c, and for the next chunk */
+		if (count + 2 > G1.max_chunks) {
+			crc = write_chunk(&G1.chunks[first], crc);
+			first = (first + 1) % G1.max_chunks;
+			count--;
+		}
+
+		/* Read ahead, to know whether c is the last chunk */
+		next = &G1.chunks[(first + count + 1) % G1.max_chunks];
+		dict_len = MIN(c->dict_len + c->len, WSIZE);
+		memcpy(next->buf, c->buf + c->dict_len + c->len - dict_len, dict_len);
+		next->dict_len = dict_len;
+		next->len = read_chunk(next->buf + dict_len);
+
+		c->last = (next->len == 0);
+		c->task.run = deflate_chunk;
+		bb_pool_submit(G1.pool, &c->task);
+		count++;
+		if (c->last)
+			break;
+		c = next;
+	}
+	while (count) {
+		crc = write_chunk(&G1.chunks[first], crc);
+		first = (first + 1) % G1.max_chunks;
+		count--;
+	}
+	G1.crc = ~crc;
+}
+#endif
+
 /* ===========================================================================
  * Deflate in to out.
  * IN assertions: the input and output buffers are cleared.
@@ -2072,26 +2500,34 @@ static void zip(void)
 	put_32bit(0x00088b1f);
 	put_32bit(0);		/* Unix timestamp */
 
-	/* Write deflated file to zip file */
-	G1.crc = ~0;
-
-	bi_init();
-	ct_init();
-	lm_init();
-
 	deflate_flags = 0x300; /* extra flags. OS id = 3 (Unix) */
 #if ENABLE_FEATURE_GZIP_LEVELS
-	/* Note that comp_level < 4 do not exist in this version of gzip */
-	if (comp_level_minus4 == 9 - 4) {
+	if (comp_level == 9) {
 		deflate_flags |= 0x02; /* SLOW flag */
 	}
+	if (comp_level == 1) {
+		deflate_flags |= 0x04; /* FAST flag */
+	}
 #endif
 	put_16bit(deflate_flags);
 
 	/* The above 32-bit misaligns outbuf (10 bytes are stored), flush it */
 	flush_outbuf_if_32bit_optimized();
 
-	deflate();
+#if ENABLE_FEATURE_USE_THREADS
+	if (G1.pool) {
+		deflate_parallel();
+	} else
+#endif
+	{
+		/* Write deflated file to zip file */
+		G1.crc = ~0;
+
+		bi_init();
+		ct_init();
+		lm_init(0);
+		deflate(1);
+	}
 
 	/* Write the crc and uncompressed size */
 	put_32bit(~G1.crc);
@@ -2104,38 +2540,7 @@ static void zip(void)
 static
 IF_DESKTOP(long long) int FAST_FUNC pack_gzip(transformer_state_t *xstate UNUSED_PARAM)
 {
-	/* Reinit G1.xxx except pointers to allocated buffers, and entire G2 */
-	memset(&G1.crc, 0, (sizeof(G1) - offsetof(struct globals, crc)) + sizeof(G2));
-
-	/* Clear input and output buffers */
-	//G1.outcnt = 0;
-#ifdef DEBUG
-	//G1.insize = 0;
-#endif
-	//G1.isize = 0;
-
-	/* Reinit G2.xxx */
-	G2.l_desc.dyn_tree     = G2.dyn_ltree;
-	G2.l_desc.static_tree  = G2.static_ltree;
-	G2.l_desc.extra_bits   = extra_lbits;
-	G2.l_desc.extra_base   = LITERALS + 1;
-	G2.l_desc.elems        = L_CODES;
-	G2.l_desc.max_length   = MAX_BITS;
-	//G2.l_desc.max_code     = 0;
-	G2.d_desc.dyn_tree     = G2.dyn_dtree;
-	G2.d_desc.static_tree  = G2.static_dtree;
-	G2.d_desc.extra_bits   = extra_dbits;
-	//G2.d_desc.extra_base   = 0;
-	G2.d_desc.elems        = D_CODES;
-	G2.d_desc.max_length   = MAX_BITS;
-	//G2.d_desc.max_code     = 0;
-	G2.bl_desc.dyn_tree    = G2.bl_tree;
-	//G2.bl_desc.static_tree = NULL;
-	G2.bl_desc.extra_bits  = extra_blbits,
-	//G2.bl_desc.extra_base  = 0;
-	G2.bl_desc.elems       = BL_CODES;
-	G2.bl_desc.max_length  = MAX_BL_BITS;
-	//G2.bl_desc.max_code    = 0;
+	init_state();
 
 #if 0
 	/* Saving of timestamp is disabled. Why?
@@ -2172,6 +2577,7 @@ static const char gzip_longopts[] ALIGN1 =
 	"fast\0"                No_argument       "1"
 	"best\0"                No_argument       "9"
 	"no-name\0"             No_argument       "n"
+	"processes\0"           Required_argument "p"
 	;
 #endif
 
@@ -2197,60 +2603,72 @@ int gzip_main(int argc UNUSED_PARAM, char **argv)
 #endif
 {
 	unsigned opt;
+	unsigned nthreads = 0;
 #if ENABLE_FEATURE_GZIP_LEVELS
 	static const struct {
 		uint8_t good;
 		uint8_t chain_shift;
-		uint8_t lazy2;
-		uint8_t nice2;
-	} gzip_level_config[6] = {
-		{4,   4,   4/2,  16/2}, /* Level 4 */
-		{8,   5,  16/2,  32/2}, /* Level 5 */
-		{8,   7,  16/2, 128/2}, /* Level 6 */
-		{8,   8,  32/2, 128/2}, /* Level 7 */
-		{32, 10, 128/2, 258/2}, /* Level 8 */
-		{32, 12, 258/2, 258/2}, /* Level 9 */
+		uint16_t lazy;
+		uint16_t nice;
+	} gzip_level_config[9] = {
+		/* Same as zlib's. For levels 1-3, "lazy" is max_insert_length */
+		{4,   2,   4,   8}, /* Level 1 */
+		{4,   3,   5,  16}, /* Level 2 */
+		{4,   5,   6,  32}, /* Level 3 */
+		{4,   4,   4,  16}, /* Level 4 */
+		{8,   5,  16,  32}, /* Level 5 */
+		{8,   7,  16, 128}, /* Level 6 */
+		{8,   8,  32, 128}, /* Level 7 */
+		{32, 10, 128, 258}, /* Level 8 */
+		{32, 12, 258, 258}, /* Level 9 */
 	};
 #endif
 
-	SET_PTR_TO_GLOBALS((char *)xzalloc(sizeof(struct globals)+sizeof(struct globals2))
-			+ sizeof(struct globals));
+	/* Allocate all global buffers (for DYN_ALLOC option) */
+	SET_PTR_TO_GLOBALS(alloc_state());
+	IF_FEATURE_USE_THREADS(gz_ptr = (char *)ptr_to_globals;)
 
 	/* Must match bbunzip's constants OPT_STDOUT, OPT_FORCE! */
 #if ENABLE_FEATURE_GZIP_LONG_OPTIONS
-	opt = getopt32long(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n123456789", gzip_longopts);
+	opt = getopt32long(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "np:+123456789", gzip_longopts, &nthreads);
 #else
-	opt = getopt32(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n123456789");
+	opt = getopt32(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "np:+123456789", &nthreads);
 #endif
 #if ENABLE_FEATURE_GZIP_DECOMPRESS /* gunzip_main may not be visible... */
 	if (opt & (BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST)) /* -d and/or -t */
 		return gunzip_main(argc, argv);
 #endif
 #if ENABLE_FEATURE_GZIP_LEVELS
-	opt >>= (BBUNPK_OPTSTRLEN IF_FEATURE_GZIP_DECOMPRESS(+ 2) + 1); /* drop cfkvq[dt]n bits */
+	opt >>= (BBUNPK_OPTSTRLEN IF_FEATURE_GZIP_DECOMPRESS(+ 2) + 2); /* drop cfkvq[dt]np bits */
 	if (opt == 0)
 		opt = 1 << 5; /* default: 6 */
-	opt = ffs(opt >> 4); /* Maps -1..-4 to [0], -5 to [1] ... -9 to [5] */
+	opt = ffs(opt) - 1; /* Maps -1 to [0] ... -9 to [8] */
 
-	comp_level_minus4 = opt;
+	comp_level = opt + 1;
 
 	max_chain_length = 1 << gzip_level_config[opt].chain_shift;
 	good_match	 = gzip_level_config[opt].good;
-	max_lazy_match	 = gzip_level_config[opt].lazy2 * 2;
-	nice_match	 = gzip_level_config[opt].nice2 * 2;
+	max_lazy_match	 = gzip_level_config[opt].lazy;
+	nice_match	 = gzip_level_config[opt].nice;
 #endif
 	option_mask32 &= BBUNPK_OPTSTRMASK; /* retain only -cfkvq */
 
-	/* Allocate all global buffers (for DYN_ALLOC option) */
-	ALLOC(uch, G1.l_buf, INBUFSIZ);
-	ALLOC(uch, G1.outbuf, OUTBUFSIZ);
-	ALLOC(ush, G1.d_buf, DIST_BUFSIZE);
-	ALLOC(uch, G1.window, 2L * WSIZE);
-	ALLOC(ush, G1.prev, 1L << BITS);
-
 	/* Initialize the CRC32 table */
 	global_crc32_new_table_le();
 
+#if ENABLE_FEATURE_USE_THREADS
+	/* -p1 is the same as no -p */
+	if (nthreads > 1) {
+		unsigned i;
+
+		G1.pool = bb_pool_new(nthreads);
+		G1.max_chunks = nthreads * CHUNKS_PER_THREAD;
+		G1.chunks = xzalloc(G1.max_chunks * sizeof(G1.chunks[0]));
+		for (i = 0; i < G1.max_chunks; i++)
+			G1.chunks[i].buf = xmalloc(WSIZE + CHUNK_SIZE);
+	}
+#endif
+
 	argv += optind;
 	return bbunpack(argv, pack_gzip, append_ext, "gz");
 }
@@ -580,6 +580,7 @@ static int read_bunzip(bunzip_data *bd, char *outbuf, int len)
 	const uint32_t *dbuf;
 	int pos, current, previous;
 	uint32_t CRC;
+	char *crc_start; /* output not yet accounted for in CRC starts here */
 
 	/* If we already have error/end indicator, return it */
 	if (bd->writeCount < 0)
@@ -591,6 +592,7 @@ static int read_bunzip(bunzip_data *bd, char *outbuf, int len)
 	pos = bd->writePos;
 	current = bd->writeCurrent;
 	CRC = bd->writeCRC; /* small loss on x86-32 (not enough regs), win on x86-64 */
+	crc_start = outbuf;
 
 	/* We will always have pending decoded data to write into the output
 	   buffer unless this is the very first call (in which case we haven't
@@ -612,9 +614,10 @@ static int read_bunzip(bunzip_data *bd, char *outbuf, int len)
 				goto outbuf_full;
 			}
 
-			/* Write next byte into output buffer, updating CRC */
+			/* Write next byte into output buffer.
+			 * CRC is updated later, for all written bytes at once:
+			 * crc32_block_endian1() is faster than bytewise update */
 			*outbuf++ = current;
-			CRC = (CRC << 8) ^ bd->crc32Table[(CRC >> 24) ^ current];
 
 			/* Loop now if we're outputting multiple copies of this byte */
 			if (bd->writeCopies) {
@@ -657,6 +660,7 @@ static int read_bunzip(bunzip_data *bd, char *outbuf, int len)
 		} /* for(;;) */
 
 		/* Decompression of this input block completed successfully */
+		CRC = crc32_block_endian1(CRC, crc_start, outbuf - crc_start, bd->crc32Table);
 		bd->writeCRC = CRC = ~CRC;
 		bd->totalCRC = ((bd->totalCRC << 1) | (bd->totalCRC >> 31)) ^ CRC;
 
@@ -677,6 +681,7 @@ static int read_bunzip(bunzip_data *bd, char *outbuf, int len)
 	}
 
 	CRC = ~0;
+	crc_start = outbuf;
 	pos = bd->writePos;
 	current = bd->writeCurrent;
 	goto decode_next_byte;
@@ -685,7 +690,7 @@ static int read_bunzip(bunzip_data *bd, char *outbuf, int len)
 	/* Output buffer is full, save cached state and return */
 	bd->writePos = pos;
 	bd->writeCurrent = current;
-	bd->writeCRC = CRC;
+	bd->writeCRC = crc32_block_endian1(CRC, crc_start, outbuf - crc_start, bd->crc32Table);
 
 	bd->writeCopies++;
 
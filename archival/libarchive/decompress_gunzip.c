@@ -52,6 +52,13 @@ enum {
 	/* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
 	BMAX = 16,	/* maximum bit length of any code (16 for explode) */
 	N_MAX = 288,	/* maximum number of codes in any set */
+#if ENABLE_FEATURE_GUNZIP_FAST
+	/* Lookup bits of the flat literal/length and distance tables */
+	FAST_LBITS = 10,
+	FAST_DBITS = 8,
+	/* Longest match */
+	MAX_MATCH = 258,
+#endif
 };
 
 
@@ -101,6 +108,11 @@ typedef struct state_t {
 	unsigned inflate_codes_bd;
 	unsigned inflate_codes_nn; /* length and index for copy */
 	unsigned inflate_codes_dd;
+#if ENABLE_FEATURE_GUNZIP_FAST
+	/* flat copies of the first levels of tl and td */
+	uint32_t inflate_fast_tl[1 << FAST_LBITS];
+	uint32_t inflate_fast_td[1 << FAST_DBITS];
+#endif
 
 	smallint resume_copy;
 
@@ -115,6 +127,13 @@ typedef struct state_t {
 	unsigned inflate_stored_k;
 	unsigned inflate_stored_w;
 
+#if ENABLE_FEATURE_GZIP_INDEX
+	gz_index_t *gunzip_index;
+	off_t gunzip_in_count;		/* bytes read from gunzip_src_fd */
+	uint64_t index_out;		/* output before this member */
+	smallint index_restore;		/* starting at a checkpoint */
+#endif
+
 	const char *error_msg;
 	jmp_buf error_jmp;
 } state_t;
@@ -144,6 +163,8 @@ typedef struct state_t {
 #define inflate_codes_bd    (S()inflate_codes_bd   )
 #define inflate_codes_nn    (S()inflate_codes_nn   )
 #define inflate_codes_dd    (S()inflate_codes_dd   )
+#define inflate_fast_tl     (S()inflate_fast_tl    )
+#define inflate_fast_td     (S()inflate_fast_td    )
 #define resume_copy         (S()resume_copy        )
 #define method              (S()method             )
 #define need_another_block  (S()need_another_block )
@@ -152,6 +173,10 @@ typedef struct state_t {
 #define inflate_stored_b    (S()inflate_stored_b   )
 #define inflate_stored_k    (S()inflate_stored_k   )
 #define inflate_stored_w    (S()inflate_stored_w   )
+#define gunzip_index        (S()gunzip_index       )
+#define gunzip_in_count     (S()gunzip_in_count    )
+#define index_out           (S()index_out          )
+#define index_restore       (S()index_restore      )
 #define error_msg           (S()error_msg          )
 #define error_jmp           (S()error_jmp          )
 
@@ -263,6 +288,7 @@ static unsigned fill_bitbuffer(STATE_PARAM unsigned bitbuffer, unsigned *current
 			}
 			if (to_read >= 0) /* unzip only */
 				to_read -= bytebuffer_size;
+			IF_FEATURE_GZIP_INDEX(gunzip_in_count += bytebuffer_size;)
 			bytebuffer_size += 4;
 			bytebuffer_offset = 4;
 		}
@@ -506,6 +532,174 @@ static huft_t* huft_build(const unsigned *b, const unsigned n,
 #define bd inflate_codes_bd
 #define nn inflate_codes_nn
 #define dd inflate_codes_dd
+
+#if ENABLE_FEATURE_GUNZIP_FAST
+/* Entries of the flat tables: bits of the whole code in bits 0-7,
+ * huft_t's e in bits 8-15, its v.n in bits 16-31.
+ * 0 means "code is longer than the table's index, use huft_t".
+ */
+#define FAST_ENTRY(bits, e, n) ((bits) | ((e) << 8) | ((uint32_t)(n) << 16))
+
+/* Decode the code in the low bits of b by walking the huft_t tables.
+ * Returns a flat table entry, or 0 if the code is invalid.
+ */
+static uint32_t huft_decode(huft_t *t, unsigned m, uint64_t b)
+{
+	unsigned used = 0;
+	unsigned e;
+
+	t += (unsigned) b & m;
+	e = t->e;
+	while (e > 16) {
+		if (e == 99)
+			return 0;
+		used += t->b;
+		e -= 16;
+		t = t->v.t + ((unsigned) (b >> used) & mask_bits[e]);
+		e = t->e;
+	}
+	return FAST_ENTRY(used + t->b, e, t->v.n);
+}
+
+static void build_fast_table(uint32_t *fast, unsigned bits, huft_t *t, unsigned m)
+{
+	unsigned j;
+
+	for (j = 0; j < (1 << bits); j++) {
+		uint32_t v = huft_decode(t, m, j);
+		fast[j] = ((v & 0xff) <= bits) ? v : 0;
+	}
+}
+
+/* Decode as many codes as possible while the input buffer has
+ * at least 8 bytes left and the window has room for a whole match.
+ * Bits are taken from the buffer 8 bytes at a time into a 64-bit
+ * bit buffer, which is refilled once per code; whole bytes which are
+ * left over in it are given back to the buffer on return.
+ * Returns 1 if end of block was reached.
+ */
+static int inflate_codes_fast(STATE_PARAM_ONLY)
+{
+	unsigned char *window = gunzip_window;
+	const unsigned char *in, *in_last;
+	uint64_t hold;
+	unsigned bits;
+	unsigned ww;
+	int eob = 0;
+
+	/* The whole bytes in bb must come from the current buffer fill */
+	if (w > GUNZIP_WSIZE - MAX_MATCH
+	 || bytebuffer_offset < 4 + (k >> 3)
+	 || bytebuffer_size < bytebuffer_offset + 8
+	) {
+		return 0;
+	}
+	in = &bytebuffer[bytebuffer_offset - (k >> 3)];
+	in_last = &bytebuffer[bytebuffer_size - 8];
+	bits = k & 7;
+	hold = bb & mask_bits[bits];
+	ww = w;
+
+	do {
+		uint32_t t;
+		unsigned e, n, d;
+		unsigned char *out;
+
+		/* Top up to 56..63 bits. Bits above that are
+		 * the beginning of *in, they are or'ed in again next time */
+#if BB_LITTLE_ENDIAN
+		{
+			uint64_t v;
+			memcpy(&v, in, 8);
+			hold |= v << bits;
+			in += (63 - bits) >> 3;
+			bits |= 56;
+		}
+#else
+		while (bits <= 56) {
+			hold |= (uint64_t) *in++ << bits;
+			bits += 8;
+		}
+#endif
+		/* 56 bits is enough for the longest length and distance
+		 * codes with their extra bits: 15+5 + 15+13 */
+		t = inflate_fast_tl[(unsigned) hold & ((1 << FAST_LBITS) - 1)];
+		if (!t) {
+			t = huft_decode(tl, ml, hold);
+			if (!t)
+				abort_unzip(PASS_STATE_ONLY);
+		}
+		hold >>= t & 0xff;
+		bits -= t & 0xff;
+		e = (t >> 8) & 0xff;
+		if (e == 16) {	/* literal */
+			window[ww++] = (unsigned char) (t >> 16);
+			continue;
+		}
+		if (e == 15) {	/* end of block */
+			eob = 1;
+			break;
+		}
+		n = (t >> 16) + ((unsigned) hold & mask_bits[e]);
+		hold >>= e;
+		bits -= e;
+
+		t = inflate_fast_td[(unsigned) hold & ((1 << FAST_DBITS) - 1)];
+		if (!t) {
+			t = huft_decode(td, md, hold);
+			if (!t)
+				abort_unzip(PASS_STATE_ONLY);
+		}
+		hold >>= t & 0xff;
+		bits -= t & 0xff;
+		e = (t >> 8) & 0xff;
+		d = (t >> 16) + ((unsigned) hold & mask_bits[e]);
+		hold >>= e;
+		bits -= e;
+
+		/* Copy n bytes from distance d. There is room for them
+		 * up to the end of the window, but the source wraps around
+		 * if it starts before the window's beginning */
+		out = window + ww;
+		if (d <= ww) {
+			const unsigned char *from = out - d;
+
+			if (d >= n) {
+				memcpy(out, from, n);
+			} else if (d == 1) {
+				memset(out, *from, n);
+			} else {
+				/* Overlapping: a chunk of d bytes at a time
+				 * is available, until the tail */
+				unsigned m = n;
+				while (m > d) {
+					memcpy(out, from, d);
+					out += d;
+					m -= d;
+				}
+				memcpy(out, from, m);
+			}
+		} else {
+			unsigned from = ww - d;
+			unsigned m = n;
+			do {
+				*out++ = window[from++ & (GUNZIP_WSIZE - 1)];
+			} while (--m);
+		}
+		ww += n;
+	} while (in <= in_last && ww <= GUNZIP_WSIZE - MAX_MATCH);
+
+	/* Give whole unused bytes back */
+	in -= bits >> 3;
+	bits &= 7;
+	bb = (unsigned) hold & mask_bits[bits];
+	k = bits;
+	bytebuffer_offset = in - bytebuffer;
+	w = ww;
+	return eob;
+}
+#endif
+
 static void inflate_codes_setup(STATE_PARAM unsigned my_bl, unsigned my_bd)
 {
 	bl = my_bl;
@@ -517,6 +711,10 @@ static void inflate_codes_setup(STATE_PARAM unsigned my_bl, unsigned my_bd)
 	/* inflate the coded data */
 	ml = mask_bits[bl];		/* precompute masks for speed */
 	md = mask_bits[bd];
+#if ENABLE_FEATURE_GUNZIP_FAST
+	build_fast_table(inflate_fast_tl, FAST_LBITS, tl, ml);
+	build_fast_table(inflate_fast_td, FAST_DBITS, td, md);
+#endif
 }
 /* called once from inflate_get_next_window */
 static NOINLINE int inflate_codes(STATE_PARAM_ONLY)
@@ -528,6 +726,10 @@ static NOINLINE int inflate_codes(STATE_PARAM_ONLY)
 		goto do_copy;
 
 	while (1) {			/* do until end of block */
+#if ENABLE_FEATURE_GUNZIP_FAST
+		if (inflate_codes_fast(PASS_STATE_ONLY))
+			break;
+#endif
 		bb = fill_bitbuffer(PASS_STATE bb, &k, bl);
 		t = tl + ((unsigned) bb & ml);
 		e = t->e;
@@ -663,7 +865,29 @@ static void inflate_stored_setup(STATE_PARAM int my_n, int my_b, int my_k)
 static int inflate_stored(STATE_PARAM_ONLY)
 {
 	/* read and output the compressed data */
-	while (inflate_stored_n--) {
+	while (inflate_stored_n != 0) {
+#if ENABLE_FEATURE_GUNZIP_FAST
+		/* Once bit buffer is empty, copy straight from the input buffer */
+		if (inflate_stored_k == 0 && bytebuffer_offset < bytebuffer_size) {
+			unsigned n = bytebuffer_size - bytebuffer_offset;
+
+			if (n > inflate_stored_n)
+				n = inflate_stored_n;
+			if (n > GUNZIP_WSIZE - inflate_stored_w)
+				n = GUNZIP_WSIZE - inflate_stored_w;
+			memcpy(gunzip_window + inflate_stored_w, &bytebuffer[bytebuffer_offset], n);
+			bytebuffer_offset += n;
+			inflate_stored_n -= n;
+			inflate_stored_w += n;
+			if (inflate_stored_w == GUNZIP_WSIZE) {
+				gunzip_outbuf_count = inflate_stored_w;
+				inflate_stored_w = 0;
+				return 1; /* We have a block */
+			}
+			continue;
+		}
+#endif
+		inflate_stored_n--;
 		inflate_stored_b = fill_bitbuffer(PASS_STATE inflate_stored_b, &inflate_stored_k, 8);
 		gunzip_window[inflate_stored_w++] = (unsigned char) inflate_stored_b;
 		if (inflate_stored_w == GUNZIP_WSIZE) {
@@ -952,6 +1176,39 @@ static void calculate_gunzip_crc(STATE_PARAM_ONLY)
 	gunzip_bytes_out += gunzip_outbuf_count;
 }
 
+#if ENABLE_FEATURE_GZIP_INDEX
+/* Between two blocks: record a checkpoint if it is time for one */
+static void add_index_point(STATE_PARAM_ONLY)
+{
+	uint64_t in_bits;
+
+	in_bits = (uint64_t)(gunzip_in_count - (bytebuffer_size - bytebuffer_offset)) * 8 - gunzip_bk;
+	gz_index_add(gunzip_index, in_bits,
+			index_out + gunzip_bytes_out + gunzip_outbuf_count,
+			gunzip_window, gunzip_outbuf_count);
+}
+
+/* Continue inflating from checkpoint gunzip_index->start */
+static void restore_index_point(STATE_PARAM_ONLY)
+{
+	unsigned i = gunzip_index->start;
+	uint64_t in_bits = gunzip_index->point[i].in_bits;
+	unsigned bits = in_bits & 7;
+
+	/* The window starts with the oldest byte, wraps around
+	 * to it at position 0 */
+	gz_index_read_window(gunzip_index, i, gunzip_window);
+	xlseek(gunzip_src_fd, in_bits >> 3, SEEK_SET);
+	gunzip_in_count = in_bits >> 3;
+	bytebuffer_offset = bytebuffer_size = 0;
+	if (bits) {
+		unsigned k = 0;
+		gunzip_bb = fill_bitbuffer(PASS_STATE 0, &k, 8) >> bits;
+		gunzip_bk = k - bits;
+	}
+}
+#endif
+
 /* One callsite in inflate_unzip_internal */
 static int inflate_get_next_window(STATE_PARAM_ONLY)
 {
@@ -967,6 +1224,10 @@ static int inflate_get_next_window(STATE_PARAM_ONLY)
 				/* NB: need_another_block is still set */
 				return 0; /* Last block */
 			}
+#if ENABLE_FEATURE_GZIP_INDEX
+			if (gunzip_index && gunzip_index->building)
+				add_index_point(PASS_STATE_ONLY);
+#endif
 			method = inflate_block(PASS_STATE &end_reached);
 			need_another_block = 0;
 		}
@@ -1024,9 +1285,27 @@ inflate_unzip_internal(STATE_PARAM transformer_state_t *xstate)
 		goto ret;
 	}
 
+#if ENABLE_FEATURE_GZIP_INDEX
+	gunzip_index = xstate->gz_index;
+	if (index_restore)
+		restore_index_point(PASS_STATE_ONLY);
+	else if (gunzip_index)
+		memset(gunzip_window, 0, GUNZIP_WSIZE); /* saved with checkpoints */
+#endif
+
 	while (1) {
 		int r = inflate_get_next_window(PASS_STATE_ONLY);
-		nwrote = transformer_write(xstate, gunzip_window, gunzip_outbuf_count);
+		unsigned char *out = gunzip_window;
+		unsigned count = gunzip_outbuf_count;
+#if ENABLE_FEATURE_GZIP_INDEX
+		if (xstate->gz_skip != 0) {
+			unsigned skip = xstate->gz_skip < count ? xstate->gz_skip : count;
+			out += skip;
+			count -= skip;
+			xstate->gz_skip -= skip;
+		}
+#endif
+		nwrote = transformer_write(xstate, out, count);
 		if (nwrote == (ssize_t)-1) {
 			n = -1;
 			goto ret;
@@ -1095,6 +1374,7 @@ static int top_up(STATE_PARAM unsigned n)
 			bb_simple_error_msg(bb_msg_read_error);
 			return 0;
 		}
+		IF_FEATURE_GZIP_INDEX(gunzip_in_count += bytebuffer_size;)
 		bytebuffer_size += count;
 		if (bytebuffer_size < n)
 			return 0;
@@ -1214,6 +1494,14 @@ unpack_gz_stream(transformer_state_t *xstate)
 	uint32_t v32;
 	IF_DESKTOP(long long) int total, n;
 	DECLARE_STATE;
+#if ENABLE_FEATURE_GZIP_INDEX
+	/* Starting at a checkpoint, not at the header? */
+	smallint restore = (xstate->gz_index
+			&& !xstate->gz_index->building && xstate->gz_index->start >= 0);
+
+	if (restore)
+		xstate->signature_skipped = 2;
+#endif
 
 #if !ENABLE_FEATURE_SEAMLESS_Z
 	if (check_signature16(xstate, GZIP_MAGIC))
@@ -1244,6 +1532,13 @@ unpack_gz_stream(transformer_state_t *xstate)
 	bytebuffer = xmalloc(bytebuffer_max);
 	gunzip_src_fd = xstate->src_fd;
 
+#if ENABLE_FEATURE_GZIP_INDEX
+	gunzip_in_count = 2; /* magic */
+	index_out = 0;
+	index_restore = restore;
+	if (restore)
+		goto inflate;
+#endif
  again:
 	if (!check_header_gzip(PASS_STATE xstate)) {
 		bb_simple_error_msg("corrupted data");
@@ -1251,6 +1546,9 @@ unpack_gz_stream(transformer_state_t *xstate)
 		goto ret;
 	}
 
+#if ENABLE_FEATURE_GZIP_INDEX
+ inflate:
+#endif
 	n = inflate_unzip_internal(PASS_STATE xstate);
 	if (n < 0) {
 		total = -1;
@@ -1264,6 +1562,15 @@ unpack_gz_stream(transformer_state_t *xstate)
 		goto ret;
 	}
 
+#if ENABLE_FEATURE_GZIP_INDEX
+	if (index_restore) {
+		/* Started in the middle, crc and length can't be checked */
+		index_restore = 0;
+		bytebuffer_offset += 8;
+		goto next;
+	}
+#endif
+
 	/* Validate decompression - crc */
 	v32 = buffer_read_le_u32(PASS_STATE_ONLY);
 	if ((~gunzip_crc) != v32) {
@@ -1279,6 +1586,10 @@ unpack_gz_stream(transformer_state_t *xstate)
 		total = -1;
 	}
 
+#if ENABLE_FEATURE_GZIP_INDEX
+ next:
+	index_out += gunzip_bytes_out;
+#endif
 	if (!top_up(PASS_STATE 2))
 		goto ret; /* EOF */
 
@@ -0,0 +1,175 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Index of inflate checkpoints for random access to .gz files,
+ * the idea is from zran.c in zlib's examples.
+ *
+ * Licensed under GPLv2 or later, see file LICENSE in this source tree.
+ */
+#include "libbb.h"
+#include "bb_archive.h"
+
+/* File layout (numbers are little-endian):
+ * "BBGZIDX1"
+ * 32k window of every checkpoint
+ * u64 in_bits, u64 out of every checkpoint
+ * u64 .gz file size, u64 count of checkpoints, "BBGZIDX1"
+ * Windows are written as they come, the table at the end.
+ */
+#define GZ_INDEX_MAGIC "BBGZIDX1"
+enum {
+	HEADER_SIZE = 8,
+	TRAILER_SIZE = 24,
+};
+
+static off_t window_offset(unsigned i)
+{
+	return HEADER_SIZE + (off_t)i * GZ_INDEX_WSIZE;
+}
+
+gz_index_t* FAST_FUNC gz_index_create(const char *name, uint64_t span)
+{
+	gz_index_t *idx = xzalloc(sizeof(*idx));
+
+	idx->fd = xopen(name, O_WRONLY | O_CREAT | O_TRUNC);
+	idx->span = span;
+	idx->building = 1;
+	xwrite(idx->fd, GZ_INDEX_MAGIC, HEADER_SIZE);
+	return idx;
+}
+
+/* window[pos] is the oldest byte of the circular window */
+void FAST_FUNC gz_index_add(gz_index_t *idx, uint64_t in_bits, uint64_t out,
+		const uint8_t *window, unsigned pos)
+{
+	if (out < (idx->count ? idx->point[idx->count - 1].out : 0) + idx->span)
+		return;
+	xwrite(idx->fd, window + pos, GZ_INDEX_WSIZE - pos);
+	xwrite(idx->fd, window, pos);
+	idx->point = xrealloc_vector(idx->point, 6, idx->count);
+	idx->point[idx->count].in_bits = in_bits;
+	idx->point[idx->count].out = out;
+	idx->count++;
+}
+
+void FAST_FUNC gz_index_finish(gz_index_t *idx, int gz_fd)
+{
+	struct stat st;
+	uint64_t v64;
+	unsigned i;
+
+	for (i = 0; i < idx->count; i++) {
+		v64 = SWAP_LE64(idx->point[i].in_bits);
+		xwrite(idx->fd, &v64, 8);
+		v64 = SWAP_LE64(idx->point[i].out);
+		xwrite(idx->fd, &v64, 8);
+	}
+	/* 0: unknown (pipe) */
+	v64 = (fstat(gz_fd, &st) == 0 && S_ISREG(st.st_mode)) ? SWAP_LE64((uint64_t)st.st_size) : 0;
+	xwrite(idx->fd, &v64, 8);
+	v64 = SWAP_LE64((uint64_t)idx->count);
+	xwrite(idx->fd, &v64, 8);
+	xwrite(idx->fd, GZ_INDEX_MAGIC, 8);
+	xclose(idx->fd);
+	free(idx->point);
+	free(idx);
+}
+
+gz_index_t* FAST_FUNC gz_index_open(const char *name)
+{
+	gz_index_t *idx = xzalloc(sizeof(*idx));
+	uint64_t *table;
+	uint64_t trailer[3];
+	unsigned i;
+	off_t size;
+
+	idx->fd = xopen(name, O_RDONLY);
+	size = xlseek(idx->fd, 0, SEEK_END);
+	if (size < HEADER_SIZE + TRAILER_SIZE)
+		goto bad;
+	xlseek(idx->fd, size - TRAILER_SIZE, SEEK_SET);
+	xread(idx->fd, trailer, TRAILER_SIZE);
+	if (memcmp(&trailer[2], GZ_INDEX_MAGIC, 8) != 0)
+		goto bad;
+	idx->gz_size = SWAP_LE64(trailer[0]);
+	idx->count = SWAP_LE64(trailer[1]);
+	if ((uint64_t)size != window_offset(idx->count) + (uint64_t)idx->count * 16 + TRAILER_SIZE
+	 || idx->count != SWAP_LE64(trailer[1])
+	)
+		goto bad;
+
+	table = xmalloc((size_t)idx->count * 16);
+	xlseek(idx->fd, window_offset(idx->count), SEEK_SET);
+	xread(idx->fd, table, (size_t)idx->count * 16);
+	idx->point = xmalloc(idx->count * sizeof(idx->point[0]));
+	for (i = 0; i < idx->count; i++) {
+		idx->point[i].in_bits = SWAP_LE64(table[2 * i]);
+		idx->point[i].out = SWAP_LE64(table[2 * i + 1]);
+	}
+	free(table);
+	idx->start = -1;
+	return idx;
+ bad:
+	bb_error_msg_and_die("%s: not a gzip index", name);
+}
+
+/* The window is returned oldest byte first */
+void FAST_FUNC gz_index_read_window(gz_index_t *idx, unsigned i, uint8_t *window)
+{
+	xlseek(idx->fd, window_offset(i), SEEK_SET);
+	xread(idx->fd, window, GZ_INDEX_WSIZE);
+}
+
+#if ENABLE_FEATURE_TAR_GZ_INDEX
+/* Make fd read uncompressed data of gz_fd from position target on,
+ * by (re)starting a child which unpacks it from the nearest checkpoint.
+ * gz_fd is used only by the child. The caller's fd is at position cur.
+ * If no checkpoint is worth jumping to and a child already runs,
+ * returns 0: read up to target.
+ */
+int FAST_FUNC gz_index_reader(gz_index_t *idx, int gz_fd, int fd,
+		uint64_t cur, uint64_t target)
+{
+	struct fd_pair fd_pipe;
+	int i;
+
+	/* The last checkpoint at or before target */
+	for (i = idx->count - 1; i >= 0; i--)
+		if (idx->point[i].out <= target)
+			break;
+	if (idx->pid) {
+		/* Restarting costs about as much as
+		 * decompressing a few windows */
+		if (i < 0 || idx->point[i].out < cur + 4 * GZ_INDEX_WSIZE)
+			return 0;
+		kill(idx->pid, SIGKILL);
+		waitpid(idx->pid, NULL, 0);
+	} else {
+		struct stat st;
+
+		xfstat(gz_fd, &st, "gzip file");
+		if (idx->gz_size != 0 && (uint64_t)st.st_size != idx->gz_size)
+			bb_simple_error_msg_and_die("index does not match gzip file");
+	}
+
+	xpiped_pair(fd_pipe);
+	idx->pid = xfork();
+	if (idx->pid == 0) {
+		/* Child */
+		transformer_state_t xstate;
+
+		close(fd_pipe.rd);
+		init_transformer_state(&xstate);
+		xstate.src_fd = gz_fd;
+		xstate.dst_fd = fd_pipe.wr;
+		xstate.gz_index = idx;
+		idx->start = i;
+		if (i < 0)
+			xlseek(gz_fd, 0, SEEK_SET);
+		xstate.gz_skip = target - (i >= 0 ? idx->point[i].out : 0);
+		_exit(/*error if:*/ unpack_gz_stream(&xstate) < 0);
+	}
+	close(fd_pipe.wr);
+	xmove_fd(fd_pipe.rd, fd);
+	return 1;
+}
+#endif
@@ -89,6 +89,15 @@
 //config:	the contents of each extracted file to the standard input of an
 //config:	external program.
 //config:
+//config:config FEATURE_TAR_GZ_INDEX
+//config:	bool "Skip through .tar.gz using gunzip --index (--index=IDX)"
+//config:	default y
+//config:	depends on TAR && FEATURE_TAR_LONG_OPTIONS && FEATURE_SEAMLESS_GZ
+//config:	depends on FEATURE_GZIP_INDEX && !NOMMU && !PLATFORM_MINGW32
+//config:	help
+//config:	"tar -xzf FILE.tar.gz --index=IDX MEMBER" decompresses
+//config:	from the checkpoint nearest to MEMBER, not from the start.
+//config:
 //config:config FEATURE_TAR_UNAME_GNAME
 //config:	bool "Enable use of user and group names"
 //config:	default y
@@ -811,6 +820,7 @@ static llist_t *append_file_list_to_list(llist_t *list)
 //usage:	"vokO] "
 //usage:	"[-f TARFILE] [-C DIR] "
 //usage:	IF_FEATURE_TAR_FROM("[-T FILE] [-X FILE] "IF_FEATURE_TAR_LONG_OPTIONS("[--exclude PATTERN]... "))
+//usage:	IF_FEATURE_TAR_GZ_INDEX("[--index IDX] ")
 //usage:	"[FILE]..."
 //usage:#define tar_full_usage "\n\n"
 //usage:	IF_FEATURE_TAR_CREATE("Create, extract, ")
@@ -855,6 +865,9 @@ static llist_t *append_file_list_to_list(llist_t *list)
 //usage:     "\n	--exclude PATTERN	Glob pattern to exclude"
 //usage:	)
 //usage:	)
+//usage:	IF_FEATURE_TAR_GZ_INDEX(
+//usage:     "\n	--index IDX	With -z: skip using index made by gunzip --index"
+//usage:	)
 //usage:
 //usage:#define tar_example_usage
 //usage:       "$ zcat /tmp/tarball.tar.gz | tar -xf -\n"
@@ -890,6 +903,7 @@ enum {
 	OPTBIT_NUMERIC_OWNER,
 	OPTBIT_NOPRESERVE_PERM,
 	OPTBIT_OVERWRITE,
+	IF_FEATURE_TAR_GZ_INDEX(OPTBIT_INDEX        ,)
 #endif
 	OPT_TEST         = 1 << 0, // t
 	OPT_EXTRACT      = 1 << 1, // x
@@ -917,6 +931,7 @@ enum {
 	OPT_NUMERIC_OWNER    = IF_FEATURE_TAR_LONG_OPTIONS((1 << OPTBIT_NUMERIC_OWNER  )) + 0, // numeric-owner
 	OPT_NOPRESERVE_PERM  = IF_FEATURE_TAR_LONG_OPTIONS((1 << OPTBIT_NOPRESERVE_PERM)) + 0, // no-same-permissions
 	OPT_OVERWRITE        = IF_FEATURE_TAR_LONG_OPTIONS((1 << OPTBIT_OVERWRITE      )) + 0, // overwrite
+	OPT_INDEX            = IF_FEATURE_TAR_GZ_INDEX(    (1 << OPTBIT_INDEX          )) + 0, // index
 
 	OPT_ANY_COMPRESS = (OPT_BZIP2 | OPT_LZMA | OPT_GZIP | OPT_XZ | OPT_COMPRESS),
 };
@@ -972,6 +987,9 @@ static const char tar_longopts[] ALIGN1 =
 	"no-same-permissions\0" No_argument       "\xfd"
 	/* on unpack, open with O_TRUNC and !O_EXCL */
 	"overwrite\0"           No_argument       "\xfe"
+# if ENABLE_FEATURE_TAR_GZ_INDEX
+	"index\0"               Required_argument "\xf7"
+# endif
 	/* --exclude takes next bit position in option mask, */
 	/* therefore we have to put it _after_ --no-same-permissions */
 # if ENABLE_FEATURE_TAR_FROM
@@ -985,6 +1003,21 @@ static const char tar_longopts[] ALIGN1 =
 # define LONGOPTS
 #endif
 
+#if ENABLE_FEATURE_TAR_GZ_INDEX
+static gz_index_t *gz_index;
+static archive_handle_t *gz_index_handle;
+static int gz_index_fd;
+
+/* Skipping data: jump to a checkpoint if there is one far enough */
+static void FAST_FUNC seek_by_gz_index(int fd, off_t amount)
+{
+	off_t cur = gz_index_handle->offset;
+
+	if (!gz_index_reader(gz_index, gz_index_fd, fd, cur, cur + amount))
+		seek_by_read(fd, amount);
+}
+#endif
+
 int tar_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int tar_main(int argc UNUSED_PARAM, char **argv)
 {
@@ -996,6 +1029,7 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 #if ENABLE_FEATURE_TAR_LONG_OPTIONS && ENABLE_FEATURE_TAR_FROM
 	llist_t *excludes = NULL;
 #endif
+	IF_FEATURE_TAR_GZ_INDEX(const char *index_name;)
 	INIT_G();
 
 	/* Initialise default values */
@@ -1077,6 +1111,7 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 		, &tar_handle->tar__strip_components // --strip-components
 #endif
 		IF_FEATURE_TAR_TO_COMMAND(, &(tar_handle->tar__to_command)) // --to-command
+		IF_FEATURE_TAR_GZ_INDEX(, &index_name) // --index
 #if ENABLE_FEATURE_TAR_LONG_OPTIONS && ENABLE_FEATURE_TAR_FROM
 		, &excludes // --exclude
 #endif
@@ -1112,6 +1147,7 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 	showopt(OPT_NUMERIC_OWNER   );
 	showopt(OPT_NOPRESERVE_PERM );
 	showopt(OPT_OVERWRITE       );
+	showopt(OPT_INDEX           );
 	showopt(OPT_ANY_COMPRESS    );
 	bb_error_msg("base_dir:'%s'", base_dir);
 	bb_error_msg("tar_filename:'%s'", tar_filename);
@@ -1243,6 +1279,20 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 		}
 	}
 
+#if ENABLE_FEATURE_TAR_GZ_INDEX
+	if (opt & OPT_INDEX) {
+		/* Checkpoints are positions in FILE and in its tar stream */
+		if ((opt & (OPT_CREATE | OPT_ANY_COMPRESS)) != OPT_GZIP || LONE_DASH(tar_filename))
+			bb_simple_error_msg_and_die("--index needs -z and -f FILE");
+		gz_index = gz_index_open(index_name);
+		gz_index_handle = tar_handle;
+		gz_index_fd = xopen(tar_filename, O_RDONLY);
+		gz_index_reader(gz_index, gz_index_fd, tar_handle->src_fd, 0, 0);
+		tar_handle->seek = seek_by_gz_index;
+		opt &= ~OPT_ANY_COMPRESS; /* already decompressed */
+	}
+#endif
+
 	if (base_dir)
 		xchdir(base_dir);
 
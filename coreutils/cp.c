@@ -26,9 +26,14 @@
 //config:	Also add support for --parents option.
 //config:
 //config:config FEATURE_CP_REFLINK
-//config:	bool "Enable --reflink[=auto]"
+//config:	bool "Enable --reflink[=auto|always|never]"
 //config:	default y
 //config:	depends on FEATURE_CP_LONG_OPTIONS
+//config:	help
+//config:	On filesystems with copy-on-write (btrfs, xfs...), share
+//config:	data blocks of the copy with the source (FICLONE ioctl).
+//config:	This is done by default, --reflink=always fails if it
+//config:	is not possible, --reflink=never always copies data.
 
 //applet:IF_CP(APPLET_NOEXEC(cp, cp, BB_DIR_BIN, BB_SUID_DROP, cp))
 /* NOEXEC despite cases when it can be a "runner" (cp -r LARGE_DIR NEW_DIR) */
@@ -55,6 +60,11 @@
 //usage:     "\n	-l,-s	Create (sym)links"
 //usage:     "\n	-T	Treat DEST as a normal file"
 //usage:     "\n	-u	Copy only newer files"
+//usage:     "\n	-j N	Copy N files in parallel"
+//usage:	IF_FEATURE_CP_REFLINK(
+//usage:     "\n	--reflink[=always|auto|never]"
+//usage:     "\n		Share data blocks with SOURCE (default: auto)"
+//usage:	)
 
 #include "libbb.h"
 #include "libcoreutils/coreutils.h"
@@ -72,8 +82,11 @@ int cp_main(int argc, char **argv)
 	int d_flags;
 	int flags;
 	int status;
+	unsigned jobs = 0;
 	enum {
 		FILEUTILS_CP_OPTNUM = sizeof(FILEUTILS_CP_OPTSTR)-1,
+		/* -j is removed from flags right after getopt32 */
+		OPT_jobs = 1 << FILEUTILS_CP_OPTNUM,
 #if ENABLE_FEATURE_CP_LONG_OPTIONS
 		/*OPT_rmdest  = FILEUTILS_RMDEST = 1 << FILEUTILS_CP_OPTNUM */
 		OPT_parents = 1 << (FILEUTILS_CP_OPTNUM+1),
@@ -86,7 +99,7 @@ int cp_main(int argc, char **argv)
 	char *reflink = NULL;
 # endif
 	flags = getopt32long(argv, "^"
-		FILEUTILS_CP_OPTSTR
+		FILEUTILS_CP_OPTSTR "j:+"
 		"\0"
 		// Need at least two arguments
 		// Soft- and hardlinking doesn't mix
@@ -110,9 +123,15 @@ int cp_main(int argc, char **argv)
 		"parents\0"        No_argument "\xfe"
 # if ENABLE_FEATURE_CP_REFLINK
 		"reflink\0"        Optional_argument "\xfd"
+# endif
+		, &jobs
+# if ENABLE_FEATURE_CP_REFLINK
 		, &reflink
 # endif
 	);
+	/* Close the gap left by -j, long options must be where
+	 * FILEUTILS_xxx expect them */
+	flags = (flags & (OPT_jobs - 1)) | ((unsigned)flags >> 1 & ~(OPT_jobs - 1));
 # if ENABLE_FEATURE_CP_REFLINK
 	BUILD_BUG_ON((int)OPT_reflink != (int)FILEUTILS_REFLINK);
 	if (flags & FILEUTILS_REFLINK) {
@@ -120,16 +139,20 @@ int cp_main(int argc, char **argv)
 			flags |= FILEUTILS_REFLINK_ALWAYS;
 		else if (strcmp(reflink, "always") == 0)
 			flags |= FILEUTILS_REFLINK_ALWAYS;
+		else if (strcmp(reflink, "never") == 0)
+			flags |= FILEUTILS_REFLINK_NEVER;
 		else if (strcmp(reflink, "auto") != 0)
 			bb_show_usage();
 	}
 # endif
 #else
 	flags = getopt32(argv, "^"
-		FILEUTILS_CP_OPTSTR
+		FILEUTILS_CP_OPTSTR "j:+"
 		"\0"
-		"-2:l--s:s--l:Pd:rRd:Rd:apdR"
+		"-2:l--s:s--l:Pd:rRd:Rd:apdR",
+		&jobs
 	);
+	flags &= ~OPT_jobs;
 #endif
 	/* Options of cp from GNU coreutils 6.10:
 	 * -a, --archive
@@ -194,6 +217,13 @@ int cp_main(int argc, char **argv)
 	}
 #endif
 
+	/* --parents creates directories with umask games,
+	 * that does not mix with threads creating files */
+#if ENABLE_FEATURE_CP_LONG_OPTIONS
+	if (!(flags & OPT_parents))
+#endif
+		copy_file_jobs(jobs);
+
 	status = EXIT_SUCCESS;
 	last = argv[argc - 1];
 	/* If there are only two arguments and...  */
@@ -266,6 +296,8 @@ int cp_main(int argc, char **argv)
 		/* don't move up: dest may be == last and not malloced! */
 		free((void*)dest);
 	}
+	if (copy_file_finish() < 0)
+		status = EXIT_FAILURE;
 
 	/* Exit. We are NOEXEC, not NOFORK. We do exit at the end of main() */
 	return status;
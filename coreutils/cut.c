@@ -66,21 +66,30 @@ static int cmpfunc(const void *a, const void *b)
 			((struct cut_list *) b)->startpos);
 }
 
-static void cut_file(FILE *file, char delim, const struct cut_list *cut_lists, unsigned nlists)
+static void cut_file(int fd, char delim, const struct cut_list *cut_lists, unsigned nlists)
 {
 	char *line;
+	size_t len;
 	unsigned linenum = 0;	/* keep these zero-based to be consistent */
+	char *printed = NULL;
+	size_t printed_size = 0;
+	struct line_reader *lr = line_reader_new(fd, LR_STOP_AT_NUL);
 
 	/* go through every line in the file */
-	while ((line = xmalloc_fgetline(file)) != NULL) {
+	while ((line = line_reader_getline(lr, &len)) != NULL) {
 
 		/* set up a list so we can keep track of what's been printed */
-		int linelen = strlen(line);
-		char *printed = xzalloc(linelen + 1);
-		char *orig_line = line;
+		int linelen = len;
 		unsigned cl_pos = 0;
 		int spos;
 
+		if (len >= printed_size) {
+			printed_size = len + 1;
+			free(printed);
+			printed = xmalloc(printed_size);
+		}
+		memset(printed, 0, len + 1);
+
 		/* cut based on chars/bytes XXX: only works when sizeof(char) == byte */
 		if (option_mask32 & (CUT_OPT_CHAR_FLGS | CUT_OPT_BYTE_FLGS)) {
 			/* print the chars specified in each cut list */
@@ -186,9 +195,9 @@ static void cut_file(FILE *file, char delim, const struct cut_list *cut_lists, u
 		putchar('\n');
  next_line:
 		linenum++;
-		free(printed);
-		free(orig_line);
 	}
+	free(printed);
+	line_reader_free(lr);
 }
 
 int cut_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
@@ -303,13 +312,14 @@ int cut_main(int argc UNUSED_PARAM, char **argv)
 			*--argv = (char *)"-";
 
 		do {
-			FILE *file = fopen_or_warn_stdin(*argv);
-			if (!file) {
+			int fd = open_or_warn_stdin(*argv);
+			if (fd < 0) {
 				retval = EXIT_FAILURE;
 				continue;
 			}
-			cut_file(file, delim, cut_lists, nlists);
-			fclose_if_not_stdin(file);
+			cut_file(fd, delim, cut_lists, nlists);
+			if (fd != STDIN_FILENO)
+				close(fd);
 		} while (*++argv);
 
 		if (ENABLE_FEATURE_CLEAN_UP)
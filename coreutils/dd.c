@@ -43,6 +43,8 @@
 //config:	help
 //config:	Enable support for writing a certain number of bytes in and out,
 //config:	at a time, and performing conversions on the data stream.
+//config:	Also enables bufs=N, O_DIRECT I/O (iflag=direct, oflag=direct)
+//config:	and conv=sparse.
 //config:
 //config:config FEATURE_DD_STATUS
 //config:	bool "Enable status display options"
@@ -58,8 +60,8 @@
 //usage:#define dd_trivial_usage
 //usage:       "[if=FILE] [of=FILE] [" IF_FEATURE_DD_IBS_OBS("ibs=N obs=N/") "bs=N] [count=N] [skip=N] [seek=N]\n"
 //usage:	IF_FEATURE_DD_IBS_OBS(
-//usage:       "	[conv=notrunc|noerror|sync|fsync]\n"
-//usage:       "	[iflag=skip_bytes|fullblock] [oflag=seek_bytes|append]"
+//usage:       "	[conv=notrunc|noerror|sync|fsync|sparse] [bufs=N]\n"
+//usage:       "	[iflag=skip_bytes|fullblock|direct] [oflag=seek_bytes|append|direct]"
 //usage:	)
 //usage:#define dd_full_usage "\n\n"
 //usage:       "Copy a file with converting and formatting\n"
@@ -81,10 +83,14 @@
 //usage:     "\n	conv=sync	Pad blocks with zeros"
 //usage:     "\n	conv=fsync	Physically write data out before finishing"
 //usage:     "\n	conv=swab	Swap every pair of bytes"
+//usage:     "\n	conv=sparse	Seek over blocks of zeros instead of writing them"
+//usage:     "\n	bufs=N		Read up to N blocks ahead of writing"
 //usage:     "\n	iflag=skip_bytes	skip=N is in bytes"
 //usage:     "\n	iflag=fullblock	Read full blocks"
+//usage:     "\n	iflag=direct	Read with O_DIRECT"
 //usage:     "\n	oflag=seek_bytes	seek=N is in bytes"
 //usage:     "\n	oflag=append	Open output file in append mode"
+//usage:     "\n	oflag=direct	Write with O_DIRECT"
 //usage:	)
 //usage:	IF_FEATURE_DD_STATUS(
 //usage:     "\n	status=noxfer	Suppress rate output"
@@ -106,6 +112,17 @@
 
 /* This is a NOEXEC applet. Be very careful! */
 
+#ifndef O_DIRECT
+# define O_DIRECT 0
+#endif
+
+/* Buffers are aligned for O_DIRECT */
+#define DD_ALIGN 4096
+/* Without bufs=N, read ahead only if blocks are big enough:
+ * handing small blocks over between threads costs more than it saves */
+#define DD_READAHEAD_MIN_BS  (64 * 1024)
+#define DD_READAHEAD_BUFS    2
+#define DD_READAHEAD_MAX_MEM (64 * 1024 * 1024)
 
 enum {
 	ifd = STDIN_FILENO,
@@ -119,6 +136,10 @@ struct globals {
 	unsigned long long begin_time_us;
 #endif
 	int flags;
+	smallint out_hole; /* conv=sparse: output ends with a seek */
+	/* Used only by the reader (dd_read() tasks): */
+	smallint in_eof;
+	size_t ibs;
 } FIX_ALIASING;
 #define G (*(struct globals*)bb_common_bufsiz1)
 #define INIT_G() do { \
@@ -135,23 +156,71 @@ enum {
 	FLAG_NOERROR = (1 << 2) * ENABLE_FEATURE_DD_IBS_OBS,
 	FLAG_FSYNC   = (1 << 3) * ENABLE_FEATURE_DD_IBS_OBS,
 	FLAG_SWAB    = (1 << 4) * ENABLE_FEATURE_DD_IBS_OBS,
+	FLAG_SPARSE  = (1 << 5) * ENABLE_FEATURE_DD_IBS_OBS,
 	/* end of conv flags */
 	/* start of input flags */
-	FLAG_IFLAG_SHIFT = 5,
-	FLAG_SKIP_BYTES = (1 << 5) * ENABLE_FEATURE_DD_IBS_OBS,
-	FLAG_FULLBLOCK = (1 << 6) * ENABLE_FEATURE_DD_IBS_OBS,
+	FLAG_IFLAG_SHIFT = 6,
+	FLAG_SKIP_BYTES = (1 << 6) * ENABLE_FEATURE_DD_IBS_OBS,
+	FLAG_FULLBLOCK = (1 << 7) * ENABLE_FEATURE_DD_IBS_OBS,
+	FLAG_IDIRECT = (1 << 8) * ENABLE_FEATURE_DD_IBS_OBS,
 	/* end of input flags */
 	/* start of output flags */
-	FLAG_OFLAG_SHIFT = 7,
-	FLAG_SEEK_BYTES = (1 << 7) * ENABLE_FEATURE_DD_IBS_OBS,
-	FLAG_APPEND = (1 << 8) * ENABLE_FEATURE_DD_IBS_OBS,
+	FLAG_OFLAG_SHIFT = 9,
+	FLAG_SEEK_BYTES = (1 << 9) * ENABLE_FEATURE_DD_IBS_OBS,
+	FLAG_APPEND = (1 << 10) * ENABLE_FEATURE_DD_IBS_OBS,
+	FLAG_ODIRECT = (1 << 11) * ENABLE_FEATURE_DD_IBS_OBS,
 	/* end of output flags */
-	FLAG_TWOBUFS = (1 << 9) * ENABLE_FEATURE_DD_IBS_OBS,
-	FLAG_COUNT   = 1 << 10,
-	FLAG_STATUS_NONE = 1 << 11,
-	FLAG_STATUS_NOXFER = 1 << 12,
+	FLAG_TWOBUFS = (1 << 12) * ENABLE_FEATURE_DD_IBS_OBS,
+	FLAG_COUNT   = 1 << 13,
+	FLAG_STATUS_NONE = 1 << 14,
+	FLAG_STATUS_NOXFER = 1 << 15,
+};
+
+/* Input block. Blocks are read by a reader thread, in order,
+ * while the main thread writes out the previous ones */
+struct dd_block {
+	bb_task task;
+	char *buf;
+	ssize_t n;
+	int err; /* errno if n < 0 */
 };
 
+static void FAST_FUNC dd_read(bb_task *task)
+{
+	struct dd_block *b = (struct dd_block *)task;
+	ssize_t n = 0;
+
+	/* Don't read past EOF or a fatal error: on a tty,
+	 * this would wait for more input */
+	if (!G.in_eof) {
+#if ENABLE_FEATURE_DD_IBS_OBS
+		if (G.flags & FLAG_FULLBLOCK)
+			n = full_read(ifd, b->buf, G.ibs);
+		else
+#endif
+			n = safe_read(ifd, b->buf, G.ibs);
+		b->err = errno;
+		if (n == 0)
+			G.in_eof = 1;
+		if (n < 0) {
+			if (!(G.flags & FLAG_NOERROR))
+				G.in_eof = 1;
+			else
+				/* GNU dd with conv=noerror skips over bad blocks */
+				xlseek(ifd, G.ibs, SEEK_CUR);
+		}
+	}
+	b->n = n;
+}
+
+#if ENABLE_FEATURE_DD_IBS_OBS
+static int is_zero_block(const char *buf, size_t len)
+{
+	/* len is 0 after a bad block with conv=noerror */
+	return len != 0 && buf[0] == 0 && memcmp(buf, buf + 1, len - 1) == 0;
+}
+#endif
+
 static void dd_output_status(int UNUSED_PARAM cur_signal)
 {
 #if ENABLE_FEATURE_DD_THIRD_STATUS_LINE
@@ -200,7 +269,24 @@ static bool write_and_stats(const void *buf, size_t len, size_t obs,
 {
 	ssize_t n;
 
+#if ENABLE_FEATURE_DD_IBS_OBS
+	if ((G.flags & FLAG_SPARSE) && is_zero_block(buf, len)
+	 && lseek(ofd, len, SEEK_CUR) >= 0
+	) {
+		n = len;
+		G.out_hole = 1;
+	} else {
+		if ((G.flags & FLAG_ODIRECT) && len != obs) {
+			/* The last, partial block: its size
+			 * may be not acceptable for O_DIRECT */
+			fcntl(ofd, F_SETFL, fcntl(ofd, F_GETFL) & ~O_DIRECT);
+		}
+		n = full_write(ofd, buf, len);
+		G.out_hole = 0;
+	}
+#else
 	n = full_write(ofd, buf, len);
+#endif
 #if ENABLE_FEATURE_DD_THIRD_STATUS_LINE
 	if (n > 0)
 		G.total_bytes += n;
@@ -263,16 +349,16 @@ int dd_main(int argc UNUSED_PARAM, char **argv)
 	static const char keywords[] ALIGN1 =
 		"bs\0""count\0""seek\0""skip\0""if\0""of\0"IF_FEATURE_DD_STATUS("status\0")
 #if ENABLE_FEATURE_DD_IBS_OBS
-		"ibs\0""obs\0""conv\0""iflag\0""oflag\0"
+		"ibs\0""obs\0""conv\0""iflag\0""oflag\0""bufs\0"
 #endif
 		;
 #if ENABLE_FEATURE_DD_IBS_OBS
 	static const char conv_words[] ALIGN1 =
-		"notrunc\0""sync\0""noerror\0""fsync\0""swab\0";
+		"notrunc\0""sync\0""noerror\0""fsync\0""swab\0""sparse\0";
 	static const char iflag_words[] ALIGN1 =
-		"skip_bytes\0""fullblock\0";
+		"skip_bytes\0""fullblock\0""direct\0";
 	static const char oflag_words[] ALIGN1 =
-		"seek_bytes\0append\0";
+		"seek_bytes\0append\0""direct\0";
 #endif
 #if ENABLE_FEATURE_DD_STATUS
 	static const char status_words[] ALIGN1 =
@@ -292,12 +378,14 @@ int dd_main(int argc UNUSED_PARAM, char **argv)
 		OP_conv,
 		OP_iflag,
 		OP_oflag,
+		OP_bufs,
 		/* Must be in the same order as FLAG_XXX! */
 		OP_conv_notrunc = 0,
 		OP_conv_sync,
 		OP_conv_noerror,
 		OP_conv_fsync,
 		OP_conv_swab,
+		OP_conv_sparse,
 	/* Unimplemented conv=XXX: */
 	//nocreat       do not create the output file
 	//excl          fail if the output file already exists
@@ -313,13 +401,21 @@ int dd_main(int argc UNUSED_PARAM, char **argv)
 	//swab          swap every pair of input bytes: will abort on non-even reads
 		OP_iflag_skip_bytes,
 		OP_iflag_fullblock,
+		OP_iflag_direct,
 		OP_oflag_seek_bytes,
+		OP_oflag_append,
+		OP_oflag_direct,
 #endif
 	};
 	smallint exitcode = EXIT_FAILURE;
 	int i;
 	size_t ibs = 512;
 	char *ibuf;
+	char *mem;
+	struct dd_block *blocks;
+	bb_pool *pool;
+	unsigned nbufs = 0, in_flight;
+	off_t nread;
 #if ENABLE_FEATURE_DD_IBS_OBS
 	size_t obs = 512;
 	char *obuf;
@@ -389,6 +485,10 @@ int dd_main(int argc UNUSED_PARAM, char **argv)
 			G.flags |= parse_comma_flags(val, oflag_words, "oflag") << FLAG_OFLAG_SHIFT;
 			/*continue;*/
 		}
+		if (what == OP_bufs) {
+			nbufs = xatou_range(val, 1, 1024);
+			/*continue;*/
+		}
 #endif
 		if (what == OP_bs) {
 			ibs = xatoul_range_sfx(val, 1, ULONG_MAX/2, cwbkMG_suffixes);
@@ -429,15 +529,44 @@ int dd_main(int argc UNUSED_PARAM, char **argv)
 #endif
 	} /* end of "for (argv[i])" */
 
+	if (nbufs == 0) {
+		nbufs = 1;
+		if (ENABLE_FEATURE_USE_THREADS && ibs >= DD_READAHEAD_MIN_BS) {
+			nbufs = DD_READAHEAD_MAX_MEM / ibs;
+			nbufs = MIN(nbufs, DD_READAHEAD_BUFS);
+			if (nbufs == 0)
+				nbufs = 1;
+		}
+	}
+	G.ibs = ibs;
+
 //XXX:FIXME for huge ibs or obs, malloc'ing them isn't the brightest idea ever
-	ibuf = xmalloc(ibs);
-	obuf = ibuf;
+	/* All buffers in one block: nbufs input ones, then output one */
+	{
+		size_t islot = (ibs + DD_ALIGN - 1) & ~(size_t)(DD_ALIGN - 1);
+		size_t osize = 0;
+		char *p;
 #if ENABLE_FEATURE_DD_IBS_OBS
-	if (ibs != obs) {
-		G.flags |= FLAG_TWOBUFS;
-		obuf = xmalloc(obs);
-	}
+		if (ibs != obs) {
+			G.flags |= FLAG_TWOBUFS;
+			osize = obs;
+		}
 #endif
+		mem = xmalloc(nbufs * islot + osize + DD_ALIGN);
+		p = (char *)(((uintptr_t)mem + DD_ALIGN - 1) & ~(uintptr_t)(DD_ALIGN - 1));
+		blocks = xzalloc(nbufs * sizeof(blocks[0]));
+		for (i = 0; i < (int)nbufs; i++) {
+			blocks[i].task.run = dd_read;
+			blocks[i].buf = p;
+			p += islot;
+		}
+		ibuf = blocks[0].buf;
+#if ENABLE_FEATURE_DD_IBS_OBS
+		obuf = ibuf;
+		if (G.flags & FLAG_TWOBUFS)
+			obuf = p;
+#endif
+	}
 
 #if ENABLE_FEATURE_DD_SIGNAL_HANDLING
 	signal_SA_RESTART_empty_mask(SIGUSR1, dd_output_status);
@@ -448,7 +577,8 @@ int dd_main(int argc UNUSED_PARAM, char **argv)
 
 	if (infile) {
 #if !ENABLE_PLATFORM_MINGW32
-		xmove_fd(xopen(infile, O_RDONLY), ifd);
+		xmove_fd(xopen(infile, O_RDONLY
+			| ((G.flags & FLAG_IDIRECT) ? O_DIRECT : 0)), ifd);
 #else
 		xmove_fd(mingw_xopen(infile, O_RDONLY), ifd);
 		update_dev_fd(get_dev_type(infile), ifd);
@@ -463,6 +593,8 @@ int dd_main(int argc UNUSED_PARAM, char **argv)
 			oflag |= O_TRUNC;
 		if (G.flags & FLAG_APPEND)
 			oflag |= O_APPEND;
+		if (G.flags & FLAG_ODIRECT)
+			oflag |= O_DIRECT;
 
 		xmove_fd(xopen(outfile, oflag), ofd);
 
@@ -509,28 +641,37 @@ int dd_main(int argc UNUSED_PARAM, char **argv)
 			goto die_outfile;
 	}
 
-	while (!(G.flags & FLAG_COUNT) || (G.in_full + G.in_part != count)) {
+	/* Start reading ahead. With one buffer, there is no reader thread
+	 * and blocks are read synchronously in bb_pool_submit() */
+	pool = bb_pool_new(nbufs > 1);
+	nread = 0;
+	for (in_flight = 0; in_flight < nbufs; in_flight++) {
+		if ((G.flags & FLAG_COUNT) && nread == count)
+			break;
+		bb_pool_submit(pool, &blocks[in_flight].task);
+		nread++;
+	}
+
+	for (i = 0; in_flight != 0; i = (i + 1) % nbufs) {
+		struct dd_block *b = &blocks[i];
 		ssize_t n;
 
-#if ENABLE_FEATURE_DD_IBS_OBS
-		if (G.flags & FLAG_FULLBLOCK)
-			n = full_read(ifd, ibuf, ibs);
-		else
-#endif
-			n = safe_read(ifd, ibuf, ibs);
+		bb_pool_wait(pool, &b->task);
+		in_flight--;
+		n = b->n;
 		if (n == 0)
 			break;
 		if (n < 0) {
 			/* "Bad block" */
+			errno = b->err;
 			if (!(G.flags & FLAG_NOERROR))
 				goto die_infile;
 			bb_simple_perror_msg(infile);
-			/* GNU dd with conv=noerror skips over bad blocks */
-			xlseek(ifd, ibs, SEEK_CUR);
 			/* conv=noerror,sync writes NULs,
 			 * conv=noerror just ignores input bad blocks */
 			n = 0;
 		}
+		ibuf = b->buf;
 		if (G.flags & FLAG_SWAB) {
 			uint16_t *p16;
 			ssize_t n2;
@@ -584,19 +725,39 @@ int dd_main(int argc UNUSED_PARAM, char **argv)
 			if (write_and_stats(ibuf, n, obs, outfile))
 				goto out_status;
 		}
-	}
 
-	if (G.flags & FLAG_FSYNC) {
-		if (fsync(ofd) < 0)
-			goto die_outfile;
+		/* The block is written out, reuse the buffer */
+		if (!(G.flags & FLAG_COUNT) || nread != count) {
+			bb_pool_submit(pool, &b->task);
+			nread++;
+			in_flight++;
+		}
 	}
+	/* Let the reader finish: it will not read past EOF */
+	bb_pool_wait(pool, NULL);
+	bb_pool_free(pool);
 
 #if ENABLE_FEATURE_DD_IBS_OBS
 	if (ocount != 0) {
 		if (write_and_stats(obuf, ocount, obs, outfile))
 			goto out_status;
 	}
+	if (G.out_hole) {
+		/* Skipped zeros at the end: extend the file over them */
+		struct stat st;
+		off_t pos = lseek(ofd, 0, SEEK_CUR);
+
+		if (fstat(ofd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size < pos) {
+			if (ftruncate(ofd, pos) < 0)
+				goto die_outfile;
+		}
+	}
 #endif
+
+	if (G.flags & FLAG_FSYNC) {
+		if (fsync(ofd) < 0)
+			goto die_outfile;
+	}
 	if (close(ifd) < 0) {
  die_infile:
 		bb_simple_perror_msg_and_die(infile);
@@ -612,10 +773,10 @@ int dd_main(int argc UNUSED_PARAM, char **argv)
 	if (!ENABLE_FEATURE_DD_STATUS || !(G.flags & FLAG_STATUS_NONE))
 		dd_output_status(0);
 
-	if (ENABLE_FEATURE_CLEAN_UP) {
-		free(obuf);
-		if (G.flags & FLAG_TWOBUFS)
-			free(ibuf);
+	/* On write errors, the reader may be still running */
+	if (ENABLE_FEATURE_CLEAN_UP && exitcode == EXIT_SUCCESS) {
+		free(blocks);
+		free(mem);
 	}
 
 	return exitcode;
@@ -38,7 +38,7 @@
 /* http://www.opengroup.org/onlinepubs/007904975/utilities/du.html */
 
 //usage:#define du_trivial_usage
-//usage:       "[-aHLdclsx" IF_FEATURE_HUMAN_READABLE("hm") "k] [FILE]..."
+//usage:       "[-aHLdclsx" IF_FEATURE_HUMAN_READABLE("hm") "k] [-j N] [FILE]..."
 //usage:#define du_full_usage "\n\n"
 //usage:       "Summarize disk space used for each FILE and/or directory\n"
 //usage:     "\n	-a	Show file sizes too"
@@ -49,6 +49,7 @@
 //usage:     "\n	-l	Count sizes many times if hard linked"
 //usage:     "\n	-s	Display only a total for each argument"
 //usage:     "\n	-x	Skip directories on different filesystems"
+//usage:     "\n	-j N	Scan N directories in parallel"
 //usage:	IF_FEATURE_HUMAN_READABLE(
 //usage:     "\n	-h	Sizes in human readable format (e.g., 1K 243M 2G)"
 //usage:     "\n	-m	Sizes in megabytes"
@@ -74,6 +75,9 @@
 #include "libbb.h"
 #include "common_bufsiz.h"
 
+/* -j N needs threads and *at() functions */
+#define DU_PARALLEL (ENABLE_FEATURE_USE_THREADS && !ENABLE_PLATFORM_MINGW32)
+
 enum {
 	OPT_a_files_too    = (1 << 0),
 	OPT_H_follow_links = (1 << 1),
@@ -99,6 +103,10 @@ struct globals {
 	int slink_depth;
 	int du_depth;
 	dev_t dir_dev;
+#if DU_PARALLEL
+	bb_pool *pool;
+	ino_dev_set *scanned; /* directories by (dev,ino) */
+#endif
 } FIX_ALIASING;
 #define G (*(struct globals*)bb_common_bufsiz1)
 #define INIT_G() do { setup_common_bufsiz(); } while (0)
@@ -135,6 +143,229 @@ static void print(unsigned long long size, const char *filename)
 #endif
 }
 
+#if DU_PARALLEL
+/* du -j N: worker threads read directories (fstatat relative to
+ * the directory fd) into a compact tree. Then the main thread walks
+ * it in readdir order, exactly like du() walks the filesystem, so
+ * hardlinks are counted at the same place and output is the same.
+ * Only entries which need to be looked at in order are kept:
+ * subdirectories, files with several links, files to show (-a)
+ * and errors. Other files are just summed up by the scanner.
+ */
+struct du_ent {
+	unsigned long long blocks;
+	ino_t ino;
+	dev_t dev;
+	nlink_t nlink;
+	int err;            /* stat failed */
+	struct du_dir *dir; /* it is a directory */
+	smallint owner;     /* dir was created for this entry */
+	char *name;
+};
+
+struct du_dir {
+	bb_task task;
+	char *path;
+	unsigned long long sum; /* of entries not in ent[] */
+	struct du_ent *ent;
+	unsigned nent;
+	int open_err;
+	smallint walking;
+};
+
+static void FAST_FUNC du_scan(bb_task *task);
+
+/* Each directory is read only once, even if it is reachable by
+ * several names (bind mounts, -L): this also stops loops */
+static struct du_dir *du_scan_dir(const char *path, const struct stat *st, smallint *owner)
+{
+	struct du_dir *d, *old;
+
+	*owner = 0;
+	old = ino_dev_set_find(G.scanned, st);
+	if (old)
+		return old;
+	d = xzalloc(sizeof(*d));
+	d->path = xstrdup(path);
+	old = ino_dev_set_add(G.scanned, st, d);
+	if (old) {
+		/* another thread was faster */
+		free(d->path);
+		free(d);
+		return old;
+	}
+	*owner = 1;
+	d->task.run = du_scan;
+	bb_pool_submit(G.pool, &d->task);
+	return d;
+}
+
+static void FAST_FUNC du_scan(bb_task *task)
+{
+	struct du_dir *d = (struct du_dir *)task;
+	int follow = (G.slink_depth > 1); /* -L, or -H on a symlink */
+	unsigned alloc = 0;
+	struct dirent *entry;
+	DIR *dir;
+	int fd;
+
+	fd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (follow ? 0 : O_NOFOLLOW));
+	dir = fd >= 0 ? fdopendir(fd) : NULL;
+	if (!dir) {
+		d->open_err = errno;
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	while ((entry = readdir(dir)) != NULL) {
+		struct stat statbuf;
+		struct du_ent *e;
+		int err = 0;
+
+		if (DOT_OR_DOTDOT(entry->d_name))
+			continue;
+		if (fstatat(fd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0)
+			err = errno;
+		else if ((option_mask32 & OPT_x_one_FS) && G.dir_dev != statbuf.st_dev)
+			continue;
+		else if (S_ISLNK(statbuf.st_mode) && follow
+		 && fstatat(fd, entry->d_name, &statbuf, 0) != 0
+		) {
+			err = errno;
+		}
+		if (!err
+		 && !S_ISDIR(statbuf.st_mode)
+		 && !(option_mask32 & OPT_a_files_too)
+		 && ((option_mask32 & OPT_l_hardlinks) || statbuf.st_nlink <= 1)
+		) {
+			d->sum += statbuf.st_blocks;
+			continue;
+		}
+		if (d->nent == alloc) {
+			alloc = alloc * 2 + 16;
+			d->ent = xrealloc(d->ent, alloc * sizeof(d->ent[0]));
+		}
+		e = &d->ent[d->nent++];
+		memset(e, 0, sizeof(*e));
+		e->err = err;
+		e->name = xstrdup(entry->d_name);
+		if (err)
+			continue;
+		e->blocks = statbuf.st_blocks;
+		e->ino = statbuf.st_ino;
+		e->dev = statbuf.st_dev;
+		e->nlink = statbuf.st_nlink;
+		if (S_ISDIR(statbuf.st_mode)) {
+			char *path = concat_path_file(d->path, entry->d_name);
+			e->dir = du_scan_dir(path, &statbuf, &e->owner);
+			free(path);
+		}
+	}
+	closedir(dir);
+}
+
+static unsigned long long du_walk_ent(struct du_ent *e, const char *filename);
+
+/* Sum up a scanned directory, like the loop in du() does.
+ * Returns -1 if it could not be read */
+static int du_walk_dir(struct du_dir *d, const char *filename, unsigned long long *sum)
+{
+	unsigned i;
+
+	bb_pool_wait(G.pool, &d->task);
+	if (d->open_err) {
+		errno = d->open_err;
+		bb_perror_msg("can't open '%s'", filename);
+		G.status = EXIT_FAILURE;
+		return -1;
+	}
+	/* Loop, possible only with -l: du() would never finish */
+	if (d->walking)
+		return 0;
+	d->walking = 1;
+	*sum += d->sum;
+	for (i = 0; i < d->nent; i++) {
+		char *newfile = concat_path_file(filename, d->ent[i].name);
+		++G.du_depth;
+		*sum += du_walk_ent(&d->ent[i], newfile);
+		--G.du_depth;
+		free(newfile);
+	}
+	d->walking = 0;
+	return 0;
+}
+
+static unsigned long long du_walk_ent(struct du_ent *e, const char *filename)
+{
+	unsigned long long sum;
+
+	if (e->err) {
+		errno = e->err;
+		bb_simple_perror_msg(filename);
+		G.status = EXIT_FAILURE;
+		return 0;
+	}
+	sum = e->blocks;
+	if (!(option_mask32 & OPT_l_hardlinks)
+	 && e->nlink > 1
+	) {
+		struct stat statbuf;
+
+		/* Add files/directories with links only once */
+		statbuf.st_ino = e->ino;
+		statbuf.st_dev = e->dev;
+		statbuf.st_mode = e->dir ? S_IFDIR : S_IFREG;
+		if (is_in_ino_dev_hashtable(&statbuf)) {
+			return 0;
+		}
+		add_to_ino_dev_hashtable(&statbuf, NULL);
+	}
+	if (e->dir) {
+		if (du_walk_dir(e->dir, filename, &sum) < 0)
+			return sum;
+	} else {
+		if (!(option_mask32 & OPT_a_files_too) && G.du_depth != 0)
+			return sum;
+	}
+	if (G.du_depth <= G.max_print_depth) {
+		print(sum, filename);
+	}
+	return sum;
+}
+
+static void du_free_dir(struct du_dir *d)
+{
+	while (d->nent) {
+		struct du_ent *e = &d->ent[--d->nent];
+		if (e->owner)
+			du_free_dir(e->dir);
+		free(e->name);
+	}
+	free(d->ent);
+	free(d->path);
+	free(d);
+}
+
+/* Scan directory filename in parallel, then sum it up */
+static int du_parallel(const char *filename, const struct stat *statbuf,
+		unsigned long long *sum)
+{
+	struct du_dir *d;
+	smallint owner;
+	int r;
+
+	G.scanned = ino_dev_set_new(/*shared:*/ 1);
+	d = du_scan_dir(filename, statbuf, &owner);
+	r = du_walk_dir(d, filename, sum);
+
+	/* Some directories may be still being read, if we skipped them */
+	bb_pool_wait(G.pool, NULL);
+	du_free_dir(d);
+	ino_dev_set_free(G.scanned);
+	return r;
+}
+#endif
+
 /* tiny recursive du */
 static unsigned long long du(const char *filename)
 {
@@ -187,6 +418,13 @@ static unsigned long long du(const char *filename)
 		struct dirent *entry;
 		char *newfile;
 
+#if DU_PARALLEL
+		if (G.pool) {
+			if (du_parallel(filename, &statbuf, &sum) < 0)
+				return sum;
+			goto do_print;
+		}
+#endif
 		dir = warn_opendir(filename);
 		if (!dir) {
 			G.status = EXIT_FAILURE;
@@ -207,6 +445,9 @@ static unsigned long long du(const char *filename)
 		if (!(option_mask32 & OPT_a_files_too) && G.du_depth != 0)
 			return sum;
 	}
+#if DU_PARALLEL
+ do_print:
+#endif
 	if (G.du_depth <= G.max_print_depth) {
 		print(sum, filename);
 	}
@@ -219,6 +460,7 @@ int du_main(int argc UNUSED_PARAM, char **argv)
 	unsigned long long total;
 	int slink_depth_save;
 	unsigned opt;
+	unsigned jobs = 0;
 
 	INIT_G();
 
@@ -241,9 +483,9 @@ int du_main(int argc UNUSED_PARAM, char **argv)
 	 */
 #if ENABLE_FEATURE_HUMAN_READABLE
 	opt = getopt32(argv, "^"
-			"aHkLsxd:+lchm"
+			"aHkLsxd:+lchmj:+"
 			"\0" "h-km:k-hm:m-hk:H-L:L-H:s-d:d-s",
-			&G.max_print_depth
+			&G.max_print_depth, &jobs
 	);
 	argv += optind;
 	if (opt & OPT_h_for_humans) {
@@ -257,9 +499,9 @@ int du_main(int argc UNUSED_PARAM, char **argv)
 	}
 #else
 	opt = getopt32(argv, "^"
-			"aHkLsxd:+lc"
+			"aHkLsxd:+lcj:+"
 			"\0" "H-L:L-H:s-d:d-s",
-			&G.max_print_depth
+			&G.max_print_depth, &jobs
 	);
 	argv += optind;
 #if !ENABLE_FEATURE_DU_DEFAULT_BLOCKSIZE_1K
@@ -277,6 +519,10 @@ int du_main(int argc UNUSED_PARAM, char **argv)
 	if (opt & OPT_s_total_norecurse) {
 		G.max_print_depth = 0;
 	}
+#if DU_PARALLEL
+	if (jobs)
+		G.pool = bb_pool_new(jobs);
+#endif
 
 	/* go through remaining args (if any) */
 	if (!*argv) {
@@ -19,8 +19,6 @@
  *
  * NON-OPTIMAL BEHAVIOUR:
  * 1. autowidth reads directories twice
- * 2. if you do a short directory listing without filetype characters
- *    appended, there's no need to stat each one
  * PORTABILITY:
  * 1. requires lstat (BSD) - how do you do it without?
  *
@@ -97,7 +95,7 @@
 //kbuild:lib-$(CONFIG_LS) += ls.o
 
 //usage:#define ls_trivial_usage
-//usage:	"[-1AaCxd"
+//usage:	"[-1AaCxdfU"
 //usage:	IF_FEATURE_LS_FOLLOWLINKS("LH")
 //usage:	IF_FEATURE_LS_RECURSIVE("R")
 //usage:	IF_FEATURE_LS_FILETYPES("Fp") "lins"
@@ -111,6 +109,7 @@
 //usage:     "\n	-1	One column output"
 //usage:     "\n	-a	Include entries which start with ."
 //usage:     "\n	-A	Like -a, but exclude . and .."
+//usage:     "\n	-f	Like -aU, and turn off -l, -s and colors"
 ////usage:     "\n	-C	List by columns" - don't show, this is a default anyway
 //usage:     "\n	-x	List by lines"
 //usage:     "\n	-d	List directory entries instead of contents"
@@ -153,6 +152,7 @@
 //usage:     "\n	-tu	Sort by atime"
 //usage:	)
 //usage:     "\n	-r	Reverse sort order"
+//usage:     "\n	-U	Don't sort, list in directory order"
 //usage:	IF_SELINUX(
 //usage:     "\n	-Z	List security context and permission"
 //usage:	)
@@ -206,6 +206,9 @@ SPLIT_SUBDIR    = 2,
 /* -SXvhTw  GNU options, busybox optionally supports */
 /* -T WIDTH Ignored (we don't use tabs on output) */
 /* -Z       SELinux mandated option, busybox optionally supports */
+/* -fU      Std/GNU options, busybox always supports */
+/*          With long opts, getopt32 has no bits left for them, */
+/*          take_unsorted_opts() handles them before it runs */
 #define ls_options \
 	"Cadi1lgnsxAk"       /* 12 opts, total 12 */ \
 	IF_FEATURE_LS_FILETYPES("Fp")    /* 2, 14 */ \
@@ -327,6 +330,7 @@ struct globals {
 #endif
 	smallint exit_code;
 	smallint show_dirname;
+	smallint unsorted; /* -U or -f */
 #if ENABLE_FEATURE_LS_WIDTH
 	unsigned terminal_width;
 # define G_terminal_width (G.terminal_width)
@@ -761,6 +765,38 @@ static struct dnode *my_stat(const char *fullname, const char *name, int force_f
 	return cur;
 }
 
+#ifdef _DIRENT_HAVE_D_TYPE
+# ifndef DTTOIF
+#  define DTTOIF(dirtype) ((dirtype) << 12)
+# endif
+# define dirent_type(entry) DTTOIF((entry)->d_type)
+#else
+# define dirent_type(entry) 0
+#endif
+
+/* Like my_stat() for a directory entry, but when the listing
+ * needs nothing beyond the name and the file type, take the type
+ * from d_type and skip [l]stat. type is 0 if it is unknown */
+static struct dnode *dirent_stat(const char *fullname, mode_t type)
+{
+	struct dnode *cur;
+
+	if (!type
+	 || (option_mask32 & (OPT_l|OPT_s|OPT_i|OPT_t|OPT_S|OPT_Z))
+	 /* -L needs the type of the target */
+	 || (S_ISLNK(type) && (option_mask32 & OPT_L))
+	 /* -F and colors need exec bits */
+	 || (S_ISREG(type) && ((option_mask32 & OPT_F) || G_show_color))
+	) {
+		return my_stat(fullname, bb_basename(fullname), 0);
+	}
+	cur = xzalloc(sizeof(*cur));
+	cur->fullname = fullname;
+	cur->name = bb_basename(fullname);
+	cur->dn_mode = cur->dn_mode_lstat = type;
+	return cur;
+}
+
 static unsigned count_dirs(struct dnode **dn, int which)
 {
 	unsigned dirs, all;
@@ -909,6 +945,16 @@ static int sortcmp(const void *a, const void *b)
 
 static void dnsort(struct dnode **dn, int size)
 {
+	if (G.unsorted)
+		return;
+	/* Sort by name only? Radix sort is much faster on big dirs */
+	if (!(option_mask32 & (OPT_dirs_first | OPT_S | OPT_t | OPT_v | OPT_X))
+	 && collation_is_bytewise()
+	) {
+		sort_by_string_key((void **)dn, size, offsetof(struct dnode, name),
+				(option_mask32 & OPT_r) ? SORT_KEY_REVERSE : 0, NULL);
+		return;
+	}
 	qsort(dn, size, sizeof(*dn), sortcmp);
 }
 
@@ -922,8 +968,20 @@ static void sort_and_display_files(struct dnode **dn, unsigned nfiles)
 # define sort_and_display_files(dn, nfiles) display_files(dn, nfiles)
 #endif
 
-/* Returns NULL-terminated malloced vector of pointers (or NULL) */
-static struct dnode **scan_one_dir(const char *path, unsigned *nfiles_p)
+/* -U with one entry per line, and no "total" line before them?
+ * Then entries are printed as soon as readdir returns them */
+static int can_stream(void)
+{
+	return G.unsorted
+		&& (option_mask32 & (OPT_l|OPT_1))
+		&& !(ENABLE_DESKTOP && (option_mask32 & (OPT_s|OPT_l)));
+}
+
+/* Returns NULL-terminated malloced vector of pointers (or NULL),
+ * in the order readdir returned them.
+ * If stream is set, entries are printed right away and the vector
+ * only has the subdirectories -R needs to descend into */
+static struct dnode **scan_one_dir(const char *path, unsigned *nfiles_p, int stream)
 {
 	struct dnode *dn, *cur, **dnp;
 	struct dirent *entry;
@@ -952,12 +1010,24 @@ static struct dnode **scan_one_dir(const char *path, unsigned *nfiles_p)
 			}
 		}
 		fullname = concat_path_file(path, entry->d_name);
-		cur = my_stat(fullname, bb_basename(fullname), 0);
+		cur = dirent_stat(fullname, dirent_type(entry));
 		if (!cur) {
 			free(fullname);
 			continue;
 		}
 		cur->fname_allocated = 1;
+		if (stream) {
+			display_single(cur);
+			putchar('\n');
+			if (!(option_mask32 & OPT_R)
+			 || !S_ISDIR(cur->dn_mode)
+			 || DOT_OR_DOTDOT(cur->name)
+			) {
+				free(fullname);
+				free(cur);
+				continue;
+			}
+		}
 		cur->dn_next = dn;
 		dn = cur;
 		nfiles++;
@@ -972,12 +1042,9 @@ static struct dnode **scan_one_dir(const char *path, unsigned *nfiles_p)
 	 */
 	*nfiles_p = nfiles;
 	dnp = dnalloc(nfiles);
-	for (i = 0; /* i < nfiles - detected via !dn below */; i++) {
-		dnp[i] = dn;	/* save pointer to node in array */
-		dn = dn->dn_next;
-		if (!dn)
-			break;
-	}
+	/* the list is in reverse order */
+	for (i = nfiles; dn; dn = dn->dn_next)
+		dnp[--i] = dn;	/* save pointer to node in array */
 
 	return dnp;
 }
@@ -1015,6 +1082,7 @@ static void scan_and_display_dirs_recur(struct dnode **dn, int first)
 {
 	unsigned nfiles;
 	struct dnode **subdnp;
+	int stream = can_stream();
 
 	for (; *dn; dn++) {
 		if (G.show_dirname || (option_mask32 & OPT_R)) {
@@ -1023,7 +1091,15 @@ static void scan_and_display_dirs_recur(struct dnode **dn, int first)
 			first = 0;
 			printf("%s:\n", (*dn)->fullname);
 		}
-		subdnp = scan_one_dir((*dn)->fullname, &nfiles);
+		subdnp = scan_one_dir((*dn)->fullname, &nfiles, stream);
+		if (stream) {
+			/* already printed, subdnp has only dirs to recurse into */
+			if (nfiles > 0) {
+				scan_and_display_dirs_recur(subdnp, 0);
+				dfree(subdnp);
+			}
+			continue;
+		}
 #if ENABLE_DESKTOP
 		if (option_mask32 & (OPT_s|OPT_l)) {
 			if (option_mask32 & OPT_h) {
@@ -1062,6 +1138,51 @@ static void scan_and_display_dirs_recur(struct dnode **dn, int first)
 	}
 }
 
+/* Remove -f and -U from argv (see ls_options comment).
+ * Returns 'f' if -f was seen, else 'U' if -U was, else 0 */
+static char take_unsorted_opts(char **argv)
+{
+	char **dst;
+	char *arg;
+	char seen = 0;
+
+	dst = ++argv;
+	while ((arg = *argv++) != NULL) {
+		char *s;
+		int next_is_param = 0;
+
+		if (arg[0] != '-' || !arg[1] || arg[1] == '-') {
+			*dst++ = arg;
+			if (strcmp(arg, "--") == 0) {
+				while ((*dst++ = *argv++) != NULL)
+					continue;
+				return seen;
+			}
+			continue;
+		}
+		for (s = arg + 1; *s;) {
+			if (*s == 'f' || *s == 'U') {
+				if (seen != 'f')
+					seen = *s;
+				/* (only writes to argv[] strings if there is something to remove) */
+				overlapping_strcpy(s, s + 1);
+				continue;
+			}
+			if (ENABLE_FEATURE_LS_WIDTH && (*s == 'T' || *s == 'w')) {
+				/* the rest of it, or the next word, is the parameter */
+				next_is_param = !s[1];
+				break;
+			}
+			s++;
+		}
+		if (arg[1]) /* not "-" left from "-U" */
+			*dst++ = arg;
+		if (next_is_param && *argv)
+			*dst++ = *argv++;
+	}
+	*dst = NULL;
+	return seen;
+}
 
 int ls_main(int argc UNUSED_PARAM, char **argv)
 {	/*      ^^^^^^^^^^^^^^^^^ note: if FTPD, argc can be wrong, see ftpd.c */
@@ -1075,6 +1196,7 @@ int ls_main(int argc UNUSED_PARAM, char **argv)
 	unsigned dnfiles;
 	unsigned dndirs;
 	unsigned i;
+	char unsorted;
 #if ENABLE_FEATURE_LS_COLOR
 	/* colored LS support by JaWi, janwillem.janssen@lxtreme.nl */
 	/* coreutils 6.10:
@@ -1112,6 +1234,7 @@ int ls_main(int argc UNUSED_PARAM, char **argv)
 #endif
 
 	/* process options */
+	unsorted = take_unsorted_opts(argv);
 	opt = getopt32long(argv, "^"
 		ls_options
 			"\0"
@@ -1193,6 +1316,16 @@ int ls_main(int argc UNUSED_PARAM, char **argv)
 		}
 	}
 
+	if (unsorted) {
+		G.unsorted = 1;
+		if (unsorted == 'f') {
+			/* -f is -aU without -l, -s and colors */
+			option_mask32 |= OPT_a;
+			option_mask32 &= ~(OPT_l|OPT_s);
+			IF_FEATURE_LS_COLOR(G_show_color = 0;)
+		}
+	}
+
 	/* choose a display format if one was not already specified by an option */
 	if (!(option_mask32 & (OPT_l|OPT_1|OPT_x|OPT_C)))
 		option_mask32 |= (isatty(STDOUT_FILENO) ? OPT_C : OPT_1);
@@ -1237,12 +1370,9 @@ int ls_main(int argc UNUSED_PARAM, char **argv)
 	 * allocate memory for an array to hold dnode pointers
 	 */
 	dnp = dnalloc(nfiles);
-	for (i = 0; /* i < nfiles - detected via !dn below */; i++) {
-		dnp[i] = dn;	/* save pointer to node in array */
-		dn = dn->dn_next;
-		if (!dn)
-			break;
-	}
+	/* the list is in reverse order, -U wants the original one */
+	for (i = nfiles; dn; dn = dn->dn_next)
+		dnp[--i] = dn;	/* save pointer to node in array */
 
 	if (option_mask32 & OPT_d) {
 		sort_and_display_files(dnp, nfiles);
@@ -60,14 +60,16 @@
 //kbuild:lib-$(CONFIG_SHA3SUM)   += md5_sha1_sum.o
 
 //usage:#define md5sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[-j N] [FILE]..."
 //usage:#define md5sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " MD5 checksums"
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
+//usage:     "\n"
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK(
 //usage:     "\n	-c	Check sums against list in FILEs"
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:     "\n	-j N	Hash N files in parallel"
 //usage:
 //usage:#define md5sum_example_usage
 //usage:       "$ md5sum < busybox\n"
@@ -80,51 +82,60 @@
 //usage:       "^D\n"
 //usage:
 //usage:#define sha1sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[-j N] [FILE]..."
 //usage:#define sha1sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA1 checksums"
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
+//usage:     "\n"
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK(
 //usage:     "\n	-c	Check sums against list in FILEs"
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:     "\n	-j N	Hash N files in parallel"
 //usage:
 //usage:#define sha256sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[-j N] [FILE]..."
 //usage:#define sha256sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA256 checksums"
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
+//usage:     "\n"
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK(
 //usage:     "\n	-c	Check sums against list in FILEs"
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:     "\n	-j N	Hash N files in parallel"
 //usage:
 //usage:#define sha512sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[-j N] [FILE]..."
 //usage:#define sha512sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA512 checksums"
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
+//usage:     "\n"
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK(
 //usage:     "\n	-c	Check sums against list in FILEs"
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:     "\n	-j N	Hash N files in parallel"
 //usage:
 //usage:#define sha3sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[-a BITS] [FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[-j N] [-a BITS] [FILE]..."
 //usage:#define sha3sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA3 checksums"
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
+//usage:     "\n"
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK(
 //usage:     "\n	-c	Check sums against list in FILEs"
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:     "\n	-a BITS	224 (default), 256, 384, 512"
 //usage:	)
+//usage:     "\n	-j N	Hash N files in parallel"
 
 //FIXME: GNU coreutils 8.25 has no -s option, it has only these two long opts:
 // --quiet   don't print OK for each successfully verified file
 // --status  don't output anything, status code shows success
 
 #include "libbb.h"
+#include "common_bufsiz.h"
 
 /* This is a NOEXEC applet. Be very careful! */
 
@@ -227,7 +238,12 @@ static uint8_t *hash_file(const char *filename, unsigned sha3_width)
 	}
 
 	{
+#if ENABLE_FEATURE_USE_THREADS
+		/* With -j, we may run in several threads at once */
+		uint8_t in_buf[4096];
+#else
 		RESERVE_CONFIG_UBUFFER(in_buf, 4096);
+#endif
 		while ((count = safe_read(src_fd, in_buf, 4096)) > 0) {
 			update(&context, in_buf, count);
 		}
@@ -238,7 +254,9 @@ static uint8_t *hash_file(const char *filename, unsigned sha3_width)
 			final(&context, in_buf);
 			hash_value = hash_bin_to_hex(in_buf, hash_len);
 		}
+#if !ENABLE_FEATURE_USE_THREADS
 		RELEASE_CONFIG_BUFFER(in_buf);
+#endif
 	}
 
 	if (src_fd != STDIN_FILENO) {
@@ -248,13 +266,113 @@ static uint8_t *hash_file(const char *filename, unsigned sha3_width)
 	return hash_value;
 }
 
+/* Files are hashed as "jobs". Without -j, there is no concurrency:
+ * every job is run and its result printed right away.
+ * With -j N, up to JOBS_PER_THREAD*N jobs are in flight,
+ * results are printed in the order the jobs were submitted.
+ */
+enum { JOBS_PER_THREAD = 4 };
+
+struct hash_job {
+	bb_task task;
+	char *filename;
+	char *line; /* -c: malloced line with expected hash, else NULL */
+	uint8_t *hash_value;
+};
+
+struct globals {
+	bb_pool *pool;
+	struct hash_job *job;
+	unsigned max_jobs;
+	unsigned first_job;
+	unsigned num_jobs;
+	unsigned flags;
+	int count_failed;
+	int return_value;
+#if ENABLE_SHA3SUM
+	unsigned sha3_width;
+#endif
+} FIX_ALIASING;
+#define G (*(struct globals*)bb_common_bufsiz1)
+#define INIT_G() do { \
+	setup_common_bufsiz(); \
+	BUILD_BUG_ON(sizeof(G) > COMMON_BUFSIZE); \
+} while (0)
+
+static void FAST_FUNC run_hash_job(bb_task *task)
+{
+	struct hash_job *job = (struct hash_job *)task;
+	job->hash_value = hash_file(job->filename, G.sha3_width);
+}
+
+/* Wait for the oldest job and print its result */
+static void finish_job(void)
+{
+	struct hash_job *job = &G.job[G.first_job];
+
+	bb_pool_wait(G.pool, &job->task);
+	if (job->line) {
+		if (job->hash_value && (strcmp((char*)job->hash_value, job->line) == 0)) {
+			if (!(G.flags & FLAG_SILENT))
+				printf("%s: OK\n", job->filename);
+		} else {
+			if (!(G.flags & FLAG_SILENT))
+				printf("%s: FAILED\n", job->filename);
+			G.count_failed++;
+			G.return_value = EXIT_FAILURE;
+		}
+		free(job->line);
+	} else {
+		if (job->hash_value == NULL) {
+			G.return_value = EXIT_FAILURE;
+		} else {
+			printf("%s  %s\n", job->hash_value, job->filename);
+		}
+	}
+	/* possible free(NULL) */
+	free(job->hash_value);
+	G.first_job = (G.first_job + 1) % G.max_jobs;
+	G.num_jobs--;
+}
+
+static void finish_all_jobs(void)
+{
+	while (G.num_jobs)
+		finish_job();
+}
+
+static void submit_job(char *filename, char *line)
+{
+	struct hash_job *job;
+	/* stdin can't be shared: when hashing it,
+	 * nothing else (e.g. reading of "-c -" list) may run */
+	bool stdin_job = LONE_DASH(filename);
+
+	if (stdin_job)
+		finish_all_jobs();
+	else if (G.num_jobs == G.max_jobs)
+		finish_job();
+
+	job = &G.job[(G.first_job + G.num_jobs) % G.max_jobs];
+	G.num_jobs++;
+	job->task.run = run_hash_job;
+	job->filename = filename;
+	job->line = line;
+	bb_pool_submit(G.pool, &job->task);
+
+	if (stdin_job || G.max_jobs == 1)
+		finish_job();
+}
+
 int md5_sha1_sum_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 {
-	int return_value = EXIT_SUCCESS;
-	unsigned flags;
+	unsigned nthreads = 0;
+
+	INIT_G();
+	G.return_value = EXIT_SUCCESS;
 #if ENABLE_SHA3SUM
-	unsigned sha3_width = 224;
+	G.sha3_width = 224;
 #endif
 
 	if (ENABLE_FEATURE_MD5_SHA1_SUM_CHECK) {
@@ -262,34 +380,40 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 		/* -s and -w require -c */
 #if ENABLE_SHA3SUM
 		if (applet_name[3] == HASH_SHA3)
-			flags = getopt32(argv, "^" "scwbta:+" "\0" "s?c:w?c", &sha3_width);
+			G.flags = getopt32(argv, "^" "scwbtj:+a:+" "\0" "s?c:w?c", &nthreads, &G.sha3_width);
 		else
 #endif
-			flags = getopt32(argv, "^" "scwbt" "\0" "s?c:w?c");
+			G.flags = getopt32(argv, "^" "scwbtj:+" "\0" "s?c:w?c", &nthreads);
 	} else {
 #if ENABLE_SHA3SUM
 		if (applet_name[3] == HASH_SHA3)
-			getopt32(argv, "a:+", &sha3_width);
+			getopt32(argv, "j:+a:+", &nthreads, &G.sha3_width);
 		else
 #endif
-			getopt32(argv, "");
+			getopt32(argv, "j:+", &nthreads);
 	}
 	argv += optind;
 	//argc -= optind;
 	if (!*argv)
 		*--argv = (char*)"-";
 
+	/* -j1 is the same as no -j */
+	if (nthreads == 1)
+		nthreads = 0;
+	G.pool = bb_pool_new(nthreads);
+	G.max_jobs = nthreads ? nthreads * JOBS_PER_THREAD : 1;
+	G.job = xzalloc(G.max_jobs * sizeof(G.job[0]));
+
 	do {
-		if (ENABLE_FEATURE_MD5_SHA1_SUM_CHECK && (flags & FLAG_CHECK)) {
+		if (ENABLE_FEATURE_MD5_SHA1_SUM_CHECK && (G.flags & FLAG_CHECK)) {
 			FILE *pre_computed_stream;
 			char *line;
 			int count_total = 0;
-			int count_failed = 0;
 
+			G.count_failed = 0;
 			pre_computed_stream = xfopen_stdin(*argv);
 
 			while ((line = xmalloc_fgetline(pre_computed_stream)) != NULL) {
-				uint8_t *hash_value;
 				char *filename_ptr;
 
 				count_total++;
@@ -299,38 +423,26 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 					filename_ptr = strstr(line, " *");
 				}
 				if (filename_ptr == NULL) {
-					if (flags & FLAG_WARN) {
+					if (G.flags & FLAG_WARN) {
 						bb_simple_error_msg("invalid format");
 					}
-					count_failed++;
-					return_value = EXIT_FAILURE;
+					G.count_failed++;
+					G.return_value = EXIT_FAILURE;
 					free(line);
 					continue;
 				}
 				*filename_ptr = '\0';
 				filename_ptr += 2;
 
-				hash_value = hash_file(filename_ptr, sha3_width);
-
-				if (hash_value && (strcmp((char*)hash_value, line) == 0)) {
-					if (!(flags & FLAG_SILENT))
-						printf("%s: OK\n", filename_ptr);
-				} else {
-					if (!(flags & FLAG_SILENT))
-						printf("%s: FAILED\n", filename_ptr);
-					count_failed++;
-					return_value = EXIT_FAILURE;
-				}
-				/* possible free(NULL) */
-				free(hash_value);
-				free(line);
+				submit_job(filename_ptr, line);
 			}
-			if (count_failed && !(flags & FLAG_SILENT)) {
+			finish_all_jobs();
+			if (G.count_failed && !(G.flags & FLAG_SILENT)) {
 				bb_error_msg("WARNING: %d of %d computed checksums did NOT match",
-						count_failed, count_total);
+						G.count_failed, count_total);
 			}
 			if (count_total == 0) {
-				return_value = EXIT_FAILURE;
+				G.return_value = EXIT_FAILURE;
 				/*
 				 * md5sum from GNU coreutils 8.25 says:
 				 * md5sum: <FILE>: no properly formatted MD5 checksum lines found
@@ -339,15 +451,14 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 			}
 			fclose_if_not_stdin(pre_computed_stream);
 		} else {
-			uint8_t *hash_value = hash_file(*argv, sha3_width);
-			if (hash_value == NULL) {
-				return_value = EXIT_FAILURE;
-			} else {
-				printf("%s  %s\n", hash_value, *argv);
-				free(hash_value);
-			}
+			submit_job(*argv, NULL);
 		}
 	} while (*++argv);
+	finish_all_jobs();
 
-	return return_value;
+	if (ENABLE_FEATURE_CLEAN_UP) {
+		bb_pool_free(G.pool);
+		free(G.job);
+	}
+	return G.return_value;
 }
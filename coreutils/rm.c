@@ -25,12 +25,13 @@
 /* http://www.opengroup.org/onlinepubs/007904975/utilities/rm.html */
 
 //usage:#define rm_trivial_usage
-//usage:       "[-irf] FILE..."
+//usage:       "[-irf] [-j N] FILE..."
 //usage:#define rm_full_usage "\n\n"
 //usage:       "Remove (unlink) FILEs\n"
 //usage:     "\n	-i	Always prompt before removing"
 //usage:     "\n	-f	Never prompt"
 //usage:     "\n	-R,-r	Recurse"
+//usage:     "\n	-j N	Remove N subdirectories in parallel"
 //usage:
 //usage:#define rm_example_usage
 //usage:       "$ rm -rf /tmp/foo\n"
@@ -45,8 +46,9 @@ int rm_main(int argc UNUSED_PARAM, char **argv)
 	int status = 0;
 	int flags = 0;
 	unsigned opt;
+	unsigned jobs = 0;
 
-	opt = getopt32(argv, "^" "fiRrv" "\0" "f-i:i-f");
+	opt = getopt32(argv, "^" "fiRrvj:+" "\0" "f-i:i-f", &jobs);
 	argv += optind;
 	if (opt & 1)
 		flags |= FILEUTILS_FORCE;
@@ -56,6 +58,8 @@ int rm_main(int argc UNUSED_PARAM, char **argv)
 		flags |= FILEUTILS_RECUR;
 	if ((opt & 16) && FILEUTILS_VERBOSE)
 		flags |= FILEUTILS_VERBOSE;
+	if (flags & FILEUTILS_RECUR)
+		remove_file_jobs(jobs);
 
 	if (*argv != NULL) {
 		do {
@@ -72,5 +76,7 @@ int rm_main(int argc UNUSED_PARAM, char **argv)
 		bb_show_usage();
 	}
 
+	if (ENABLE_FEATURE_CLEAN_UP)
+		remove_file_jobs(0);
 	return status;
 }
@@ -36,6 +36,16 @@
 //config:	help
 //config:	Attempt to use less memory (by storing only one copy
 //config:	of duplicated lines, and such). Useful if you work on huge files.
+//config:
+//config:config FEATURE_SORT_EXTERNAL
+//config:	bool "Sort inputs bigger than memory (-m, -S, -T, --batch-size)"
+//config:	default y
+//config:	depends on FEATURE_SORT_BIG && PLATFORM_POSIX
+//config:	help
+//config:	When input does not fit into -S SIZE of memory (by default,
+//config:	half of RAM), sort it in parts, write them to temporary files
+//config:	in -T DIR, and merge those. -m merges sorted inputs without
+//config:	reading them into memory.
 
 //applet:IF_SORT(APPLET_NOEXEC(sort, sort, BB_DIR_USR_BIN, BB_SUID_DROP, sort))
 
@@ -44,6 +54,7 @@
 //usage:#define sort_trivial_usage
 //usage:       "[-nru"
 //usage:	IF_FEATURE_SORT_BIG("gMcszbdfiokt] [-o FILE] [-k start[.offset][opts][,end[.offset][opts]] [-t CHAR")
+//usage:	IF_FEATURE_SORT_EXTERNAL("] [-m] [-S SIZE] [-T DIR")
 //usage:       "] [FILE]..."
 //usage:#define sort_full_usage "\n\n"
 //usage:       "Sort lines of text\n"
@@ -68,6 +79,15 @@
 //usage:     "\n	-s	Stable (don't sort ties alphabetically)"
 //usage:     "\n	-u	Suppress duplicate lines"
 //usage:     "\n	-z	Lines are terminated by NUL, not newline"
+//usage:	IF_LONG_OPTS(
+//usage:     "\n	--parallel N Sort in N threads"
+//usage:	)
+//usage:	IF_FEATURE_SORT_EXTERNAL(
+//usage:     "\n	-m	Merge already sorted files"
+//usage:     "\n	-S SIZE[bKMG%] Memory to use, spill the rest to temporary files"
+//usage:     "\n	-T DIR	Directory for temporary files"
+//usage:     "\n	--batch-size N Merge at most N files at once"
+//usage:	)
 ///////:     "\n	-m	Ignored for GNU compatibility"
 ///////:     "\n	-S BUFSZ Ignored for GNU compatibility"
 ///////:     "\n	-T TMPDIR Ignored for GNU compatibility"
@@ -89,6 +109,9 @@
 //usage:       ""
 
 #include "libbb.h"
+#if ENABLE_FEATURE_SORT_EXTERNAL
+# include <sys/sysinfo.h>
+#endif
 
 /* These are sort types */
 enum {
@@ -107,12 +130,14 @@ enum {
 	FLAG_d  = 1 << 10,      /* Ignore !(isalnum()|isspace()) */
 	FLAG_f  = 1 << 11,      /* Force uppercase */
 	FLAG_i  = 1 << 12,      /* Ignore !isprint() */
-	FLAG_m  = 1 << 13,      /* ignored: merge already sorted files; do not sort */
-	FLAG_S  = 1 << 14,      /* ignored: -S, --buffer-size=SIZE */
-	FLAG_T  = 1 << 15,      /* ignored: -T, --temporary-directory=DIR */
+	FLAG_m  = 1 << 13,      /* Merge already sorted files; do not sort */
+	FLAG_S  = 1 << 14,      /* -S, --buffer-size=SIZE */
+	FLAG_T  = 1 << 15,      /* -T, --temporary-directory=DIR */
 	FLAG_o  = 1 << 16,
 	FLAG_k  = 1 << 17,
 	FLAG_t  = 1 << 18,
+	FLAG_parallel = (1 << 19) * ENABLE_LONG_OPTS,
+	FLAG_batch_size = (1 << 20) * (ENABLE_FEATURE_SORT_EXTERNAL && ENABLE_LONG_OPTS),
 	FLAG_bb = 0x80000000,   /* Ignore trailing blanks  */
 	FLAG_no_tie_break = 0x40000000,
 };
@@ -126,6 +151,13 @@ static const char sort_opt_str[] ALIGN1 = "^"
  */
 #define OPT_STR (sort_opt_str + 1)
 
+#if ENABLE_LONG_OPTS
+static const char sort_longopts[] ALIGN1 =
+	"parallel\0" Required_argument "\xff"
+	IF_FEATURE_SORT_EXTERNAL("batch-size\0" Required_argument "\xfe")
+	;
+#endif
+
 #if ENABLE_FEATURE_SORT_BIG
 static char key_separator;
 
@@ -139,6 +171,12 @@ static struct sort_key {
 /* This is a NOEXEC applet. Be very careful! */
 
 
+static int key_is_whole_line(struct sort_key *key, int flags)
+{
+	return key->range[0] == 1 && !key->range[1] && !key->range[2] && !key->range[3]
+		&& !(flags & (FLAG_b | FLAG_d | FLAG_f | FLAG_i | FLAG_bb));
+}
+
 static char *get_key(char *str, struct sort_key *key, int flags)
 {
 	int start = start; /* for compiler */
@@ -147,11 +185,8 @@ static char *get_key(char *str, struct sort_key *key, int flags)
 	unsigned i;
 
 	/* Special case whole string, so we don't have to make a copy */
-	if (key->range[0] == 1 && !key->range[1] && !key->range[2] && !key->range[3]
-	 && !(flags & (FLAG_b | FLAG_d | FLAG_f | FLAG_i | FLAG_bb))
-	) {
+	if (key_is_whole_line(key, flags))
 		return str;
-	}
 
 	/* Find start of key on first pass, end on second pass */
 	len = strlen(str);
@@ -253,6 +288,46 @@ static struct sort_key *add_key(void)
 #define GET_LINE(fp) xmalloc_fgetline(fp)
 #endif
 
+/* If all keys are equal, break the tie. Apply -r */
+static int finish_compare(const void *xarg, const void *yarg, int retval, int flags)
+{
+	if (retval == 0) {
+		/* So far lines are "the same" */
+
+		if (option_mask32 & FLAG_s) {
+			/* "Stable sort": later line is "greater than",
+			 * IOW: do not allow qsort() to swap equal lines.
+			 */
+			uint32_t *p32;
+			uint32_t x32, y32;
+			char *line;
+			unsigned len;
+
+			line = *(char**)xarg;
+			len = (strlen(line) + 4) & (~3u);
+			p32 = (void*)(line + len);
+			x32 = *p32;
+			line = *(char**)yarg;
+			len = (strlen(line) + 4) & (~3u);
+			p32 = (void*)(line + len);
+			y32 = *p32;
+
+			/* If x > y, 1, else -1 */
+			retval = (x32 > y32) * 2 - 1;
+		} else
+		if (!(option_mask32 & FLAG_no_tie_break)) {
+			/* fallback sort */
+			flags = option_mask32;
+			retval = strcmp(*(char **)xarg, *(char **)yarg);
+		}
+	}
+
+	if (flags & FLAG_r)
+		return -retval;
+
+	return retval;
+}
+
 /* Iterate through keys list and perform comparisons */
 static int compare_keys(const void *xarg, const void *yarg)
 {
@@ -356,53 +431,658 @@ static int compare_keys(const void *xarg, const void *yarg)
 #endif
 	} /* for */
 
-	if (retval == 0) {
-		/* So far lines are "the same" */
+	return finish_compare(xarg, yarg, retval, flags);
+}
 
-		if (option_mask32 & FLAG_s) {
-			/* "Stable sort": later line is "greater than",
-			 * IOW: do not allow qsort() to swap equal lines.
-			 */
+#if ENABLE_FEATURE_SORT_BIG
+static unsigned str2u(char **str)
+{
+	unsigned long lu;
+	if (!isdigit((*str)[0]))
+		bb_simple_error_msg_and_die("bad field specification");
+	lu = strtoul(*str, str, 10);
+	if ((sizeof(long) > sizeof(int) && lu > INT_MAX) || !lu)
+		bb_simple_error_msg_and_die("bad field specification");
+	return lu;
+}
+#endif
+
+static int (*line_cmp)(const void *, const void *) = compare_keys;
+
+#if ENABLE_FEATURE_SORT_BIG
+/* Comparing by get_key() extracts (and, for -n/-g/-M, parses) both keys
+ * on every comparison. Instead, we extract keys of every line once
+ * into a cached_line, sort these, then put lines back into lines[] */
+struct cached_key {
+	union {
+		char *str;      /* string key */
+		double num;     /* -n, -g */
+	} u;
+	int cls;            /* -g: 0 not a number, 1 NaN, 2 number; -M: month or -1 */
+};
+struct cached_line {
+	char *line;
+	struct cached_key key[];
+};
+
+static int keys_need_cache(void)
+{
+	struct sort_key *key = key_list;
+	int flags = key->flags ? key->flags : option_mask32;
+
+	return key->next_key
+		|| (flags & (FLAG_n | FLAG_g | FLAG_M))
+		|| !key_is_whole_line(key, flags);
+}
+
+static void cache_key(struct cached_key *k, char *line, struct sort_key *key)
+{
+	int flags = key->flags ? key->flags : option_mask32;
+	char *str = get_key(line, key, flags);
+
+	switch (flags & (FLAG_n | FLAG_g | FLAG_M | FLAG_V)) {
+	case FLAG_n:
+		k->u.num = atof(str);
+		break;
+	case FLAG_g: {
+		char *end;
+		k->u.num = strtod(str, &end);
+		k->cls = (end == str) ? 0 : (k->u.num != k->u.num) ? 1 : 2;
+		break;
+	}
+	case FLAG_M: {
+		struct tm thyme;
+		k->cls = strptime(str, "%b", &thyme) ? thyme.tm_mon : -1;
+		break;
+	}
+	default:
+		k->u.str = str;
+		return;
+	}
+	if (str != line)
+		free(str);
+}
+
+/* Same order as compare_keys(), for cached_line's */
+static int compare_cached(const void *xarg, const void *yarg)
+{
+	struct cached_line *x = *(struct cached_line **)xarg;
+	struct cached_line *y = *(struct cached_line **)yarg;
+	struct cached_key *kx = x->key, *ky = y->key;
+	struct sort_key *key;
+	int flags = option_mask32, retval = 0;
+
+	for (key = key_list; !retval && key; key = key->next_key, kx++, ky++) {
+		flags = key->flags ? key->flags : option_mask32;
+		switch (flags & (FLAG_n | FLAG_g | FLAG_M | FLAG_V)) {
+		default:
+			bb_simple_error_msg_and_die("unknown sort type");
+			break;
+#if defined(HAVE_STRVERSCMP) && HAVE_STRVERSCMP == 1
+		case FLAG_V:
+			retval = strverscmp(kx->u.str, ky->u.str);
+			break;
+#endif
+		case 0:
+#if ENABLE_LOCALE_SUPPORT
+			retval = strcoll(kx->u.str, ky->u.str);
+#else
+			retval = strcmp(kx->u.str, ky->u.str);
+#endif
+			break;
+		/* not numbers < NaN < numbers (including infinities) */
+		case FLAG_g:
+			if (kx->cls != ky->cls) {
+				retval = (kx->cls > ky->cls) * 2 - 1;
+				break;
+			}
+			if (kx->cls != 2)
+				break;
+			/* fall through */
+		case FLAG_n:
+			retval = (kx->u.num > ky->u.num) - (kx->u.num < ky->u.num);
+			break;
+		case FLAG_M:
+			/* -1 (not a month) sorts first */
+			retval = kx->cls - ky->cls;
+			break;
+		}
+	}
+
+	return finish_compare(&x->line, &y->line, retval, flags);
+}
+
+/* Replace lines[] with pointers to cached_line's, return their storage */
+static char *cache_lines(char **lines, int linecount, size_t *recsizep)
+{
+	struct sort_key *key;
+	size_t recsize = sizeof(struct cached_line);
+	char *recs;
+	int i;
+
+	for (key = key_list; key; key = key->next_key)
+		recsize += sizeof(struct cached_key);
+	recs = xzalloc(linecount * recsize);
+	for (i = 0; i < linecount; i++) {
+		struct cached_line *rec = (void*)(recs + i * recsize);
+		struct cached_key *k = rec->key;
+
+		rec->line = lines[i];
+		for (key = key_list; key; key = key->next_key)
+			cache_key(k++, lines[i], key);
+		lines[i] = (char*)rec;
+	}
+	*recsizep = recsize;
+	return recs;
+}
+
+/* Free string keys in all cached_line's */
+static void free_cached_keys(char *recs, int count, size_t recsize)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		struct cached_line *rec = (void*)(recs + i * recsize);
+		struct cached_key *k = rec->key;
+		struct sort_key *key;
+
+		for (key = key_list; key; key = key->next_key, k++) {
+			int flags = key->flags ? key->flags : option_mask32;
+			if (!(flags & (FLAG_n | FLAG_g | FLAG_M)) && k->u.str != rec->line)
+				free(k->u.str);
+		}
+	}
+	free(recs);
+}
+#endif
+
+/* If the first key compares as plain bytes, radix sort by it,
+ * and use line_cmp() only to order lines with equal first keys.
+ * Returns 0 if the first key isn't a byte string */
+static int sort_by_first_key(void **vec, int linecount)
+{
+	int flags = option_mask32;
+	int key_ofs = -1;
+	int (*tie_cmp)(const void *, const void *) = NULL;
+#if ENABLE_FEATURE_SORT_BIG
+	struct sort_key *key = key_list;
+
+	if (key->flags)
+		flags = key->flags;
+#endif
+	if ((flags & (FLAG_n | FLAG_g | FLAG_M | FLAG_V))
+	 || !collation_is_bytewise()
+	) {
+		return 0;
+	}
+	/* -s: equal lines are ordered by their position */
+	if (option_mask32 & FLAG_s)
+		tie_cmp = line_cmp;
+#if ENABLE_FEATURE_SORT_BIG
+	if (line_cmp == compare_cached) {
+		/* Key is a (modified) part of line, or there are more keys */
+		key_ofs = offsetof(struct cached_line, key[0].u.str);
+		tie_cmp = compare_cached;
+	}
+#endif
+	sort_by_string_key(vec, linecount, key_ofs,
+			(flags & FLAG_r) ? SORT_KEY_REVERSE : 0,
+			tie_cmp);
+	return 1;
+}
+
+static void sort_vector(void **vec, int count)
+{
+	if (!sort_by_first_key(vec, count))
+		qsort(vec, count, sizeof(vec[0]), line_cmp);
+}
+
+/* --parallel=N: sort N parts of lines[] in threads, then merge them,
+ * also in N threads. Since line_cmp() orders all lines which aren't
+ * identical (ties are broken by whole line, or by position for -s),
+ * the result is the same as that of a single sort.
+ */
+#define PARALLEL_MIN_LINES (16 * 1024)
+
+static bb_pool *sort_pool;
+static unsigned sort_nthreads;
+
+struct sort_job {
+	bb_task task;
+	void **a, **b;      /* sort a[], or merge a[] and b[] to out[] */
+	void **out;
+	int na, nb;
+};
+
+static void FAST_FUNC run_sort_job(bb_task *task)
+{
+	struct sort_job *job = (struct sort_job *)task;
+
+	sort_vector(job->a, job->na);
+}
+
+static void FAST_FUNC run_merge_job(bb_task *task)
+{
+	struct sort_job *job = (struct sort_job *)task;
+	void **a = job->a, **a_end = a + job->na;
+	void **b = job->b, **b_end = b + job->nb;
+	void **out = job->out;
+
+	while (a < a_end && b < b_end) {
+		/* Equal lines: one from a[] (earlier part) goes first */
+		if (line_cmp(b, a) < 0)
+			*out++ = *b++;
+		else
+			*out++ = *a++;
+	}
+	memcpy(out, a, (a_end - a) * sizeof(*a));
+	out += a_end - a;
+	memcpy(out, b, (b_end - b) * sizeof(*b));
+}
+
+/* Index of first line in b[] which is not less than *line */
+static int lower_bound(void **b, int nb, void **line)
+{
+	int lo = 0, hi = nb;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (line_cmp(&b[mid], line) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void sort_parallel(void **lines, int linecount)
+{
+	unsigned n = sort_nthreads;
+	int *bounds = xmalloc((n + 1) * sizeof(bounds[0]));
+	struct sort_job *jobs = xzalloc(2 * n * sizeof(jobs[0]));
+	void **buf = xmalloc(linecount * sizeof(lines[0]));
+	void **src = lines, **dst = buf;
+	unsigned i, nruns;
+
+	for (i = 0; i <= n; i++)
+		bounds[i] = (unsigned long long)linecount * i / n;
+	for (i = 0; i < n; i++) {
+		jobs[i].task.run = run_sort_job;
+		jobs[i].a = lines + bounds[i];
+		jobs[i].na = bounds[i + 1] - bounds[i];
+		bb_pool_submit(sort_pool, &jobs[i].task);
+	}
+	bb_pool_wait(sort_pool, NULL);
+
+	/* Merge pairs of runs until one is left. To keep all threads busy
+	 * when there are few pairs, split each pair into nseg parts:
+	 * a[] at even intervals, b[] where those a[] lines would go */
+	for (nruns = n; nruns > 1; nruns = (nruns + 1) / 2) {
+		unsigned npairs = nruns / 2;
+		unsigned nseg = (n + npairs - 1) / npairs;
+		struct sort_job *job = jobs;
+
+		for (i = 0; i < npairs; i++) {
+			void **a = src + bounds[2*i];
+			void **b = src + bounds[2*i + 1];
+			int na = bounds[2*i + 1] - bounds[2*i];
+			int nb = bounds[2*i + 2] - bounds[2*i + 1];
+			int a0 = 0, b0 = 0;
+			unsigned seg;
+
+			for (seg = 1; seg <= nseg; seg++, job++) {
+				int a1 = na, b1 = nb;
+
+				if (seg < nseg) {
+					a1 = (unsigned long long)na * seg / nseg;
+					if (a1 < na)
+						b1 = lower_bound(b, nb, &a[a1]);
+				}
+				job->task.run = run_merge_job;
+				job->a = a + a0;
+				job->na = a1 - a0;
+				job->b = b + b0;
+				job->nb = b1 - b0;
+				job->out = dst + bounds[2*i] + a0 + b0;
+				bb_pool_submit(sort_pool, &job->task);
+				a0 = a1;
+				b0 = b1;
+			}
+		}
+		if (nruns & 1) {
+			i = nruns - 1;
+			memcpy(dst + bounds[i], src + bounds[i],
+				(bounds[i + 1] - bounds[i]) * sizeof(src[0]));
+		}
+		bb_pool_wait(sort_pool, NULL);
+
+		for (i = 0; i < npairs; i++)
+			bounds[i + 1] = bounds[2*i + 2];
+		if (nruns & 1)
+			bounds[npairs + 1] = bounds[nruns];
+		src = dst;
+		dst = (src == lines) ? buf : lines;
+	}
+	if (src != lines)
+		memcpy(lines, src, linecount * sizeof(lines[0]));
+	free(buf);
+	free(jobs);
+	free(bounds);
+}
+
+/* Sort lines[], drop duplicates if -u. Returns new line count */
+static int sort_lines(char **lines, int linecount)
+{
+	void **vec = (void **)lines;
+	int i;
+#if ENABLE_FEATURE_SORT_BIG
+	char *recs = NULL;
+	size_t recsize = recsize; /* for compiler */
+	int count = linecount;
+#endif
+
+	/* For stable sort, store original line position beyond terminating NUL */
+	if (option_mask32 & FLAG_s) {
+		for (i = 0; i < linecount; i++) {
 			uint32_t *p32;
-			uint32_t x32, y32;
 			char *line;
 			unsigned len;
 
-			line = *(char**)xarg;
-			len = (strlen(line) + 4) & (~3u);
-			p32 = (void*)(line + len);
-			x32 = *p32;
-			line = *(char**)yarg;
+			line = lines[i];
 			len = (strlen(line) + 4) & (~3u);
+			lines[i] = line = xrealloc(line, len + 4);
 			p32 = (void*)(line + len);
-			y32 = *p32;
+			*p32 = i;
+		}
+		/*option_mask32 |= FLAG_no_tie_break;*/
+		/* ^^^redundant: if FLAG_s, compare_keys() does no tie break */
+	}
 
-			/* If x > y, 1, else -1 */
-			retval = (x32 > y32) * 2 - 1;
-		} else
-		if (!(option_mask32 & FLAG_no_tie_break)) {
-			/* fallback sort */
-			flags = option_mask32;
-			retval = strcmp(*(char **)xarg, *(char **)yarg);
+#if ENABLE_FEATURE_SORT_BIG
+	if (linecount > 1 && keys_need_cache()) {
+		recs = cache_lines(lines, linecount, &recsize);
+		line_cmp = compare_cached;
+	}
+#endif
+
+	/* Perform the actual sort */
+	if (sort_pool && linecount >= PARALLEL_MIN_LINES)
+		sort_parallel(vec, linecount);
+	else
+		sort_vector(vec, linecount);
+
+	/* Handle -u */
+	if (option_mask32 & FLAG_u) {
+		int j = 0;
+		/* coreutils 6.3 drop lines for which only key is the same
+		 * -- disabling last-resort compare, or else compare_keys()
+		 * will be the same only for completely identical lines.
+		 */
+		option_mask32 |= FLAG_no_tie_break;
+		for (i = 1; i < linecount; i++) {
+			if (line_cmp(&vec[j], &vec[i]) == 0) {
+				char *line = vec[i];
+#if ENABLE_FEATURE_SORT_BIG
+				if (recs)
+					line = ((struct cached_line *)line)->line;
+#endif
+				free(line);
+			} else
+				vec[++j] = vec[i];
 		}
+		option_mask32 &= ~FLAG_no_tie_break;
+		if (linecount)
+			linecount = j+1;
 	}
 
-	if (flags & FLAG_r)
-		return -retval;
+#if ENABLE_FEATURE_SORT_BIG
+	if (recs) {
+		for (i = 0; i < linecount; i++)
+			lines[i] = ((struct cached_line *)vec[i])->line;
+		free_cached_keys(recs, count, recsize);
+		line_cmp = compare_keys;
+	}
+#endif
+	return linecount;
+}
 
-	return retval;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+/* Don't keep more than this many temporary files open */
+#define MAX_RUNS 256
+
+static const char *sort_tmpdir;
+static unsigned merge_batch = 16;
+
+static const struct suffix_mult sort_size_suffixes[] = {
+	{ "b", 1 },
+	{ "k", 1024 },
+	{ "K", 1024 },
+	{ "M", 1024*1024 },
+	{ "G", 1024*1024*1024 },
+	{ "", 0 }
+};
+
+/* -S SIZE: bytes with b suffix, % of RAM with %, KiB by default */
+static size_t get_mem_limit(char *str)
+{
+	struct sysinfo info;
+	unsigned long long ram, limit;
+	char *last;
+
+	sysinfo(&info);
+	ram = (unsigned long long)info.totalram * info.mem_unit;
+	if (!str) {
+		limit = ram / 2;
+	} else {
+		last = last_char_is(str, '%');
+		if (last) {
+			*last = '\0';
+			limit = ram / 100 * xatou_range(str, 0, 100);
+		} else {
+			limit = xatoull_sfx(str, sort_size_suffixes);
+			if (isdigit(str[strlen(str) - 1]))
+				limit *= 1024;
+		}
+	}
+	if (limit > (size_t)-1L / 2)
+		limit = (size_t)-1L / 2;
+	return limit;
 }
 
-#if ENABLE_FEATURE_SORT_BIG
-static unsigned str2u(char **str)
+/* Create an already unlinked temporary file */
+static int create_temp_file(void)
 {
-	unsigned long lu;
-	if (!isdigit((*str)[0]))
-		bb_simple_error_msg_and_die("bad field specification");
-	lu = strtoul(*str, str, 10);
-	if ((sizeof(long) > sizeof(int) && lu > INT_MAX) || !lu)
-		bb_simple_error_msg_and_die("bad field specification");
-	return lu;
+	char *name = concat_path_file(sort_tmpdir, "sortXXXXXX");
+	int fd = xmkstemp(name);
+
+	unlink(name);
+	free(name);
+	return fd;
+}
+
+/* Create a temporary file for a sorted run, open it for writing */
+static FILE *create_run(int *fdp)
+{
+	int fd = *fdp = create_temp_file();
+
+	fd = dup(fd);
+	if (fd < 0)
+		bb_simple_perror_msg_and_die("dup");
+	return xfdopen_for_write(fd);
+}
+
+/* Flush the run, rewind it for reading */
+static void finish_run(FILE *fp, int fd)
+{
+	if (fclose(fp) != 0)
+		bb_simple_perror_msg_and_die(bb_msg_write_error);
+	xlseek(fd, 0, SEEK_SET);
+}
+
+/* Write sorted lines to a temporary file, free them */
+static int write_run(char **lines, int linecount)
+{
+	int ch = (option_mask32 & FLAG_z) ? '\0' : '\n';
+	int fd, i;
+	FILE *fp = create_run(&fd);
+
+	for (i = 0; i < linecount; i++) {
+		fputs(lines[i], fp);
+		putc(ch, fp);
+		free(lines[i]);
+	}
+	finish_run(fp, fd);
+	return fd;
+}
+
+struct merge_src {
+	char *line;         /* current line, NULL at EOF */
+	struct line_reader *lr;
+	char *buf;          /* -s: copy of line with run number after it */
+	size_t bufsize;
+	uint32_t runno;
+};
+
+static char *merge_next_line(struct merge_src *src)
+{
+	char *line = line_reader_getline(src->lr, NULL);
+
+	if (!line) {
+		if (src->lr->error) {
+			errno = src->lr->error;
+			bb_simple_perror_msg_and_die(bb_msg_read_error);
+		}
+	} else if (option_mask32 & FLAG_s) {
+		/* Tag line with its run number, like sort_lines() tags
+		 * lines with their position: earlier run wins ties */
+		unsigned len = strlen(line);
+		unsigned ofs = (len + 4) & (~3u);
+
+		if (ofs + 4 > src->bufsize) {
+			src->bufsize = ofs + 4 + 256;
+			src->buf = xrealloc(src->buf, src->bufsize);
+		}
+		memcpy(src->buf, line, len + 1);
+		*(uint32_t*)(src->buf + ofs) = src->runno;
+		line = src->buf;
+	}
+	return (src->line = line);
+}
+
+static int merge_less(struct merge_src *a, struct merge_src *b)
+{
+	return compare_keys(&a->line, &b->line) < 0;
+}
+
+static void heap_sift_down(struct merge_src **heap, unsigned n, unsigned i)
+{
+	struct merge_src *t = heap[i];
+
+	for (;;) {
+		unsigned c = 2 * i + 1;
+		if (c >= n)
+			break;
+		if (c + 1 < n && merge_less(heap[c + 1], heap[c]))
+			c++;
+		if (!merge_less(heap[c], t))
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = t;
+}
+
+/* Merge sorted fds[] to out, close them */
+static void merge_runs(int *fds, unsigned n, FILE *out)
+{
+	struct merge_src *src = xzalloc(n * sizeof(src[0]));
+	struct merge_src **heap = xmalloc(n * sizeof(heap[0]));
+	int ch = (option_mask32 & FLAG_z) ? '\0' : '\n';
+	char *prev = NULL;
+	size_t prev_size = 0;
+	unsigned i, cnt;
+
+	cnt = 0;
+	for (i = 0; i < n; i++) {
+		/* NUL ends a line on the main input path too */
+		src[i].lr = line_reader_new(fds[i], LR_STOP_AT_NUL
+				| ((option_mask32 & FLAG_z) ? LR_NUL_DELIMITED : 0));
+		src[i].runno = i;
+		if (merge_next_line(&src[i]))
+			heap[cnt++] = &src[i];
+	}
+	for (i = cnt / 2; i != 0;)
+		heap_sift_down(heap, cnt, --i);
+
+	while (cnt != 0) {
+		struct merge_src *s = heap[0];
+
+		if (option_mask32 & FLAG_u) {
+			/* Print only the first of lines with equal keys */
+			size_t size;
+			int cmp = 1;
+
+			if (prev) {
+				option_mask32 |= FLAG_no_tie_break;
+				cmp = compare_keys(&prev, &s->line);
+				option_mask32 &= ~FLAG_no_tie_break;
+			}
+			if (cmp == 0)
+				goto next;
+			size = strlen(s->line) + 1;
+			if (option_mask32 & FLAG_s)
+				size = ((size + 3) & (~(size_t)3)) + 4;
+			if (size > prev_size) {
+				prev_size = size + 256;
+				free(prev);
+				prev = xmalloc(prev_size);
+			}
+			memcpy(prev, s->line, size);
+		}
+		fputs(s->line, out);
+		putc(ch, out);
+ next:
+		if (!merge_next_line(s))
+			heap[0] = heap[--cnt];
+		if (cnt > 1)
+			heap_sift_down(heap, cnt, 0);
+	}
+
+	for (i = 0; i < n; i++) {
+		line_reader_free(src[i].lr);
+		free(src[i].buf);
+		close(fds[i]);
+	}
+	free(prev);
+	free(heap);
+	free(src);
+}
+
+/* Merge each merge_batch runs into one, preserving their order.
+ * Returns new number of runs */
+static unsigned merge_pass(int *fds, unsigned n)
+{
+	unsigned i, k;
+
+	for (i = k = 0; i < n; i += merge_batch, k++) {
+		unsigned cnt = MIN(merge_batch, n - i);
+		int fd = fds[i];
+
+		if (cnt > 1) {
+			FILE *fp = create_run(&fd);
+			merge_runs(fds + i, cnt, fp);
+			finish_run(fp, fd);
+		}
+		fds[k] = fd;
+	}
+	return k;
+}
+
+static void merge_all(int *fds, unsigned n)
+{
+	while (n > merge_batch)
+		n = merge_pass(fds, n);
+	merge_runs(fds, n, stdout);
 }
 #endif
 
@@ -410,11 +1090,17 @@ int sort_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int sort_main(int argc UNUSED_PARAM, char **argv)
 {
 	char **lines;
-	char *str_ignored, *str_o, *str_t;
+	char *str_S = NULL, *str_T, *str_o, *str_t, *str_parallel;
 	llist_t *lst_k = NULL;
 	int i;
 	int linecount;
 	unsigned opts;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	char *str_batch;
+	size_t mem_limit, mem_used;
+	int *fds = NULL;
+	unsigned nruns = 0;
+#endif
 #if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
 	bool can_drop_dups;
 	size_t prev_len = 0;
@@ -428,10 +1114,17 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 	xfunc_error_retval = 2;
 
 	/* Parse command line options */
-	opts = getopt32(argv,
-			sort_opt_str,
-			&str_ignored, &str_ignored, &str_o, &lst_k, &str_t
+	opts = getopt32long(argv,
+			sort_opt_str, sort_longopts,
+			&str_S, &str_T, &str_o, &lst_k, &str_t
+			IF_LONG_OPTS(, &str_parallel)
+			IF_FEATURE_SORT_EXTERNAL(IF_LONG_OPTS(, &str_batch))
 	);
+	if (opts & FLAG_parallel) {
+		sort_nthreads = xatou_range(str_parallel, 1, 256);
+		if (sort_nthreads > 1)
+			sort_pool = bb_pool_new(sort_nthreads);
+	}
 #if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
 	/* Can drop dups only if -u but no "complicating" options,
 	 * IOW: if we do a full line compares. Safe options:
@@ -516,6 +1209,59 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 			}
 		}
 	}
+	/* If no key, perform alphabetic sort */
+	if (!key_list)
+		add_key()->range[0] = 1;
+#endif
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	sort_tmpdir = (option_mask32 & FLAG_T) ? str_T : getenv("TMPDIR");
+	if (!sort_tmpdir || !sort_tmpdir[0])
+		sort_tmpdir = "/tmp";
+	if (option_mask32 & FLAG_batch_size) {
+		/* More would run out of fds */
+		merge_batch = MIN(xatou_range(str_batch, 2, UINT_MAX), MAX_RUNS);
+	}
+	mem_limit = get_mem_limit(str_S);
+	mem_used = 0;
+
+	/* -m: inputs are sorted already, merge them as they are read */
+	if ((option_mask32 & (FLAG_m | FLAG_c)) == FLAG_m) {
+		struct stat out_st;
+
+		argv += optind;
+		if (!*argv)
+			*--argv = (char*)"-";
+		out_st.st_ino = 0;
+		if (option_mask32 & FLAG_o)
+			if (stat(str_o, &out_st) != 0)
+				out_st.st_ino = 0;
+		nruns = 0;
+		do {
+			struct stat st;
+			int fd = xopen_stdin(*argv);
+
+			/* "sort -m -o F F": don't truncate F before we read it */
+			if (out_st.st_ino != 0
+			 && fstat(fd, &st) == 0
+			 && st.st_ino == out_st.st_ino && st.st_dev == out_st.st_dev
+			) {
+				int tmp_fd = create_temp_file();
+				if (bb_copyfd_eof(fd, tmp_fd) < 0)
+					xfunc_die();
+				close(fd);
+				xlseek(tmp_fd, 0, SEEK_SET);
+				fd = tmp_fd;
+			}
+			fds = xrealloc_vector(fds, 4, nruns);
+			fds[nruns++] = fd;
+			if (nruns >= MAX_RUNS)
+				nruns = merge_pass(fds, nruns);
+		} while (*++argv);
+		if (option_mask32 & FLAG_o)
+			xmove_fd(xopen(str_o, O_WRONLY|O_CREAT|O_TRUNC), STDOUT_FILENO);
+		merge_all(fds, nruns);
+		fflush_stdout_and_exit(EXIT_SUCCESS);
+	}
 #endif
 
 	/* Open input files and read data */
@@ -555,31 +1301,51 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 							free(line);
 							continue;
 						}
+# if !ENABLE_FEATURE_SORT_EXTERNAL
+						/* (can't share lines if we free them
+						 * when writing out a run) */
 						free(line);
 						line = new_line;
 						/* continue using longer prev_line
 						 * for future tail tests.
 						 */
 						goto skip;
+# endif
 					}
 				}
 				prev_len = len;
 				prev_line = line;
+# if !ENABLE_FEATURE_SORT_EXTERNAL
  skip: ;
+# endif
 			}
 #else
 //TODO: lighter version which only drops total dups if can_drop_dups == true
 #endif
 			lines = xrealloc_vector(lines, 6, linecount);
 			lines[linecount++] = line;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+			/* Out of memory budget? Sort what we have, write it out */
+			mem_used += strlen(line) + 1 + 4 * sizeof(void*);
+			if (mem_used > mem_limit && !(option_mask32 & FLAG_c)) {
+				linecount = sort_lines(lines, linecount);
+				fds = xrealloc_vector(fds, 4, nruns);
+				fds[nruns++] = write_run(lines, linecount);
+				if (nruns >= MAX_RUNS)
+					nruns = merge_pass(fds, nruns);
+				linecount = 0;
+				mem_used = 0;
+# if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
+				prev_len = 0;
+				prev_line = (char*) "";
+# endif
+			}
+#endif
 		}
 		fclose_if_not_stdin(fp);
 	} while (*++argv);
 
 #if ENABLE_FEATURE_SORT_BIG
-	/* If no key, perform alphabetic sort */
-	if (!key_list)
-		add_key()->range[0] = 1;
 	/* Handle -c */
 	if (option_mask32 & FLAG_c) {
 		int j = (option_mask32 & FLAG_u) ? -1 : 0;
@@ -593,43 +1359,19 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 	}
 #endif
 
-	/* For stable sort, store original line position beyond terminating NUL */
-	if (option_mask32 & FLAG_s) {
-		for (i = 0; i < linecount; i++) {
-			uint32_t *p32;
-			char *line;
-			unsigned len;
+	linecount = sort_lines(lines, linecount);
 
-			line = lines[i];
-			len = (strlen(line) + 4) & (~3u);
-			lines[i] = line = xrealloc(line, len + 4);
-			p32 = (void*)(line + len);
-			*p32 = i;
-		}
-		/*option_mask32 |= FLAG_no_tie_break;*/
-		/* ^^^redundant: if FLAG_s, compare_keys() does no tie break */
-	}
-
-	/* Perform the actual sort */
-	qsort(lines, linecount, sizeof(lines[0]), compare_keys);
-
-	/* Handle -u */
-	if (option_mask32 & FLAG_u) {
-		int j = 0;
-		/* coreutils 6.3 drop lines for which only key is the same
-		 * -- disabling last-resort compare, or else compare_keys()
-		 * will be the same only for completely identical lines.
-		 */
-		option_mask32 |= FLAG_no_tie_break;
-		for (i = 1; i < linecount; i++) {
-			if (compare_keys(&lines[j], &lines[i]) == 0)
-				free(lines[i]);
-			else
-				lines[++j] = lines[i];
-		}
-		if (linecount)
-			linecount = j+1;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	/* Input didn't fit: write out the last run, merge all of them */
+	if (nruns != 0) {
+		fds = xrealloc_vector(fds, 4, nruns);
+		fds[nruns++] = write_run(lines, linecount);
+		if (option_mask32 & FLAG_o)
+			xmove_fd(xopen(str_o, O_WRONLY|O_CREAT|O_TRUNC), STDOUT_FILENO);
+		merge_all(fds, nruns);
+		fflush_stdout_and_exit(EXIT_SUCCESS);
 	}
+#endif
 
 	/* Print it */
 #if ENABLE_FEATURE_SORT_BIG
@@ -31,18 +31,69 @@
 
 /* This is a NOEXEC applet. Be very careful! */
 
-struct lstring {
-	int size;
-	char buf[1];
-};
+/* Input is read backwards by blocks of this size */
+#define TAC_BLOCK (64 * 1024)
+
+/* Print the lines of [start, end) last to first, up to the first
+ * newline. The text before it is printed too if bof is set
+ * (it is the first line of input).
+ * Returns the end of what is left unprinted.
+ */
+static char *tac_lines(char *start, char *end, int bof)
+{
+	while (end > start) {
+		char *nl = memrchr(start, '\n', end - 1 - start);
+		if (!nl) {
+			if (!bof)
+				break;
+			nl = start - 1;
+		}
+		fwrite(nl + 1, 1, end - (nl + 1), stdout);
+		end = nl + 1;
+	}
+	return end;
+}
+
+/* Regular file: read it from the end, keeping in memory
+ * only the line which crosses block boundary */
+static int tac_seekable(int fd, off_t bof, off_t pos)
+{
+	size_t cap = 2 * TAC_BLOCK;
+	size_t len = 0; /* unprinted text is at buf + cap - len */
+	char *buf = xmalloc(cap);
+	int retval = 0;
+
+	while (pos > bof) {
+		size_t n = MIN(TAC_BLOCK, pos - bof);
+		char *start, *end;
+
+		if (cap - len < n) {
+			/* A long line */
+			size_t newcap = (len + n) * 2;
+			char *newbuf = xmalloc(newcap);
+			memcpy(newbuf + newcap - len, buf + cap - len, len);
+			free(buf);
+			buf = newbuf;
+			cap = newcap;
+		}
+		start = buf + cap - len - n;
+		pos -= n;
+		xlseek(fd, pos, SEEK_SET);
+		if (full_read(fd, start, n) != (ssize_t)n) {
+			retval = -1;
+			break;
+		}
+		end = tac_lines(start, buf + cap, pos == bof);
+		len = end - start;
+		memmove(buf + cap - len, start, len);
+	}
+	free(buf);
+	return retval;
+}
 
 int tac_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int tac_main(int argc UNUSED_PARAM, char **argv)
 {
-	char **name;
-	FILE *f;
-	struct lstring *line = NULL;
-	llist_t *list = NULL;
 	int retval = EXIT_SUCCESS;
 
 #if ENABLE_DESKTOP
@@ -62,56 +113,39 @@ We support none, but at least we will complain or handle "--":
 #endif
 	if (!*argv)
 		*--argv = (char *)"-";
-	/* We will read from last file to first */
-	name = argv;
-	while (*name)
-		name++;
 
 	do {
-		int ch, i;
+		struct stat st;
+		off_t bof;
+		int fd = open_or_warn_stdin(*argv);
 
-		name--;
-		f = fopen_or_warn_stdin(*name);
-		if (f == NULL) {
-			/* error message is printed by fopen_or_warn_stdin */
+		if (fd < 0) {
+			/* error message is printed by open_or_warn_stdin */
 			retval = EXIT_FAILURE;
 			continue;
 		}
-
-		errno = i = 0;
-		do {
-			ch = fgetc(f);
-			if (ch != EOF) {
-				if (!(i & 0x7f))
-					/* Grow on every 128th char */
-					line = xrealloc(line, i + 0x7f + sizeof(int) + 1);
-				line->buf[i++] = ch;
-			}
-			if (ch == '\n' || (ch == EOF && i != 0)) {
-				line = xrealloc(line, i + sizeof(int));
-				line->size = i;
-				llist_add_to(&list, line);
-				line = NULL;
-				i = 0;
-			}
-		} while (ch != EOF);
-		/* fgetc sets errno to ENOENT on EOF, we don't want
-		 * to warn on this non-error! */
-		if (errno && errno != ENOENT) {
-			bb_simple_perror_msg(*name);
-			retval = EXIT_FAILURE;
-		}
-	} while (name != argv);
-
-	while (list) {
-		line = (struct lstring *)list->data;
-		xwrite(STDOUT_FILENO, line->buf, line->size);
-		if (ENABLE_FEATURE_CLEAN_UP) {
-			free(llist_pop(&list));
+		/* /proc files report zero st_size, read them to EOF */
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+		 && (bof = lseek(fd, 0, SEEK_CUR)) >= 0
+		) {
+			if (bof < st.st_size && tac_seekable(fd, bof, st.st_size) != 0)
+				goto err;
 		} else {
-			list = list->link;
+			size_t size = INT_MAX - 4095;
+			char *buf = xmalloc_read(fd, &size);
+			if (!buf)
+				goto err;
+			tac_lines(buf, buf + size, 1);
+			free(buf);
 		}
-	}
+		if (0) {
+ err:
+			bb_simple_perror_msg(*argv);
+			retval = EXIT_FAILURE;
+		}
+		if (fd != STDIN_FILENO)
+			close(fd);
+	} while (*++argv);
 
-	return retval;
+	fflush_stdout_and_exit(retval);
 }
@@ -36,6 +36,17 @@
 //config:		-s SEC  Wait SEC seconds between reads with -f
 //config:		-v      Always output headers giving file names
 //config:		-F      Same as -f, but keep retrying
+//config:
+//config:config FEATURE_TAIL_INOTIFY
+//config:	bool "Use inotify to wait for changes with -f and -F"
+//config:	default y
+//config:	depends on TAIL && PLATFORM_POSIX
+//config:	select PLATFORM_LINUX
+//config:	help
+//config:	Sleep until a followed file is modified, truncated or
+//config:	replaced, instead of checking all of them every second.
+//config:	Files which can't be watched (pipes, network filesystems)
+//config:	are still checked every -s SEC seconds.
 
 //applet:IF_TAIL(APPLET(tail, BB_DIR_USR_BIN, BB_SUID_DROP))
 
@@ -69,10 +80,16 @@
 
 #include "libbb.h"
 #include "common_bufsiz.h"
+#if ENABLE_FEATURE_TAIL_INOTIFY
+# include <sys/inotify.h>
+#endif
 
 struct globals {
 	bool from_top;
 	bool exitcode;
+#if ENABLE_FEATURE_TAIL_INOTIFY
+	unsigned long long poll_deadline; /* ms, when to look at polled files */
+#endif
 } FIX_ALIASING;
 #define G (*(struct globals*)bb_common_bufsiz1)
 #define INIT_G() do { setup_common_bufsiz(); } while (0)
@@ -96,8 +113,212 @@ static ssize_t tail_read(int fd, char *buf, size_t count)
 	return r;
 }
 
+#if ENABLE_FEATURE_TAIL_INOTIFY
+struct tail_watch {
+	int wd;      /* watch on the file, or -1 */
+	int dir_wd;  /* with -F: watch on its directory, or -1 */
+	bool polled; /* can't be watched, check it every sleep_period */
+	bool changed;
+};
+
+/* inotify does not see changes made by other hosts,
+ * and procfs/sysfs files change without any events */
+static int is_watchable_fs(int fd, const char *path)
+{
+	struct statfs sfs;
+
+	if ((path ? statfs(path, &sfs) : fstatfs(fd, &sfs)) != 0)
+		return 0;
+	switch ((unsigned)sfs.f_type) {
+	case 0x6969:     /* nfs */
+	case 0x517b:     /* smb */
+	case 0xff534d42: /* cifs */
+	case 0xfe534d42: /* smb2 */
+	case 0x65735546: /* fuse */
+	case 0x01021997: /* 9p */
+	case 0x00c36400: /* ceph */
+	case 0x5346414f: /* afs */
+	case 0x9fa0:     /* proc */
+	case 0x62656572: /* sysfs */
+		return 0;
+	}
+	return 1;
+}
+
+static void tail_watch_file(int ifd, struct tail_watch *w,
+		int fd, const char *filename, int retry)
+{
+	struct stat sbuf;
+
+	w->wd = -1;
+	if (fd >= 0 && fstat(fd, &sbuf) == 0 && S_ISREG(sbuf.st_mode)
+	 && is_watchable_fs(fd, NULL)
+	) {
+		w->wd = inotify_add_watch(ifd,
+			fd == STDIN_FILENO ? "/proc/self/fd/0" : filename,
+			IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF
+		);
+	}
+	/* With -F, a missing file is noticed by the directory watch */
+	w->polled = (fd >= 0 && w->wd < 0) || (retry && w->dir_wd < 0);
+	w->changed = 1;
+}
+
+static void tail_watch_dir(int ifd, struct tail_watch *w, const char *filename)
+{
+	const char *base = bb_basename(filename);
+	char *dir = (base == filename) ? xstrdup(".") : xstrndup(filename, base - filename);
+
+	w->dir_wd = -1;
+	if (is_watchable_fs(-1, dir)) {
+		w->dir_wd = inotify_add_watch(ifd, dir,
+			IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB
+			| IN_ONLYDIR
+		);
+	}
+	free(dir);
+}
+
+/* Mark the files which inotify reports as changed */
+static void tail_read_events(int ifd, struct tail_watch *w, unsigned nfiles)
+{
+	unsigned i;
+
+	for (;;) {
+		char buf[sizeof(struct inotify_event) + PATH_MAX + 1]
+			ALIGNED(__alignof__(struct inotify_event));
+		char *p;
+		ssize_t len = read(ifd, buf, sizeof(buf));
+
+		if (len <= 0)
+			break;
+		for (p = buf; p < buf + len;) {
+			struct inotify_event *ev = (void *)p;
+
+			for (i = 0; i < nfiles; i++) {
+				if (ev->mask & IN_Q_OVERFLOW)
+					w[i].changed = 1;
+				else if (ev->wd == w[i].wd || ev->wd == w[i].dir_wd) {
+					w[i].changed = 1;
+					if ((ev->mask & IN_IGNORED) && ev->wd == w[i].wd)
+						w[i].wd = -1;
+				}
+			}
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+}
+
+/* Sleep until some of the followed files change, or for sleep_period
+ * if some of them can't be watched. Mark the files to look at.
+ * Polled files are marked every sleep_period even if a steady stream
+ * of events from the watched ones keeps poll() from timing out.
+ */
+static void tail_wait(int ifd, struct tail_watch *w, unsigned nfiles,
+		unsigned sleep_period)
+{
+	struct pollfd pfd;
+	int timeout = -1;
+	bool polled = 0;
+	unsigned i;
+
+	for (i = 0; i < nfiles; i++) {
+		if (w[i].changed)
+			timeout = 0;
+		polled |= w[i].polled;
+	}
+	if (polled && timeout != 0) {
+		unsigned long long now = monotonic_ms();
+
+		timeout = 0;
+		if (G.poll_deadline > now)
+			timeout = MIN(G.poll_deadline - now, INT_MAX);
+	}
+
+	pfd.fd = ifd;
+	pfd.events = POLLIN;
+	if (safe_poll(&pfd, 1, timeout) > 0)
+		tail_read_events(ifd, w, nfiles);
+
+	if (polled) {
+		unsigned long long now = monotonic_ms();
+
+		if (now >= G.poll_deadline) {
+			for (i = 0; i < nfiles; i++)
+				if (w[i].polled)
+					w[i].changed = 1;
+			G.poll_deadline = now + sleep_period * 1000ULL;
+		}
+	}
+}
+#endif
+
 #define header_fmt_str "\n==> %s <==\n"
 
+/* Print what was appended to fd since the last call */
+static void tail_follow_read(int fd, const char *filename,
+		const char **fmt, int *prev_fd, char *buf)
+{
+	for (;;) {
+		/* tail -f keeps following files even if they are truncated */
+		struct stat sbuf;
+		int nread;
+
+		/* /proc files report zero st_size, don't lseek them */
+		if (fstat(fd, &sbuf) == 0 && sbuf.st_size > 0) {
+			off_t current = lseek(fd, 0, SEEK_CUR);
+			if (sbuf.st_size < current)
+				xlseek(fd, 0, SEEK_SET);
+		}
+
+		nread = tail_read(fd, buf, BUFSIZ);
+		if (nread <= 0)
+			break;
+		if (*fmt && (fd != *prev_fd)) {
+			tail_xprint_header(*fmt, filename);
+			*fmt = NULL;
+			*prev_fd = fd;
+		}
+		xwrite(STDOUT_FILENO, buf, nread);
+	}
+}
+
+/* Find where the last count lines of a file of the given size start.
+ * A last line without newline counts as a line.
+ */
+static off_t tail_find_lines(int fd, const char *filename, off_t size,
+		unsigned count, char *buf, size_t bufsize)
+{
+	off_t pos = size;
+
+	if (count == 0)
+		return size;
+	while (pos > 0) {
+		size_t n = MIN(bufsize, pos);
+		char *p;
+
+		pos -= n;
+		xlseek(fd, pos, SEEK_SET);
+		errno = 0;
+		if (full_read(fd, buf, n) != (ssize_t)n) {
+			/* A short read means the file shrank under us */
+			if (errno == 0)
+				errno = EIO;
+			bb_simple_perror_msg(filename);
+			G.exitcode = EXIT_FAILURE;
+			return -1;
+		}
+		p = buf + n;
+		if (pos + n == size && p[-1] == '\n')
+			p--; /* newline which ends the last line */
+		while ((p = memrchr(buf, '\n', p - buf)) != NULL) {
+			if (--count == 0)
+				return pos + (p - buf) + 1;
+		}
+	}
+	return 0;
+}
+
 static unsigned eat_num(const char *p)
 {
 	if (*p == '-')
@@ -125,6 +346,10 @@ int tail_main(int argc, char **argv)
 	int *fds;
 	const char *fmt;
 	int prev_fd;
+#if ENABLE_FEATURE_TAIL_INOTIFY
+	struct tail_watch *watches = NULL;
+	int ifd = -1;
+#endif
 
 	INIT_G();
 
@@ -195,6 +420,10 @@ int tail_main(int argc, char **argv)
 			tailbufsize = count + BUFSIZ;
 		}
 	}
+	if (!G.from_top && !COUNT_BYTES) {
+		/* Seekable files are scanned backwards by blocks of this size */
+		tailbufsize = 64 * 1024;
+	}
 	/* tail -c1024m REGULAR_FILE doesn't really need 1G mem block.
 	 * (In fact, it doesn't need ANY memory). So delay allocation.
 	 */
@@ -223,7 +452,6 @@ int tail_main(int argc, char **argv)
 		if (!G.from_top) {
 			off_t current = lseek(fd, 0, SEEK_END);
 			if (current > 0) {
-				unsigned off;
 				if (COUNT_BYTES) {
 				/* Optimizing count-bytes case if the file is seekable.
 				 * Beware of backing up too far.
@@ -237,19 +465,18 @@ int tail_main(int argc, char **argv)
 					bb_copyfd_size(fd, STDOUT_FILENO, count);
 					continue;
 				}
-#if 1 /* This is technically incorrect for *LONG* strings, but very useful */
-				/* Optimizing count-lines case if the file is seekable.
-				 * We assume the lines are <64k.
+				/* Optimizing count-lines case if the file is seekable:
+				 * scan it backwards for the start of the last lines.
 				 * (Users complain that tail takes too long
 				 * on multi-gigabyte files) */
-				off = (count | 0xf); /* for small counts, be more paranoid */
-				if (off > (INT_MAX / (64*1024)))
-					off = (INT_MAX / (64*1024));
-				current -= off * (64*1024);
-				if (current < 0)
-					current = 0;
-				xlseek(fd, current, SEEK_SET);
-#endif
+				if (!tailbuf)
+					tailbuf = xmalloc(tailbufsize);
+				current = tail_find_lines(fd, argv[i], current, count, tailbuf, tailbufsize);
+				if (current >= 0) {
+					xlseek(fd, current, SEEK_SET);
+					bb_copyfd_eof(fd, STDOUT_FILENO);
+				}
+				continue;
 			}
 		}
 
@@ -337,15 +564,46 @@ int tail_main(int argc, char **argv)
 
 	fmt = NULL;
 
+#if ENABLE_FEATURE_TAIL_INOTIFY
+	if (FOLLOW)
+		ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (ifd >= 0) {
+		/* Watches are set up after the first read: the first pass
+		 * of the loop below looks at all files, not to miss
+		 * the data written in between */
+		watches = xzalloc(sizeof(watches[0]) * nfiles);
+		for (i = 0; i < nfiles; i++) {
+			watches[i].dir_wd = -1;
+			if (FOLLOW_RETRY)
+				tail_watch_dir(ifd, &watches[i], argv[i]);
+			tail_watch_file(ifd, &watches[i], fds[i], argv[i], FOLLOW_RETRY);
+		}
+	}
+#endif
+
 	if (FOLLOW) while (1) {
+#if ENABLE_FEATURE_TAIL_INOTIFY
+		if (watches)
+			tail_wait(ifd, watches, nfiles, sleep_period);
+		else
+#endif
 		sleep(sleep_period);
 
 		i = 0;
 		do {
-			int nread;
 			const char *filename = argv[i];
 			int fd = fds[i];
 
+#if ENABLE_FEATURE_TAIL_INOTIFY
+			if (watches) {
+				if (!watches[i].changed)
+					continue;
+				watches[i].changed = 0;
+			}
+#endif
+			if (nfiles > header_threshhold) {
+				fmt = header_fmt_str;
+			}
 			if (FOLLOW_RETRY) {
 				struct stat sbuf, fsbuf;
 
@@ -357,8 +615,11 @@ int tail_main(int argc, char **argv)
 				) {
 					int new_fd;
 
-					if (fd >= 0)
+					if (fd >= 0) {
+						/* Print what was written before it was replaced */
+						tail_follow_read(fd, filename, &fmt, &prev_fd, tailbuf);
 						close(fd);
+					}
 					new_fd = open(filename, O_RDONLY);
 					if (new_fd >= 0) {
 						bb_error_msg("%s has %s; following end of new file",
@@ -368,39 +629,30 @@ int tail_main(int argc, char **argv)
 						bb_perror_msg("%s has become inaccessible", filename);
 					}
 					fds[i] = fd = new_fd;
+#if ENABLE_FEATURE_TAIL_INOTIFY
+					if (watches) {
+						/* The old watch is dropped when nobody uses it */
+						unsigned j;
+						for (j = 0; j < nfiles; j++)
+							if (j != i && watches[j].wd == watches[i].wd)
+								break;
+						if (watches[i].wd >= 0 && j == nfiles)
+							inotify_rm_watch(ifd, watches[i].wd);
+						tail_watch_file(ifd, &watches[i], fd, filename, 1);
+					}
+#endif
 				}
 			}
 			if (ENABLE_FEATURE_FANCY_TAIL && fd < 0)
 				continue;
-			if (nfiles > header_threshhold) {
-				fmt = header_fmt_str;
-			}
-			for (;;) {
-				/* tail -f keeps following files even if they are truncated */
-				struct stat sbuf;
-				/* /proc files report zero st_size, don't lseek them */
-				if (fstat(fd, &sbuf) == 0 && sbuf.st_size > 0) {
-					off_t current = lseek(fd, 0, SEEK_CUR);
-					if (sbuf.st_size < current)
-						xlseek(fd, 0, SEEK_SET);
-				}
-
-				nread = tail_read(fd, tailbuf, BUFSIZ);
-				if (nread <= 0)
-					break;
-				if (fmt && (fd != prev_fd)) {
-					tail_xprint_header(fmt, filename);
-					fmt = NULL;
-					prev_fd = fd;
-				}
-				xwrite(STDOUT_FILENO, tailbuf, nread);
-			}
+			tail_follow_read(fd, filename, &fmt, &prev_fd, tailbuf);
 		} while (++i < nfiles);
 	} /* while (1) */
 
 	if (ENABLE_FEATURE_CLEAN_UP) {
 		free(fds);
 		free(tailbuf);
+		IF_FEATURE_TAIL_INOTIFY(free(watches);)
 	}
 	return G.exitcode;
 }
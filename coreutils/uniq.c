@@ -45,8 +45,10 @@ int uniq_main(int argc UNUSED_PARAM, char **argv)
 	const char *input_filename;
 	unsigned skip_fields, skip_chars, max_chars;
 	unsigned opt;
-	char *cur_line;
+	char *cur_line, *old_line;
 	const char *cur_compare;
+	size_t cur_len, old_size;
+	struct line_reader *lr;
 
 	enum {
 		OPT_c = 0x1,
@@ -85,20 +87,28 @@ int uniq_main(int argc UNUSED_PARAM, char **argv)
 		}
 	}
 
-	cur_compare = cur_line = NULL; /* prime the pump */
+	lr = line_reader_new(STDIN_FILENO, LR_STOP_AT_NUL);
+	cur_compare = cur_line = old_line = NULL; /* prime the pump */
+	old_size = 0;
 
 	do {
 		unsigned i;
 		unsigned long dups;
-		char *old_line;
-		const char *old_compare;
+		const char *old_compare = old_compare; /* for compiler */
 
-		old_line = cur_line;
-		old_compare = cur_compare;
+		if (cur_line) {
+			/* cur_line is in reader's buffer, reading overwrites it */
+			if (cur_len >= old_size) {
+				old_size = cur_len + 1;
+				old_line = xrealloc(old_line, old_size);
+			}
+			memcpy(old_line, cur_line, cur_len + 1);
+			old_compare = old_line + (cur_compare - cur_line);
+		}
 		dups = 0;
 
 		/* gnu uniq ignores newlines */
-		while ((cur_line = xmalloc_fgetline(stdin)) != NULL) {
+		while ((cur_line = line_reader_getline(lr, &cur_len)) != NULL) {
 			cur_compare = cur_line;
 			for (i = skip_fields; i; i--) {
 				cur_compare = skip_whitespace(cur_compare);
@@ -117,7 +127,6 @@ int uniq_main(int argc UNUSED_PARAM, char **argv)
 				break;
 			}
 
-			free(cur_line);
 			++dups;  /* testing for overflow seems excessive */
 		}
 
@@ -129,11 +138,17 @@ int uniq_main(int argc UNUSED_PARAM, char **argv)
 				}
 				puts(old_line);
 			}
-			free(old_line);
 		}
 	} while (cur_line);
 
-	die_if_ferror(stdin, input_filename);
+	if (lr->error) {
+		errno = lr->error;
+		bb_simple_perror_msg_and_die(input_filename ? input_filename : bb_msg_standard_input);
+	}
+	if (ENABLE_FEATURE_CLEAN_UP) {
+		free(old_line);
+		line_reader_free(lr);
+	}
 
 	fflush_stdout_and_exit(EXIT_SUCCESS);
 }
@@ -105,6 +105,214 @@ enum {
 	NUM_WCS     = 5,
 };
 
+#define WC_BUFSIZE (64 * 1024)
+
+/* Without -L, we only need to count newlines, word starts
+ * and bytes which aren't 2nd+ bytes of UTF-8 chars.
+ * Word chars are printable non-space ASCII chars, words are separated
+ * by ' ' and \t\n\v\f\r. Other bytes (controls, non-ASCII)
+ * neither start nor end words: same rules as in wc_main() loop.
+ */
+static COUNT_T count_words(const uint8_t *p, const uint8_t *end, unsigned *in_word)
+{
+	COUNT_T words = 0;
+	unsigned w = *in_word;
+
+	while (p < end) {
+		unsigned c = *p++;
+		if (c - 0x21 < 0x7f - 0x21) {
+			words += !w;
+			w = 1;
+		} else if (c == ' ' || c - 9 <= 4) {
+			w = 0;
+		}
+	}
+	*in_word = w;
+	return words;
+}
+
+static void count_scalar(const uint8_t *p, const uint8_t *end,
+		COUNT_T *counts, unsigned *in_word)
+{
+	COUNT_T lines = 0, chars = 0;
+	const uint8_t *start = p;
+
+	while (p < end) {
+		unsigned c = *p++;
+		lines += (c == '\n');
+		chars += ((c & 0xc0) != 0x80);
+	}
+	counts[WC_LINES] += lines;
+	counts[WC_UNICHARS] += chars;
+	counts[WC_WORDS] += count_words(start, end, in_word);
+}
+
+/* The same with SSE2 or AVX2. Bytes are classified by compares,
+ * newlines and chars are summed in per-byte counters every 255 blocks.
+ * Words are counted from bitmasks of word chars and separators.
+ */
+#define WC_SIMD 0
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) \
+ && (defined(__clang__) || __GNUC__ >= 5)
+# undef WC_SIMD
+# define WC_SIMD 1
+# include <cpuid.h>
+# include <immintrin.h>
+
+/* Count word starts in a block, given bitmasks of its word chars
+ * and separators. A word starts at a word char if the last byte
+ * before it which is either of these is a separator.
+ * Other bytes must be skipped: for each separator, find the next
+ * byte in either mask by rippling a carry through the skipped ones.
+ */
+static ALWAYS_INLINE uint32_t word_starts(uint32_t w, uint32_t s,
+		uint32_t all, unsigned *in_word)
+{
+	uint32_t k = w | s;
+	uint32_t skip = all & ~k;
+	uint32_t g = (s << 1) | (*in_word ^ 1);  /* a word may start here */
+	uint32_t f = (g & k) | ((skip + (g & skip)) & k);
+
+	if (k)
+		*in_word = (w > s); /* is the highest bit of k in w? */
+	return w & f;
+}
+
+static ALWAYS_INLINE unsigned popcount16(uint32_t x)
+{
+	x = x - ((x >> 1) & 0x5555);
+	x = (x & 0x3333) + ((x >> 2) & 0x3333);
+	x = (x + (x >> 4)) & 0x0f0f;
+	return (x + (x >> 8)) & 0x1f;
+}
+
+/* Sum of bytes of v */
+static ALWAYS_INLINE unsigned __attribute__((target("sse2")))
+hsum_sse2(__m128i v)
+{
+	__m128i sad = _mm_sad_epu8(v, _mm_setzero_si128());
+	return _mm_cvtsi128_si32(sad) + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+}
+
+static ALWAYS_INLINE unsigned __attribute__((target("avx2")))
+hsum_avx2(__m256i v)
+{
+	__m256i sad = _mm256_sad_epu8(v, _mm256_setzero_si256());
+	__m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sad),
+			_mm256_extracti128_si256(sad, 1));
+	return _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+}
+
+static const uint8_t* __attribute__((target("sse2")))
+count_sse2(const uint8_t *p, const uint8_t *end,
+		COUNT_T *counts, unsigned *in_word)
+{
+	const __m128i c_nl = _mm_set1_epi8('\n');
+	const __m128i c_cont = _mm_set1_epi8(-0x41); /* > this: not 0x80..0xbf */
+	const __m128i c_sp = _mm_set1_epi8(' ');
+	const __m128i c_del = _mm_set1_epi8(0x7f);
+	const __m128i c_bs = _mm_set1_epi8(8);
+	const __m128i c_so = _mm_set1_epi8(0x0e);
+	COUNT_T words = 0;
+
+	while (end - p >= 16) {
+		__m128i acc_nl = _mm_setzero_si128();
+		__m128i acc_ch = _mm_setzero_si128();
+		unsigned n = 255;
+		do {
+			__m128i v = _mm_loadu_si128((const __m128i *)p);
+			__m128i w = _mm_and_si128(_mm_cmpgt_epi8(v, c_sp), _mm_cmpgt_epi8(c_del, v));
+			__m128i s = _mm_or_si128(_mm_cmpeq_epi8(v, c_sp),
+					_mm_and_si128(_mm_cmpgt_epi8(v, c_bs), _mm_cmpgt_epi8(c_so, v)));
+
+			acc_nl = _mm_sub_epi8(acc_nl, _mm_cmpeq_epi8(v, c_nl));
+			acc_ch = _mm_sub_epi8(acc_ch, _mm_cmpgt_epi8(v, c_cont));
+			words += popcount16(word_starts(_mm_movemask_epi8(w),
+					_mm_movemask_epi8(s), 0xffff, in_word));
+			p += 16;
+		} while (--n != 0 && end - p >= 16);
+		counts[WC_LINES] += hsum_sse2(acc_nl);
+		counts[WC_UNICHARS] += hsum_sse2(acc_ch);
+	}
+	counts[WC_WORDS] += words;
+	return p;
+}
+
+static const uint8_t* __attribute__((target("avx2,popcnt")))
+count_avx2(const uint8_t *p, const uint8_t *end,
+		COUNT_T *counts, unsigned *in_word)
+{
+	const __m256i c_nl = _mm256_set1_epi8('\n');
+	const __m256i c_cont = _mm256_set1_epi8(-0x41);
+	const __m256i c_sp = _mm256_set1_epi8(' ');
+	const __m256i c_del = _mm256_set1_epi8(0x7f);
+	const __m256i c_bs = _mm256_set1_epi8(8);
+	const __m256i c_so = _mm256_set1_epi8(0x0e);
+	COUNT_T words = 0;
+
+	while (end - p >= 32) {
+		__m256i acc_nl = _mm256_setzero_si256();
+		__m256i acc_ch = _mm256_setzero_si256();
+		unsigned n = 255;
+		do {
+			__m256i v = _mm256_loadu_si256((const __m256i *)p);
+			__m256i w = _mm256_and_si256(_mm256_cmpgt_epi8(v, c_sp), _mm256_cmpgt_epi8(c_del, v));
+			__m256i s = _mm256_or_si256(_mm256_cmpeq_epi8(v, c_sp),
+					_mm256_and_si256(_mm256_cmpgt_epi8(v, c_bs), _mm256_cmpgt_epi8(c_so, v)));
+
+			acc_nl = _mm256_sub_epi8(acc_nl, _mm256_cmpeq_epi8(v, c_nl));
+			acc_ch = _mm256_sub_epi8(acc_ch, _mm256_cmpgt_epi8(v, c_cont));
+			words += __builtin_popcount(word_starts(_mm256_movemask_epi8(w),
+					_mm256_movemask_epi8(s), 0xffffffff, in_word));
+			p += 32;
+		} while (--n != 0 && end - p >= 32);
+		counts[WC_LINES] += hsum_avx2(acc_nl);
+		counts[WC_UNICHARS] += hsum_avx2(acc_ch);
+	}
+	counts[WC_WORDS] += words;
+	return p;
+}
+
+/* 2: AVX2, 1: SSE2, 0: neither, -1: not checked yet */
+static signed char simd_level = -1;
+
+static int get_simd_level(void)
+{
+	if (simd_level < 0) {
+		unsigned eax, ebx, ecx, edx;
+
+		simd_level = 0;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2)) {
+			simd_level = 1;
+			/* AVX2 needs OS support for saving ymm registers */
+			if ((ecx & bit_OSXSAVE) && (ecx & bit_POPCNT)
+			 && __get_cpuid_max(0, NULL) >= 7
+			) {
+				unsigned xcr0;
+				__asm__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+				__cpuid_count(7, 0, eax, ebx, ecx, edx);
+				if ((xcr0 & 6) == 6 && (ebx & bit_AVX2))
+					simd_level = 2;
+			}
+		}
+	}
+	return simd_level;
+}
+#endif
+
+static void count_block(const uint8_t *p, const uint8_t *end,
+		COUNT_T *counts, unsigned *in_word)
+{
+#if WC_SIMD
+	int level = get_simd_level();
+	if (level == 2)
+		p = count_avx2(p, end, counts, in_word);
+	else if (level == 1)
+		p = count_sse2(p, end, counts, in_word);
+#endif
+	count_scalar(p, end, counts, in_word);
+}
+
 int wc_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int wc_main(int argc UNUSED_PARAM, char **argv)
 {
@@ -114,6 +322,7 @@ int wc_main(int argc UNUSED_PARAM, char **argv)
 	COUNT_T *pcounts;
 	COUNT_T counts[NUM_WCS];
 	COUNT_T totals[NUM_WCS];
+	uint8_t *buf;
 	int num_files;
 	smallint status = EXIT_SUCCESS;
 	unsigned print_type;
@@ -139,18 +348,20 @@ int wc_main(int argc UNUSED_PARAM, char **argv)
 	memset(totals, 0, sizeof(totals));
 
 	pcounts = counts;
+	buf = xmalloc(WC_BUFSIZE);
 
 	num_files = 0;
 	while ((arg = *argv++) != NULL) {
-		FILE *fp;
+		int fd;
 		const char *s;
 		unsigned u;
 		unsigned linepos;
-		smallint in_word;
+		unsigned in_word;
+		ssize_t pos, len;
 
 		++num_files;
-		fp = fopen_or_warn_stdin(arg);
-		if (!fp) {
+		fd = open_or_warn_stdin(arg);
+		if (fd < 0) {
 			status = EXIT_FAILURE;
 			continue;
 		}
@@ -159,18 +370,40 @@ int wc_main(int argc UNUSED_PARAM, char **argv)
 		linepos = 0;
 		in_word = 0;
 
+		if (!(print_type & (1 << WC_LENGTH))) {
+			while ((len = safe_read(fd, buf, WC_BUFSIZE)) > 0) {
+				counts[WC_BYTES] += len;
+				/* Only -c? Don't even look at the data */
+				if (print_type & ((1 << WC_LINES) | (1 << WC_WORDS) | (1 << WC_UNICHARS)))
+					count_block(buf, buf + len, counts, &in_word);
+			}
+			if (len < 0) {
+				bb_simple_perror_msg(arg);
+				status = EXIT_FAILURE;
+			}
+			if (unicode_status != UNICODE_ON)
+				counts[WC_UNICHARS] = counts[WC_BYTES];
+			goto DONE;
+		}
+
+		pos = len = 0;
 		while (1) {
 			int c;
 			/* Our -w doesn't match GNU wc exactly... oh well */
 
-			c = getc(fp);
-			if (c == EOF) {
-				if (ferror(fp)) {
-					bb_simple_perror_msg(arg);
-					status = EXIT_FAILURE;
+			if (pos == len) {
+				len = safe_read(fd, buf, WC_BUFSIZE);
+				if (len <= 0) {
+					if (len < 0) {
+						bb_simple_perror_msg(arg);
+						status = EXIT_FAILURE;
+					}
+					c = EOF;
+					goto DO_EOF;  /* Treat an EOF as '\r'. */
 				}
-				goto DO_EOF;  /* Treat an EOF as '\r'. */
+				pos = 0;
 			}
+			c = buf[pos++];
 
 			/* Cater for -c and -m */
 			++counts[WC_BYTES];
@@ -218,7 +451,9 @@ int wc_main(int argc UNUSED_PARAM, char **argv)
 			}
 		}
 
-		fclose_if_not_stdin(fp);
+ DONE:
+		if (fd != STDIN_FILENO)
+			close(fd);
 
 		if (totals[WC_LENGTH] < counts[WC_LENGTH]) {
 			totals[WC_LENGTH] = counts[WC_LENGTH];
@@ -146,7 +146,7 @@ struct globals {
 	/* list of input files */
 	int current_input_file, last_input_file;
 	char **input_file_list;
-	FILE *current_fp;
+	struct line_reader *current_lr;
 
 	regmatch_t regmatch[10];
 	regex_t *previous_regex_ptr;
@@ -210,8 +210,10 @@ static void sed_free_and_close_stuff(void)
 
 	free(G.hold_space);
 
-	if (G.current_fp)
-		fclose(G.current_fp);
+	if (G.current_lr) {
+		close(G.current_lr->fd);
+		line_reader_free(G.current_lr);
+	}
 }
 #else
 void sed_free_and_close_stuff(void);
@@ -1008,41 +1010,30 @@ static char *get_next_line(char *gets_char, char *last_puts_char)
 	 * doesn't end with either '\n' or '\0' */
 	gc = NO_EOL_CHAR;
 	for (; G.current_input_file <= G.last_input_file; G.current_input_file++) {
-		FILE *fp = G.current_fp;
-		if (!fp) {
+		struct line_reader *lr = G.current_lr;
+		if (!lr) {
 			const char *path = G.input_file_list[G.current_input_file];
-			fp = stdin;
+			int fd = STDIN_FILENO;
 			if (path != bb_msg_standard_input) {
-				fp = fopen_or_warn(path, "r");
-				if (!fp) {
+				fd = open_or_warn(path, O_RDONLY);
+				if (fd < 0) {
 					G.exitcode = EXIT_FAILURE;
 					continue;
 				}
 			}
-			G.current_fp = fp;
+			lr = G.current_lr = line_reader_new(fd, LR_STOP_AT_NUL
+					IF_PLATFORM_MINGW32(| (G.keep_cr ? LR_KEEP_CR : 0)));
 		}
-		/* Read line up to a newline or NUL byte, inclusive,
-		 * return malloc'ed char[]. length of the chunk read
-		 * is stored in len. NULL if EOF/error */
-		temp = bb_get_chunk_from_file(fp, &len);
+		/* Read line up to a newline or NUL byte, chop it off.
+		 * NULL if EOF/error */
+		temp = line_reader_getline(lr, &len);
 		if (temp) {
-			/* len > 0 here, it's ok to do temp[len-1] */
-			char c = temp[len-1];
-			if (c == '\n' || c == '\0') {
-				temp[len-1] = '\0';
-#if ENABLE_PLATFORM_MINGW32
-				if (!G.keep_cr && c == '\n' && len > 1 && temp[len-2] == '\r') {
-					temp[len-2] = '\0';
-				}
-#endif
-				gc = c;
-				if (c == '\0') {
-					int ch = fgetc(fp);
-					if (ch != EOF)
-						ungetc(ch, fp);
-					else
-						gc = LAST_IS_NUL;
-				}
+			/* Pattern space is ours to modify and keep */
+			temp = xmemdup(temp, len + 1);
+			if (lr->eol != EOF) {
+				gc = lr->eol;
+				if (gc == '\0' && line_reader_eof(lr))
+					gc = LAST_IS_NUL;
 			}
 			/* else we put NO_EOL_CHAR into *gets_char */
 			break;
@@ -1056,8 +1047,10 @@ static char *get_next_line(char *gets_char, char *last_puts_char)
 		 * (note: *no* newline after "b bang"!) */
 		}
 		/* Close this file and advance to next one */
-		fclose_if_not_stdin(fp);
-		G.current_fp = NULL;
+		if (lr->fd != STDIN_FILENO)
+			close(lr->fd);
+		line_reader_free(lr);
+		G.current_lr = NULL;
 	}
 	*gets_char = gc;
 	return temp;
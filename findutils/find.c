@@ -447,7 +447,7 @@ struct globals {
 	IF_FEATURE_FIND_MAXDEPTH(G.minmaxdepth[1] = INT_MAX;) \
 	IF_FEATURE_FIND_EXEC_PLUS(G.max_argv_len = bb_arg_max() - 2048;) \
 	G.need_print = 1; \
-	G.recurse_flags = ACTION_RECURSE; \
+	G.recurse_flags = ACTION_RECURSE | ACTION_DIRFD; \
 } while (0)
 
 /* Return values of ACTFs ('action functions') are a bit mask:
@@ -282,38 +282,15 @@ static void print_line(const char *line, size_t line_len, int linenum, char deco
 	}
 }
 
-#if ENABLE_EXTRA_COMPAT
-/* Unlike getline, this one removes trailing '\n' */
-static ssize_t FAST_FUNC bb_getline(char **line_ptr, size_t *line_alloc_len, FILE *file)
-{
-	ssize_t res_sz;
-	char *line;
-	int delim = (NUL_DELIMITED ? '\0' : '\n');
-
-	res_sz = getdelim(line_ptr, line_alloc_len, delim, file);
-	line = *line_ptr;
-
-	if (res_sz > 0) {
-		if (line[res_sz - 1] == delim)
-			line[--res_sz] = '\0';
-	} else {
-		free(line); /* uclibc allocates a buffer even on EOF. WTF? */
-	}
-	return res_sz;
-}
-#endif
-
-static int grep_file(FILE *file)
+static int grep_file(int fd)
 {
 	smalluint found;
 	int linenum = 0;
 	int nmatches = 0;
-#if !ENABLE_EXTRA_COMPAT
 	char *line;
-#else
-	char *line = NULL;
-	ssize_t line_len;
-	size_t line_alloc_len;
+	size_t line_len;
+	struct line_reader *lr;
+#if ENABLE_EXTRA_COMPAT
 # define rm_so start[0]
 # define rm_eo end[0]
 #endif
@@ -325,13 +302,10 @@ static int grep_file(FILE *file)
 	enum { print_n_lines_after = 0 };
 #endif
 
-	while (
-#if !ENABLE_EXTRA_COMPAT
-		(line = xmalloc_fgetline(file)) != NULL
-#else
-		(line_len = bb_getline(&line, &line_alloc_len, file)) >= 0
-#endif
-	) {
+	/* Without EXTRA_COMPAT, NUL byte ends the line (strings can't hold it) */
+	lr = line_reader_new(fd, !ENABLE_EXTRA_COMPAT ? LR_STOP_AT_NUL
+			: NUL_DELIMITED ? LR_NUL_DELIMITED : 0);
+	while ((line = line_reader_getline(lr, &line_len)) != NULL) {
 		llist_t *pattern_ptr = pattern_head;
 		grep_list_data_t *gl = gl; /* for gcc */
 
@@ -468,7 +442,7 @@ static int grep_file(FILE *file)
 
 			/* quiet/print (non)matching file names only? */
 			if (option_mask32 & (OPT_q|OPT_l|OPT_L)) {
-				free(line); /* we don't need line anymore */
+				line_reader_free(lr);
 				if (BE_QUIET) {
 					/* manpage says about -q:
 					 * "exit immediately with zero status
@@ -571,18 +545,14 @@ static int grep_file(FILE *file)
 			} else if (lines_before) {
 				/* Add the line to the circular 'before' buffer */
 				free(before_buf[curpos]);
-				before_buf[curpos] = line;
+				/* line is in reader's buffer, must copy it */
+				before_buf[curpos] = xmemdup(line, line_len + 1);
 				IF_EXTRA_COMPAT(before_buf_size[curpos] = line_len;)
 				curpos = (curpos + 1) % lines_before;
-				/* avoid free(line) - we took the line */
-				line = NULL;
 			}
 		}
 
 #endif /* ENABLE_FEATURE_GREP_CONTEXT */
-#if !ENABLE_EXTRA_COMPAT
-		free(line);
-#endif
 		/* Did we print all context after last requested match? */
 		if ((option_mask32 & OPT_m)
 		 && !print_n_lines_after
@@ -591,6 +561,7 @@ static int grep_file(FILE *file)
 			break;
 		}
 	} /* while (read line) */
+	line_reader_free(lr);
 
 	/* special-case file post-processing for options where we don't print line
 	 * matches, just filenames and possibly match counts */
@@ -655,7 +626,7 @@ static int FAST_FUNC file_action_grep(const char *filename,
 			void* matched,
 			int depth UNUSED_PARAM)
 {
-	FILE *file;
+	int fd;
 
 	/* If we are given a link to a directory, we should bail out now, rather
 	 * than trying to open the "file" and hoping getline gives us nothing,
@@ -672,16 +643,16 @@ static int FAST_FUNC file_action_grep(const char *filename,
 			return 1;
 	}
 
-	file = fopen_for_read(filename);
-	if (file == NULL) {
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
 		if (!SUPPRESS_ERR_MSGS)
 			bb_simple_perror_msg(filename);
 		open_errors = 1;
 		return 0;
 	}
 	cur_file = filename;
-	*(int*)matched += grep_file(file);
-	fclose(file);
+	*(int*)matched += grep_file(fd);
+	close(fd);
 	return 1;
 }
 
@@ -692,7 +663,8 @@ static int grep_dir(const char *dir)
 		/* recurse=yes */ ACTION_RECURSE |
 		/* followLinks=always */ ((option_mask32 & OPT_R) ? ACTION_FOLLOWLINKS : 0) |
 		/* followLinks=command line only */ ACTION_FOLLOWLINKS_L0 |
-		/* depthFirst=yes */ ACTION_DEPTHFIRST,
+		/* depthFirst=yes */ ACTION_DEPTHFIRST |
+		/* file_action_grep needs only file type */ ACTION_DIRFD | ACTION_TYPE_ONLY,
 		/* fileAction= */ file_action_grep,
 		/* dirAction= */ NULL,
 		/* userData= */ &matched,
@@ -703,7 +675,7 @@ static int grep_dir(const char *dir)
 int grep_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int grep_main(int argc UNUSED_PARAM, char **argv)
 {
-	FILE *file;
+	int fd;
 	int matched;
 	llist_t *fopt = NULL;
 #if ENABLE_FEATURE_GREP_CONTEXT
@@ -827,7 +799,7 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 	matched = 0;
 	do {
 		cur_file = *argv;
-		file = stdin;
+		fd = STDIN_FILENO;
 		if (!cur_file || LONE_DASH(cur_file)) {
 			cur_file = "(standard input)";
 		} else {
@@ -841,16 +813,17 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 				}
 			}
 			/* else: fopen(dir) will succeed, but reading won't */
-			file = fopen_for_read(cur_file);
-			if (file == NULL) {
+			fd = open(cur_file, O_RDONLY);
+			if (fd < 0) {
 				if (!SUPPRESS_ERR_MSGS)
 					bb_simple_perror_msg(cur_file);
 				open_errors = 1;
 				continue;
 			}
 		}
-		matched += grep_file(file);
-		fclose_if_not_stdin(file);
+		matched += grep_file(fd);
+		if (fd != STDIN_FILENO)
+			close(fd);
  grep_done: ;
 	} while (*argv && *++argv);
 
@@ -253,6 +253,13 @@ typedef struct transformer_state_t {
 	uint32_t crc32;
 	time_t   mtime;     /* gunzip code may set this on exit */
 
+#if ENABLE_FEATURE_GZIP_INDEX
+	/* unpack_gz_stream: add checkpoints to gz_index which is being built,
+	 * or start at its checkpoint gz_index->start */
+	struct gz_index_t *gz_index;
+	off_t    gz_skip;   /* do not output this many first bytes */
+#endif
+
 	union {             /* if we read magic, it's saved here */
 		uint8_t b[8];
 		uint16_t b16[4];
@@ -272,6 +279,32 @@ IF_DESKTOP(long long) int unpack_bz2_stream(transformer_state_t *xstate) FAST_FU
 IF_DESKTOP(long long) int unpack_lzma_stream(transformer_state_t *xstate) FAST_FUNC;
 IF_DESKTOP(long long) int unpack_xz_stream(transformer_state_t *xstate) FAST_FUNC;
 
+#if ENABLE_FEATURE_GZIP_INDEX
+/* Random access to .gz files: inflate checkpoints, each with
+ * the 32k window of uncompressed data preceding it */
+typedef struct gz_point_t {
+	uint64_t in_bits;   /* position in .gz file, in bits */
+	uint64_t out;       /* position in uncompressed data */
+} gz_point_t;
+typedef struct gz_index_t {
+	int fd;
+	unsigned count;
+	gz_point_t *point;
+	uint64_t span;      /* building: distance between checkpoints */
+	uint64_t gz_size;   /* size of .gz file */
+	smallint building;
+	int start;          /* reading: checkpoint to start at, -1: none */
+	pid_t pid;          /* reading: decompressing child */
+} gz_index_t;
+enum { GZ_INDEX_WSIZE = 32 * 1024 };
+gz_index_t *gz_index_create(const char *name, uint64_t span) FAST_FUNC;
+void gz_index_add(gz_index_t *idx, uint64_t in_bits, uint64_t out, const uint8_t *window, unsigned pos) FAST_FUNC;
+void gz_index_finish(gz_index_t *idx, int gz_fd) FAST_FUNC;
+gz_index_t *gz_index_open(const char *name) FAST_FUNC;
+void gz_index_read_window(gz_index_t *idx, unsigned i, uint8_t *window) FAST_FUNC;
+int gz_index_reader(gz_index_t *idx, int gz_fd, int fd, uint64_t cur, uint64_t target) FAST_FUNC;
+#endif
+
 char* append_ext(char *filename, const char *expected_ext) FAST_FUNC;
 int bbunpack(char **argv,
 		IF_DESKTOP(long long) int FAST_FUNC (*unpacker)(transformer_state_t *xstate),
@@ -356,9 +356,9 @@ struct BUG_off_t_size_is_misdetected {
 #endif
 #endif
 
-#if defined(__GLIBC__)
+#if defined(__GLIBC__) && !ENABLE_FEATURE_USE_THREADS
 /* glibc uses __errno_location() to get a ptr to errno */
-/* We can just memorize it once - no multithreading in busybox :) */
+/* We can just memorize it once - if there is no multithreading */
 extern int *const bb_errno;
 #undef errno
 #define errno (*bb_errno)
@@ -431,6 +431,7 @@ enum {	/* cp.c, mv.c, install.c depend on these values. CAREFUL when changing th
 	/* bit 17 skipped for "cp --parents" */
 	FILEUTILS_REFLINK         = 1 << (18 - !ENABLE_SELINUX), /* cp --reflink=auto */
 	FILEUTILS_REFLINK_ALWAYS  = 1 << (19 - !ENABLE_SELINUX), /* cp --reflink[=always] */
+	FILEUTILS_REFLINK_NEVER   = 1 << (20 - !ENABLE_SELINUX), /* cp --reflink=never */
 	/*
 	 * Hole. cp may have some bits set here,
 	 * they should not affect remove_file()/copy_file()
@@ -442,11 +443,19 @@ enum {	/* cp.c, mv.c, install.c depend on these values. CAREFUL when changing th
 };
 #define FILEUTILS_CP_OPTSTR "pdRfilsLHarPvuT" IF_SELINUX("c")
 extern int remove_file(const char *path, int flags) FAST_FUNC;
+/* Let remove_file() remove subdirectories in nthreads worker threads
+ * (unless it may need to prompt). 0: back to serial */
+void remove_file_jobs(unsigned nthreads) FAST_FUNC;
 /* NB: without FILEUTILS_RECUR in flags, it will basically "cat"
  * the source, not copy (unless "source" is a directory).
  * This makes "cp /dev/null file" and "install /dev/null file" (!!!)
  * work coreutils-compatibly. */
 extern int copy_file(const char *source, const char *dest, int flags) FAST_FUNC;
+/* Let copy_file() copy regular files in nthreads worker threads.
+ * copy_file_finish() waits for them and sets attributes of copied
+ * directories, returns -1 if any of the queued copies failed */
+void copy_file_jobs(unsigned nthreads) FAST_FUNC;
+int copy_file_finish(void) FAST_FUNC;
 
 enum {
 	ACTION_RECURSE        = (1 << 0),
@@ -456,8 +465,10 @@ enum {
 	/*ACTION_REVERSE      = (1 << 4), - unused */
 	ACTION_QUIET          = (1 << 5),
 	ACTION_DANGLING_OK    = (1 << 6),
+	ACTION_DIRFD          = (1 << 7), /* use openat/fstatat */
+	ACTION_TYPE_ONLY      = (1 << 8), /* callbacks need only S_IFMT of st_mode */
 };
-typedef uint8_t recurse_flags_t;
+typedef uint16_t recurse_flags_t;
 extern int recursive_action(const char *fileName, unsigned flags,
 	int FAST_FUNC (*fileAction)(const char *fileName, struct stat* statbuf, void* userData, int depth),
 	int FAST_FUNC (*dirAction)(const char *fileName, struct stat* statbuf, void* userData, int depth),
@@ -472,6 +483,9 @@ extern char *find_block_device(const char *path) FAST_FUNC;
 extern off_t bb_copyfd_eof(int fd1, int fd2) FAST_FUNC;
 extern off_t bb_copyfd_size(int fd1, int fd2, off_t size) FAST_FUNC;
 extern void bb_copyfd_exact_size(int fd1, int fd2, off_t size) FAST_FUNC;
+/* Without copy_file_range (it may share blocks on CoW filesystems).
+ * size = 0: till EOF */
+extern off_t bb_copyfd_noclone(int fd1, int fd2, off_t size) FAST_FUNC;
 /* "short" copy can be detected by return value < size */
 /* this helper yells "short read!" if param is not -1 */
 extern void complain_copyfd_and_die(off_t sz) NORETURN FAST_FUNC;
@@ -995,6 +1009,32 @@ extern char *xmalloc_fgetline(FILE *file) FAST_FUNC RETURNS_MALLOC;
 /* Same, but doesn't try to conserve space (may have some slack after the end) */
 /* extern char *xmalloc_fgetline_fast(FILE *file) FAST_FUNC RETURNS_MALLOC; */
 
+/* Block-buffered line reader for fd. Lines are returned in place,
+ * without the delimiter and NUL-terminated; they stay valid
+ * (and writable) until the next line_reader_getline().
+ * No malloc per line, useful for "grep 50gigabyte_file".
+ */
+struct line_reader {
+	char *buf;
+	size_t pos, end, size;
+	int fd;
+	int error;   /* errno of a failed read, treated as EOF */
+	int eol;     /* char which ended the last line, or EOF */
+	smallint eof;
+	unsigned flags;
+};
+enum {
+	LR_NUL_DELIMITED = 1 << 0, /* lines end with NUL, not '\n' */
+	LR_STOP_AT_NUL   = 1 << 1, /* NUL ends a line too (as in xmalloc_fgets) */
+	LR_KEEP_CR       = 1 << 2, /* WIN32: do not strip '\r' before '\n' */
+};
+struct line_reader *line_reader_new(int fd, unsigned flags) FAST_FUNC;
+/* Returns NULL on EOF. If lenp != NULL, stores line length in it */
+char *line_reader_getline(struct line_reader *lr, size_t *lenp) FAST_FUNC;
+/* Is there no more data? (may read more data to find out) */
+int line_reader_eof(struct line_reader *lr) FAST_FUNC;
+void line_reader_free(struct line_reader *lr) FAST_FUNC;
+
 void die_if_ferror(FILE *file, const char *msg) FAST_FUNC;
 void die_if_ferror_stdout(void) FAST_FUNC;
 int fflush_all(void) FAST_FUNC;
@@ -1015,6 +1055,16 @@ FILE* xfdopen_for_write(int fd) FAST_FUNC;
 
 int bb_pstrcmp(const void *a, const void *b) /* not FAST_FUNC! */;
 void qsort_string_vector(char **sv, unsigned count) FAST_FUNC;
+/* Sort items by string keys in strcmp() order (multikey quicksort).
+ * key_ofs < 0: items are the keys (char*), else item has char* key
+ * at offset key_ofs. If tie_cmp != NULL, runs of items with equal keys
+ * are then qsort'ed with it (it gets pointers to items, as in qsort).
+ */
+enum { SORT_KEY_REVERSE = 1 };
+void sort_by_string_key(void **vec, size_t count, int key_ofs,
+		unsigned flags, int (*tie_cmp)(const void *, const void *)) FAST_FUNC;
+/* Is strcoll() the same as strcmp() in current locale? */
+int collation_is_bytewise(void) FAST_FUNC;
 
 /* Wrapper which restarts poll on EINTR or ENOMEM.
  * On other errors complains [perror("poll")] and returns.
@@ -1224,6 +1274,24 @@ void set_task_comm(const char *comm) FAST_FUNC;
 # define set_task_comm(name) ((void)0)
 #endif
 
+/* Worker threads for parallel modes of applets (-j N and such).
+ * Tasks are caller-owned (usually embedded into per-item structs),
+ * bb_pool_wait(pool, task) waits for one task, with NULL - for all.
+ * A pool of 0 threads, or any pool if built without
+ * FEATURE_USE_THREADS, runs tasks synchronously in bb_pool_submit().
+ * Tasks must not touch applet globals unless they are read-only.
+ */
+typedef struct bb_task {
+	void FAST_FUNC (*run)(struct bb_task *task);
+	struct bb_task *next;
+	smallint done;
+} bb_task;
+typedef struct bb_pool bb_pool;
+bb_pool *bb_pool_new(unsigned nthreads) FAST_FUNC;
+void bb_pool_submit(bb_pool *pool, bb_task *task) FAST_FUNC;
+void bb_pool_wait(bb_pool *pool, bb_task *task) FAST_FUNC;
+void bb_pool_free(bb_pool *pool) FAST_FUNC;
+
 /* Helpers for daemonization.
  *
  * bb_daemonize(flags) = daemonize, does not compile on NOMMU
@@ -1776,6 +1844,14 @@ int bb_xioctl(int fd, unsigned request, void *argp) FAST_FUNC;
 char *is_in_ino_dev_hashtable(const struct stat *statbuf) FAST_FUNC;
 void add_to_ino_dev_hashtable(const struct stat *statbuf, const char *name) FAST_FUNC;
 void reset_ino_dev_hashtable(void) FAST_FUNC;
+/* Set of (dev,ino) -> value which threads can share (if "shared"):
+ * ino_dev_set_find() takes no locks. ino_dev_set_add() returns
+ * the value already there, or adds non-NULL value and returns NULL */
+typedef struct ino_dev_set ino_dev_set;
+ino_dev_set *ino_dev_set_new(int shared) FAST_FUNC;
+void *ino_dev_set_find(ino_dev_set *set, const struct stat *statbuf) FAST_FUNC;
+void *ino_dev_set_add(ino_dev_set *set, const struct stat *statbuf, void *value) FAST_FUNC;
+void ino_dev_set_free(ino_dev_set *set) FAST_FUNC;
 #else
 #define add_to_ino_dev_hashtable(s, n) (void)0
 #define is_in_ino_dev_hashtable(s) NULL
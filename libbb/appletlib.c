@@ -318,7 +318,7 @@ void lbb_prepare(const char *applet
 void lbb_prepare(const char *applet
 		IF_FEATURE_INDIVIDUAL(, char **argv))
 {
-#ifdef __GLIBC__
+#if defined(__GLIBC__) && !ENABLE_FEATURE_USE_THREADS
 	(*(int **)not_const_pp(&bb_errno)) = __errno_location();
 	barrier();
 #endif
@@ -15,7 +15,7 @@ int /* not FAST_FUNC! */ bb_pstrcmp(const void *a, const void *b)
 
 void FAST_FUNC qsort_string_vector(char **sv, unsigned count)
 {
-	qsort(sv, count, sizeof(char*), bb_pstrcmp);
+	sort_by_string_key((void **)sv, count, -1, 0, NULL);
 }
 
 #if ENABLE_PLATFORM_MINGW32
@@ -29,3 +29,164 @@ void FAST_FUNC qsort_string_vector_case(char **sv, unsigned count)
 	qsort(sv, count, sizeof(char*), bb_pstrcasecmp);
 }
 #endif
+
+/* Multikey quicksort (Bentley & Sedgewick) of items by string keys.
+ * Partitions on one char of the key at a time, three ways: <, =, >.
+ * Unlike qsort with strcmp, common prefixes of keys are not
+ * compared over and over again: on millions of lines it is
+ * several times faster.
+ */
+#define KEY(item) (key_ofs < 0 \
+	? (const unsigned char *)(item) \
+	: *(const unsigned char **)((char *)(item) + key_ofs))
+#define CHAR_AT(p) (KEY(*(p))[depth])
+
+static void **med3(void **a, void **b, void **c, size_t depth, int key_ofs)
+{
+	unsigned va = CHAR_AT(a);
+	unsigned vb = CHAR_AT(b);
+	unsigned vc = CHAR_AT(c);
+
+	if (va == vb)
+		return a;
+	if (vc == va || vc == vb)
+		return c;
+	if (va < vb)
+		return vb < vc ? b : (va < vc ? c : a);
+	return vb > vc ? b : (va < vc ? a : c);
+}
+
+static void vecswap(void **a, void **b, size_t n)
+{
+	while (n--) {
+		void *t = *a;
+		*a++ = *b;
+		*b++ = t;
+	}
+}
+
+static void mkqsort(void **a, size_t n, size_t depth, int key_ofs)
+{
+	while (n > 1) {
+		void **pa, **pb, **pc, **pd, **pm, **pn;
+		size_t lt, eq, gt, r;
+		int v, c;
+
+		if (n < 16) {
+			/* Insertion sort of the rest of keys */
+			for (pm = a + 1; pm < a + n; pm++) {
+				for (pb = pm; pb > a; pb--) {
+					void *t;
+					if (strcmp((char*)KEY(pb[-1]) + depth, (char*)KEY(pb[0]) + depth) <= 0)
+						break;
+					t = pb[-1];
+					pb[-1] = pb[0];
+					pb[0] = t;
+				}
+			}
+			return;
+		}
+
+		pa = a;
+		pm = a + n / 2;
+		pn = a + n - 1;
+		if (n > 64) {
+			/* Pseudo-median of 9 */
+			r = n / 8;
+			pa = med3(pa, pa + r, pa + 2*r, depth, key_ofs);
+			pm = med3(pm - r, pm, pm + r, depth, key_ofs);
+			pn = med3(pn - 2*r, pn - r, pn, depth, key_ofs);
+		}
+		pm = med3(pa, pm, pn, depth, key_ofs);
+		vecswap(a, pm, 1);
+		v = CHAR_AT(a);
+
+		/* a[0]==v [pa: ==v... pb: <v... ][pc: ...>v pd: ...==v] */
+		pa = pb = a + 1;
+		pc = pd = a + n - 1;
+		for (;;) {
+			while (pb <= pc && (c = CHAR_AT(pb) - v) <= 0) {
+				if (c == 0)
+					vecswap(pa++, pb, 1);
+				pb++;
+			}
+			while (pb <= pc && (c = CHAR_AT(pc) - v) >= 0) {
+				if (c == 0)
+					vecswap(pc, pd--, 1);
+				pc--;
+			}
+			if (pb > pc)
+				break;
+			vecswap(pb++, pc--, 1);
+		}
+		/* Move ==v parts to the middle */
+		pn = a + n;
+		r = MIN(pa - a, pb - pa);
+		vecswap(a, pb - r, r);
+		r = MIN(pd - pc, pn - pd - 1);
+		vecswap(pb, pn - r, r);
+
+		lt = pb - pa;
+		gt = pd - pc;
+		eq = n - lt - gt;
+		/* Recurse into two smaller parts, loop on the largest one:
+		 * this limits recursion depth to log2(n) */
+		if (eq >= lt && eq >= gt) {
+			mkqsort(a, lt, depth, key_ofs);
+			mkqsort(pn - gt, gt, depth, key_ofs);
+			if (v == '\0') /* keys are equal */
+				return;
+			a += lt;
+			n = eq;
+			depth++;
+		} else {
+			if (v != '\0')
+				mkqsort(a + lt, eq, depth + 1, key_ofs);
+			if (lt >= gt) {
+				mkqsort(pn - gt, gt, depth, key_ofs);
+				n = lt;
+			} else {
+				mkqsort(a, lt, depth, key_ofs);
+				a = pn - gt;
+				n = gt;
+			}
+		}
+	}
+}
+
+void FAST_FUNC sort_by_string_key(void **vec, size_t count, int key_ofs,
+		unsigned flags, int (*tie_cmp)(const void *, const void *))
+{
+	size_t i, j;
+
+	mkqsort(vec, count, 0, key_ofs);
+	if (flags & SORT_KEY_REVERSE) {
+		for (i = 0, j = count; i + 1 < j; i++, j--) {
+			void *t = vec[i];
+			vec[i] = vec[j - 1];
+			vec[j - 1] = t;
+		}
+	}
+	if (!tie_cmp)
+		return;
+	/* Order runs of equal keys with the full comparator */
+	for (i = 0; i < count; i = j) {
+		const char *key = (const char *)KEY(vec[i]);
+		for (j = i + 1; j < count; j++)
+			if (strcmp(key, (const char *)KEY(vec[j])) != 0)
+				break;
+		if (j - i > 1)
+			qsort(vec + i, j - i, sizeof(vec[0]), tie_cmp);
+	}
+}
+
+/* Is strcoll() the same as strcmp() in current locale? */
+int FAST_FUNC collation_is_bytewise(void)
+{
+#if ENABLE_LOCALE_SUPPORT
+	const char *l = setlocale(LC_COLLATE, NULL);
+	return !l || strcmp(l, "C") == 0 || strcmp(l, "POSIX") == 0;
+#else
+	return 1;
+#endif
+}
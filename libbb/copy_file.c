@@ -20,6 +20,67 @@
 // This is strange, but POSIX-correct.
 // coreutils cp has --remove-destination to override this...
 
+#if ENABLE_FEATURE_CP_REFLINK
+# ifndef FICLONE
+#  define FICLONE _IOW(0x94, 9, int)
+# endif
+#endif
+
+static off_t copy_data(int src_fd, int dst_fd, off_t size, int flags)
+{
+	if (flags & FILEUTILS_REFLINK_NEVER)
+		return bb_copyfd_noclone(src_fd, dst_fd, size);
+	return size ? bb_copyfd_size(src_fd, dst_fd, size) : bb_copyfd_eof(src_fd, dst_fd);
+}
+
+/* Copy a file with holes: only data extents are copied,
+ * holes are seeked over in the destination.
+ * Returns 1 if SEEK_DATA is not supported (nothing is done then).
+ */
+static int copy_sparse(int src_fd, int dst_fd, off_t size, int flags,
+		const char *source, const char *dest)
+{
+#ifdef SEEK_DATA
+	off_t pos = 0;
+
+	for (;;) {
+		off_t data, hole, copied;
+
+		data = lseek(src_fd, pos, SEEK_DATA);
+		if (data < 0) {
+			if (errno == ENXIO) /* only a hole is left */
+				break;
+			if (pos == 0)
+				return 1;
+			goto err_src;
+		}
+		hole = lseek(src_fd, data, SEEK_HOLE);
+		if (hole < 0 || lseek(src_fd, data, SEEK_SET) < 0)
+			goto err_src;
+		if (lseek(dst_fd, data, SEEK_SET) < 0)
+			goto err_dst;
+		copied = copy_data(src_fd, dst_fd, hole - data, flags);
+		if (copied != hole - data) {
+			/* If -1, bb_copyfd_XX complained. Else the file has shrunk */
+			if (copied >= 0)
+				bb_simple_error_msg("short read");
+			return -1;
+		}
+		pos = hole;
+	}
+	if (ftruncate(dst_fd, size) == 0)
+		return 0;
+ err_dst:
+	bb_perror_msg("error writing to '%s'", dest);
+	return -1;
+ err_src:
+	bb_perror_msg("can't seek in '%s'", source);
+	return -1;
+#else
+	return 1;
+#endif
+}
+
 /* Called if open of destination, link creation etc fails.
  * errno must be set to relevant value ("why we cannot create dest?")
  * to give reasonable error message */
@@ -72,6 +133,282 @@ static int ask_and_unlink(const char *dest, int flags)
 	return 1; /* ok (to try again) */
 }
 
+static void preserve_status(const char *dest, int flags, struct stat *source_stat)
+{
+	if (flags & FILEUTILS_PRESERVE_STATUS
+	/* Cannot happen: */
+	/* && !(flags & (FILEUTILS_MAKE_SOFTLINK|FILEUTILS_MAKE_HARDLINK)) */
+	) {
+		struct timeval times[2];
+
+		times[1].tv_sec = times[0].tv_sec = source_stat->st_mtime;
+		times[1].tv_usec = times[0].tv_usec = 0;
+		/* BTW, utimes sets usec-precision time - just FYI */
+		if (utimes(dest, times) < 0)
+			bb_perror_msg("can't preserve %s of '%s'", "times", dest);
+		if (chown(dest, source_stat->st_uid, source_stat->st_gid) < 0) {
+			source_stat->st_mode &= ~(S_ISUID | S_ISGID);
+			bb_perror_msg("can't preserve %s of '%s'", "ownership", dest);
+		}
+		if (chmod(dest, source_stat->st_mode) < 0)
+			bb_perror_msg("can't preserve %s of '%s'", "permissions", dest);
+	}
+}
+
+/* Copy data of a regular file (or, without -R, of anything which
+ * can be read) to a new file. May run in a worker thread with -j */
+static int copy_regular(const char *source, const char *dest, int flags,
+		struct stat *source_stat)
+{
+	int src_fd;
+	int dst_fd;
+	mode_t new_mode;
+	smallint retval = 0;
+	smallint ovr;
+
+	src_fd = open_or_warn(source, O_RDONLY);
+	if (src_fd < 0)
+		return -1;
+
+	/* Do not try to open with weird mode fields */
+	new_mode = source_stat->st_mode;
+	if (!S_ISREG(source_stat->st_mode))
+		new_mode = 0666;
+
+	if (ENABLE_FEATURE_NON_POSIX_CP || (flags & FILEUTILS_INTERACTIVE)) {
+		/*
+		 * O_CREAT|O_EXCL: require that file did not exist before creation
+		 */
+		dst_fd = open(dest, O_WRONLY|O_CREAT|O_EXCL, new_mode);
+	} else { /* POSIX, and not "cp -i" */
+		/*
+		 * O_CREAT|O_TRUNC: create, or truncate (security problem versus (sym)link attacks)
+		 */
+		dst_fd = open(dest, O_WRONLY|O_CREAT|O_TRUNC, new_mode);
+	}
+	if (dst_fd == -1) {
+		ovr = ask_and_unlink(dest, flags);
+		if (ovr <= 0) {
+			close(src_fd);
+			return ovr;
+		}
+		/* It shouldn't exist. If it exists, do not open (symlink attack?) */
+		dst_fd = open3_or_warn(dest, O_WRONLY|O_CREAT|O_EXCL, new_mode);
+		if (dst_fd < 0) {
+			close(src_fd);
+			return -1;
+		}
+	}
+
+#if ENABLE_SELINUX
+	if ((flags & (FILEUTILS_PRESERVE_SECURITY_CONTEXT|FILEUTILS_SET_SECURITY_CONTEXT))
+	 && is_selinux_enabled() > 0
+	) {
+		security_context_t con;
+		if (getfscreatecon(&con) == -1) {
+			bb_simple_perror_msg("getfscreatecon");
+			return -1;
+		}
+		if (con) {
+			if (setfilecon(dest, con) == -1) {
+				bb_perror_msg("setfilecon:%s,%s", dest, con);
+				freecon(con);
+				return -1;
+			}
+			freecon(con);
+		}
+	}
+#endif
+#if ENABLE_FEATURE_CP_REFLINK
+	/* Share data blocks (on CoW filesystems) unless told not to */
+	if (!(flags & FILEUTILS_REFLINK_NEVER)) {
+		if (ioctl(dst_fd, FICLONE, src_fd) == 0)
+			goto do_close;
+		/* reflink did not work */
+		if (flags & FILEUTILS_REFLINK_ALWAYS) {
+			bb_perror_msg("failed to clone '%s' from '%s'", dest, source);
+			retval = -1;
+			goto do_close;
+		}
+		/* fall through to standard copy */
+	}
+#endif
+	{
+		struct stat dst_stat;
+		int r = 1;
+
+		/* Fewer allocated blocks than size: there are holes */
+		if (S_ISREG(source_stat->st_mode)
+		 && (off_t)source_stat->st_blocks * 512 < source_stat->st_size
+		 && fstat(dst_fd, &dst_stat) == 0 && S_ISREG(dst_stat.st_mode)
+		) {
+			r = copy_sparse(src_fd, dst_fd, source_stat->st_size, flags,
+					source, dest);
+		}
+		if (r > 0)
+			r = (copy_data(src_fd, dst_fd, 0, flags) == -1);
+		if (r != 0)
+			retval = -1;
+	}
+ IF_FEATURE_CP_REFLINK(do_close:)
+	/* Careful with writing... */
+	if (close(dst_fd) < 0) {
+		bb_perror_msg("error writing to '%s'", dest);
+		retval = -1;
+	}
+	/* ...but read size is already checked by bb_copyfd_eof */
+	close(src_fd);
+	/* "cp /dev/something new_file" should not
+	 * copy mode of /dev/something */
+	if (!S_ISREG(source_stat->st_mode))
+		return retval;
+	preserve_status(dest, flags, source_stat);
+	if (flags & FILEUTILS_VERBOSE)
+		printf("'%s' -> '%s'\n", source, dest);
+	return retval;
+}
+
+/* cp -j N: copy_file() queues regular files to be copied
+ * by worker threads. Attributes of directories it creates
+ * are set in copy_file_finish(), after their contents are done.
+ */
+struct copy_job {
+	bb_task task;
+	struct copy_job *next;
+	char *source, *dest;
+	int flags;
+	int retval;
+	struct stat st;
+};
+
+struct copy_dir {
+	struct copy_dir *next;
+	char *source, *dest;
+	int flags;
+	mode_t mode; /* to chmod to, or (mode_t)-1 */
+	struct stat st;
+};
+
+static struct copy_par {
+	bb_pool *pool;
+	struct copy_job *head, *tail; /* oldest first */
+	struct copy_dir *dirs, *last_dir; /* in order of completion */
+	unsigned njobs, max_jobs;
+	mode_t umask;
+	smallint failed;
+} *copy_par;
+
+static void FAST_FUNC run_copy_job(bb_task *task)
+{
+	struct copy_job *job = (struct copy_job *)task;
+	job->retval = copy_regular(job->source, job->dest, job->flags, &job->st);
+}
+
+static void reap_copy_job(void)
+{
+	struct copy_job *job = copy_par->head;
+
+	bb_pool_wait(copy_par->pool, &job->task);
+	if (job->retval < 0)
+		copy_par->failed = 1;
+	copy_par->head = job->next;
+	if (!job->next)
+		copy_par->tail = NULL;
+	copy_par->njobs--;
+	free(job->source);
+	free(job->dest);
+	free(job);
+}
+
+static void queue_copy_job(const char *source, const char *dest, int flags,
+		const struct stat *st)
+{
+	struct copy_job *job;
+
+	/* Bound the queue: traversal should not run far ahead */
+	if (copy_par->njobs >= copy_par->max_jobs)
+		reap_copy_job();
+	job = xzalloc(sizeof(*job));
+	job->task.run = run_copy_job;
+	job->source = xstrdup(source);
+	job->dest = xstrdup(dest);
+	job->flags = flags;
+	job->st = *st;
+	if (copy_par->tail)
+		copy_par->tail->next = job;
+	else
+		copy_par->head = job;
+	copy_par->tail = job;
+	copy_par->njobs++;
+	bb_pool_submit(copy_par->pool, &job->task);
+}
+
+static void wait_copy_jobs(void)
+{
+	while (copy_par->head)
+		reap_copy_job();
+}
+
+/* Directory contents are done (or queued): remember to set
+ * its attributes when all jobs are finished. Subdirectories
+ * are completed before their parents, so this list is post-order */
+static void defer_copy_dir(const char *source, const char *dest, int flags,
+		mode_t mode, const struct stat *st)
+{
+	struct copy_dir *d = xzalloc(sizeof(*d));
+
+	d->source = xstrdup(source);
+	d->dest = xstrdup(dest);
+	d->flags = flags;
+	d->mode = mode;
+	d->st = *st;
+	if (copy_par->last_dir)
+		copy_par->last_dir->next = d;
+	else
+		copy_par->dirs = d;
+	copy_par->last_dir = d;
+}
+
+void FAST_FUNC copy_file_jobs(unsigned nthreads)
+{
+	if (!ENABLE_FEATURE_USE_THREADS || nthreads == 0)
+		return;
+	copy_par = xzalloc(sizeof(*copy_par));
+	copy_par->pool = bb_pool_new(nthreads);
+	copy_par->max_jobs = 4 * nthreads;
+	/* umask is per process: with threads, don't change it
+	 * even for a moment, remember it instead */
+	copy_par->umask = umask(0);
+	umask(copy_par->umask);
+}
+
+int FAST_FUNC copy_file_finish(void)
+{
+	int retval;
+
+	if (!copy_par)
+		return 0;
+	wait_copy_jobs();
+	bb_pool_free(copy_par->pool);
+	while (copy_par->dirs) {
+		struct copy_dir *d = copy_par->dirs;
+
+		if (d->mode != (mode_t)-1 && chmod(d->dest, d->mode) < 0)
+			bb_perror_msg("can't preserve %s of '%s'", "permissions", d->dest);
+		preserve_status(d->dest, d->flags, &d->st);
+		if (d->flags & FILEUTILS_VERBOSE)
+			printf("'%s' -> '%s'\n", d->source, d->dest);
+		copy_par->dirs = d->next;
+		free(d->source);
+		free(d->dest);
+		free(d);
+	}
+	retval = copy_par->failed ? -1 : 0;
+	free(copy_par);
+	copy_par = NULL;
+	return retval;
+}
+
 /* Return:
  * -1 error, copy not made
  *  0 copy is made or user answered "no" in interactive mode
@@ -168,7 +505,7 @@ int FAST_FUNC copy_file(const char *source, const char *dest, int flags)
 		} else {
 			/* Create DEST */
 			mode_t mode;
-			saved_umask = umask(0);
+			saved_umask = copy_par ? copy_par->umask : umask(0);
 
 			mode = source_stat.st_mode;
 			if (!(flags & FILEUTILS_PRESERVE_STATUS))
@@ -176,11 +513,18 @@ int FAST_FUNC copy_file(const char *source, const char *dest, int flags)
 			/* Allow owner to access new dir (at least for now) */
 			mode |= S_IRWXU;
 			if (mkdir(dest, mode) < 0) {
+				if (!copy_par)
+					umask(saved_umask);
+				bb_perror_msg("can't create directory '%s'", dest);
+				return -1;
+			}
+			if (!copy_par)
 				umask(saved_umask);
+			/* Workers may be creating files: umask stays as is */
+			else if ((mode & saved_umask) && chmod(dest, mode) < 0) {
 				bb_perror_msg("can't create directory '%s'", dest);
 				return -1;
 			}
-			umask(saved_umask);
 			/* need stat info for add_to_ino_dev_hashtable */
 			if (lstat(dest, &dest_stat) < 0) {
 				bb_perror_msg("can't stat '%s'", dest);
@@ -212,6 +556,12 @@ int FAST_FUNC copy_file(const char *source, const char *dest, int flags)
 		}
 		closedir(dp);
 
+		if (copy_par) {
+			defer_copy_dir(source, dest, flags,
+				dest_exists ? (mode_t)-1 : (source_stat.st_mode & ~saved_umask),
+				&source_stat);
+			return retval;
+		}
 		if (!dest_exists
 		 && chmod(dest, source_stat.st_mode & ~saved_umask) < 0
 		) {
@@ -266,10 +616,6 @@ int FAST_FUNC copy_file(const char *source, const char *dest, int flags)
 	  * So the below is never true: */
 	 /* || (FLAGS_DEREF && S_ISLNK(source_stat.st_mode)) */
 	) {
-		int src_fd;
-		int dst_fd;
-		mode_t new_mode;
-
 		if (!FLAGS_DEREF && S_ISLNK(source_stat.st_mode)) {
 			/* "cp -d symlink dst": create a link */
 			goto dont_cat;
@@ -279,6 +625,9 @@ int FAST_FUNC copy_file(const char *source, const char *dest, int flags)
 			const char *link_target;
 			link_target = is_in_ino_dev_hashtable(&source_stat);
 			if (link_target) {
+				/* The target may be still being copied */
+				if (copy_par)
+					wait_copy_jobs();
 				if (link(link_target, dest) < 0) {
 					ovr = ask_and_unlink(dest, flags);
 					if (ovr <= 0)
@@ -293,92 +642,17 @@ int FAST_FUNC copy_file(const char *source, const char *dest, int flags)
 			add_to_ino_dev_hashtable(&source_stat, dest);
 		}
 
-		src_fd = open_or_warn(source, O_RDONLY);
-		if (src_fd < 0)
-			return -1;
-
-		/* Do not try to open with weird mode fields */
-		new_mode = source_stat.st_mode;
-		if (!S_ISREG(source_stat.st_mode))
-			new_mode = 0666;
-
-		if (ENABLE_FEATURE_NON_POSIX_CP || (flags & FILEUTILS_INTERACTIVE)) {
-			/*
-			 * O_CREAT|O_EXCL: require that file did not exist before creation
-			 */
-			dst_fd = open(dest, O_WRONLY|O_CREAT|O_EXCL, new_mode);
-		} else { /* POSIX, and not "cp -i" */
-			/*
-			 * O_CREAT|O_TRUNC: create, or truncate (security problem versus (sym)link attacks)
-			 */
-			dst_fd = open(dest, O_WRONLY|O_CREAT|O_TRUNC, new_mode);
-		}
-		if (dst_fd == -1) {
-			ovr = ask_and_unlink(dest, flags);
-			if (ovr <= 0) {
-				close(src_fd);
-				return ovr;
-			}
-			/* It shouldn't exist. If it exists, do not open (symlink attack?) */
-			dst_fd = open3_or_warn(dest, O_WRONLY|O_CREAT|O_EXCL, new_mode);
-			if (dst_fd < 0) {
-				close(src_fd);
-				return -1;
-			}
-		}
-
+		if (copy_par && S_ISREG(source_stat.st_mode)
+		 && !(flags & FILEUTILS_INTERACTIVE)
 #if ENABLE_SELINUX
-		if ((flags & (FILEUTILS_PRESERVE_SECURITY_CONTEXT|FILEUTILS_SET_SECURITY_CONTEXT))
-		 && is_selinux_enabled() > 0
-		) {
-			security_context_t con;
-			if (getfscreatecon(&con) == -1) {
-				bb_simple_perror_msg("getfscreatecon");
-				return -1;
-			}
-			if (con) {
-				if (setfilecon(dest, con) == -1) {
-					bb_perror_msg("setfilecon:%s,%s", dest, con);
-					freecon(con);
-					return -1;
-				}
-				freecon(con);
-			}
-		}
+		 /* fscreate context is per thread */
+		 && !(flags & (FILEUTILS_PRESERVE_SECURITY_CONTEXT|FILEUTILS_SET_SECURITY_CONTEXT))
 #endif
-#if ENABLE_FEATURE_CP_REFLINK
-# undef BTRFS_IOCTL_MAGIC
-# define BTRFS_IOCTL_MAGIC 0x94
-# undef BTRFS_IOC_CLONE
-# define BTRFS_IOC_CLONE _IOW (BTRFS_IOCTL_MAGIC, 9, int)
-		if (flags & FILEUTILS_REFLINK) {
-			retval = ioctl(dst_fd, BTRFS_IOC_CLONE, src_fd);
-			if (retval == 0)
-				goto do_close;
-			/* reflink did not work */
-			if (flags & FILEUTILS_REFLINK_ALWAYS) {
-				bb_perror_msg("failed to clone '%s' from '%s'", dest, source);
-				goto do_close;
-			}
-			/* fall through to standard copy */
-			retval = 0;
-		}
-#endif
-		if (bb_copyfd_eof(src_fd, dst_fd) == -1)
-			retval = -1;
- IF_FEATURE_CP_REFLINK(do_close:)
-		/* Careful with writing... */
-		if (close(dst_fd) < 0) {
-			bb_perror_msg("error writing to '%s'", dest);
-			retval = -1;
+		) {
+			queue_copy_job(source, dest, flags, &source_stat);
+			return 0;
 		}
-		/* ...but read size is already checked by bb_copyfd_eof */
-		close(src_fd);
-		/* "cp /dev/something new_file" should not
-		 * copy mode of /dev/something */
-		if (!S_ISREG(source_stat.st_mode))
-			return retval;
-		goto preserve_mode_ugid_time;
+		return copy_regular(source, dest, flags, &source_stat);
 	}
  dont_cat:
 
@@ -425,24 +699,7 @@ int FAST_FUNC copy_file(const char *source, const char *dest, int flags)
 
  preserve_mode_ugid_time:
 
-	if (flags & FILEUTILS_PRESERVE_STATUS
-	/* Cannot happen: */
-	/* && !(flags & (FILEUTILS_MAKE_SOFTLINK|FILEUTILS_MAKE_HARDLINK)) */
-	) {
-		struct timeval times[2];
-
-		times[1].tv_sec = times[0].tv_sec = source_stat.st_mtime;
-		times[1].tv_usec = times[0].tv_usec = 0;
-		/* BTW, utimes sets usec-precision time - just FYI */
-		if (utimes(dest, times) < 0)
-			bb_perror_msg("can't preserve %s of '%s'", "times", dest);
-		if (chown(dest, source_stat.st_uid, source_stat.st_gid) < 0) {
-			source_stat.st_mode &= ~(S_ISUID | S_ISGID);
-			bb_perror_msg("can't preserve %s of '%s'", "ownership", dest);
-		}
-		if (chmod(dest, source_stat.st_mode) < 0)
-			bb_perror_msg("can't preserve %s of '%s'", "permissions", dest);
-	}
+	preserve_status(dest, flags, &source_stat);
 
  verb_and_exit:
 	if (flags & FILEUTILS_VERBOSE) {
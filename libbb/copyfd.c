@@ -9,8 +9,18 @@
 #include "libbb.h"
 #if ENABLE_FEATURE_USE_SENDFILE
 # include <sys/sendfile.h>
+# include <sys/syscall.h>
+/* Not every libc has copy_file_range() wrapper (glibc has it since 2.27) */
+# if defined(__NR_copy_file_range)
+#  define bb_copy_file_range(in, out, len) \
+	syscall(__NR_copy_file_range, in, NULL, out, NULL, len, 0)
+# else
+#  define bb_copy_file_range(in, out, len) (-1)
+# endif
 #else
-# define sendfile(a,b,c,d) (-1)
+# define sendfile(a,b,c,d) ((void)(d), -1)
+# define splice(a,b,c,d,e,f) (-1)
+# define bb_copy_file_range(in, out, len) (-1)
 #endif
 
 /*
@@ -22,16 +32,29 @@
  */
 #define SENDFILE_BIGBUF (16*1024*1024)
 
+/* Ways to move data, from most to least efficient.
+ * If a method fails, we fall back to sendfile, then to read/write:
+ * if the failure was for real (say, disk is full), read/write
+ * will hit it again and report it.
+ */
+enum {
+	COPY_READ_WRITE,
+	COPY_SENDFILE,
+	COPY_SPLICE,          /* at least one side is a pipe */
+	COPY_COPY_FILE_RANGE, /* both sides are regular files */
+};
+
 /* Used by NOFORK applets (e.g. cat) - must not use xmalloc.
  * size < 0 means "ignore write errors", used by tar --to-command
  * size = 0 means "copy till EOF"
+ * noclone: don't use copy_file_range, it may share data blocks
  */
-static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
+static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size, bool noclone)
 {
 	int status = -1;
 	off_t total = 0;
 	bool continue_on_write_error = 0;
-	ssize_t sendfile_sz;
+	smallint method = COPY_READ_WRITE;
 #if CONFIG_FEATURE_COPYBUF_KB > 4
 	char *buffer = buffer; /* for compiler */
 	int buffer_size = 0;
@@ -48,9 +71,18 @@ static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 	if (src_fd < 0)
 		goto out;
 
-	sendfile_sz = !ENABLE_FEATURE_USE_SENDFILE
-		? 0
-		: SENDFILE_BIGBUF;
+	/* dst_fd == -1 is a fake, else... */
+	if (ENABLE_FEATURE_USE_SENDFILE && dst_fd >= 0) {
+		struct stat src_st, dst_st;
+
+		method = COPY_SENDFILE;
+		if (fstat(src_fd, &src_st) == 0 && fstat(dst_fd, &dst_st) == 0) {
+			if (S_ISFIFO(src_st.st_mode) || S_ISFIFO(dst_st.st_mode))
+				method = COPY_SPLICE;
+			else if (S_ISREG(src_st.st_mode) && S_ISREG(dst_st.st_mode) && !noclone)
+				method = COPY_COPY_FILE_RANGE;
+		}
+	}
 	if (!size) {
 		size = SENDFILE_BIGBUF;
 		status = 1; /* copy until eof */
@@ -59,15 +91,25 @@ static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 	while (1) {
 		ssize_t rd;
 
-		if (sendfile_sz) {
-			/* dst_fd == -1 is a fake, else... */
-			if (dst_fd >= 0) {
-				rd = sendfile(dst_fd, src_fd, NULL,
-					size > sendfile_sz ? sendfile_sz : size);
-				if (rd >= 0)
-					goto read_ok;
+		if (method != COPY_READ_WRITE) {
+			size_t sz = size > SENDFILE_BIGBUF ? SENDFILE_BIGBUF : size;
+
+			if (method == COPY_COPY_FILE_RANGE) {
+				rd = bb_copy_file_range(src_fd, dst_fd, sz);
+				/* On some kernels, copy_file_range from /proc and /sys
+				 * files (which have st_size 0) returns 0 right away.
+				 * Let other methods verify that it is really EOF */
+				if (rd == 0 && total == 0)
+					rd = -1;
+			} else if (method == COPY_SPLICE) {
+				rd = splice(src_fd, NULL, dst_fd, NULL, sz, SPLICE_F_MOVE);
+			} else {
+				rd = sendfile(dst_fd, src_fd, NULL, sz);
 			}
-			sendfile_sz = 0; /* do not try sendfile anymore */
+			if (rd >= 0)
+				goto read_ok;
+			method = (method == COPY_SENDFILE) ? COPY_READ_WRITE : COPY_SENDFILE;
+			continue;
 		}
 #if CONFIG_FEATURE_COPYBUF_KB > 4
 		if (buffer_size == 0) {
@@ -99,7 +141,7 @@ static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 			break;
 		}
 		/* dst_fd == -1 is a fake, else... */
-		if (dst_fd >= 0 && !sendfile_sz) {
+		if (dst_fd >= 0 && method == COPY_READ_WRITE) {
 			ssize_t wr = full_write(dst_fd, buffer, rd);
 			if (wr < rd) {
 				if (!continue_on_write_error) {
@@ -143,7 +185,7 @@ void FAST_FUNC complain_copyfd_and_die(off_t sz)
 off_t FAST_FUNC bb_copyfd_size(int fd1, int fd2, off_t size)
 {
 	if (size) {
-		return bb_full_fd_action(fd1, fd2, size);
+		return bb_full_fd_action(fd1, fd2, size, 0);
 	}
 	return 0;
 }
@@ -161,5 +203,10 @@ void FAST_FUNC bb_copyfd_exact_size(int fd1, int fd2, off_t size)
 
 off_t FAST_FUNC bb_copyfd_eof(int fd1, int fd2)
 {
-	return bb_full_fd_action(fd1, fd2, 0);
+	return bb_full_fd_action(fd1, fd2, 0, 0);
+}
+
+off_t FAST_FUNC bb_copyfd_noclone(int fd1, int fd2, off_t size)
+{
+	return bb_full_fd_action(fd1, fd2, size, 1);
 }
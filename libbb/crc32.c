@@ -52,24 +52,181 @@ uint32_t* FAST_FUNC global_crc32_new_table_le(void)
 	return global_crc32_table;
 }
 
+#if ENABLE_FEATURE_FAST_CRC32
+/* Slicing-by-8: tables T[1..7] let us process 8 bytes at once,
+ * T[0] is the usual table. They are built from the caller's table
+ * on first use. The only two CRC32 flavors busybox uses are the ones
+ * crc32_filltable() produces, thus tables are per-endianness.
+ */
+static uint32_t *crc32_slice8_table[2];
+
+static const uint32_t *get_slice8_table(const uint32_t *crc_table, int endian)
+{
+	uint32_t *t = crc32_slice8_table[endian];
+
+	if (!t) {
+		unsigned i;
+
+		t = xmalloc(8 * 256 * sizeof(t[0]));
+		memcpy(t, crc_table, 256 * sizeof(t[0]));
+		for (i = 256; i < 8 * 256; i++) {
+			uint32_t c = t[i - 256];
+			t[i] = endian ? (c << 8) ^ t[c >> 24] : (c >> 8) ^ t[(uint8_t)c];
+		}
+		/* If two threads race here, one table leaks. Not a problem */
+		crc32_slice8_table[endian] = t;
+	}
+	return t;
+}
+
+/* Carry-less multiplication (x86 PCLMULQDQ) can fold 64 bytes
+ * per iteration, for the reflected (gzip) flavor of CRC32.
+ * Algorithm and constants are from Intel's "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction" paper.
+ */
+# define CRC32_PCLMUL 0
+# if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) \
+  && (defined(__clang__) || __GNUC__ >= 5)
+#  undef CRC32_PCLMUL
+#  define CRC32_PCLMUL 1
+#  include <cpuid.h>
+#  include <immintrin.h>
+
+/* 1: can use PCLMULQDQ, -1: can't, 0: not checked yet */
+static smallint has_pclmul;
+
+static int pclmul_supported(void)
+{
+	if (has_pclmul == 0) {
+		unsigned eax, ebx, ecx, edx;
+
+		has_pclmul = -1;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)
+		 && (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1)
+		) {
+			has_pclmul = 1;
+		}
+	}
+	return has_pclmul > 0;
+}
+
+/* len must be >= 64, and a multiple of 16 */
+static uint32_t __attribute__((target("pclmul,sse4.1")))
+crc32_le_pclmul(uint32_t crc, const uint8_t *buf, unsigned len)
+{
+	static const uint64_t k1k2[] ALIGNED(16) = { 0x0154442bd4, 0x01c6e41596 };
+	static const uint64_t k3k4[] ALIGNED(16) = { 0x01751997d0, 0x00ccaa009e };
+	static const uint64_t k5k0[] ALIGNED(16) = { 0x0163cd6124, 0x0000000000 };
+	static const uint64_t poly[] ALIGNED(16) = { 0x01db710641, 0x01f7011641 };
+	__m128i x0, x1, x2, x3, x4, mask32;
+
+#define FOLD(x, k, next) \
+	_mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), \
+			_mm_clmulepi64_si128(x, k, 0x11)), next)
+	x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(buf + 0x00)), _mm_cvtsi32_si128(crc));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	buf += 64;
+	len -= 64;
+
+	/* Fold four 128-bit lanes in parallel, 64 bytes per iteration */
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	while (len >= 64) {
+		x1 = FOLD(x1, x0, _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+		x2 = FOLD(x2, x0, _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+		x3 = FOLD(x3, x0, _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+		x4 = FOLD(x4, x0, _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+		buf += 64;
+		len -= 64;
+	}
+
+	/* Fold the lanes into one, then remaining 16-byte blocks into it */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x1 = FOLD(x1, x0, x2);
+	x1 = FOLD(x1, x0, x3);
+	x1 = FOLD(x1, x0, x4);
+	while (len >= 16) {
+		x1 = FOLD(x1, x0, _mm_loadu_si128((const __m128i *)buf));
+		buf += 16;
+		len -= 16;
+	}
+#undef FOLD
+
+	/* Fold 128 bits to 64 */
+	mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), x0, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+# endif
+#endif /* FEATURE_FAST_CRC32 */
+
 uint32_t FAST_FUNC crc32_block_endian1(uint32_t val, const void *buf, unsigned len, uint32_t *crc_table)
 {
-	const void *end = (uint8_t*)buf + len;
+	const uint8_t *p = buf;
+	const uint8_t *end = p + len;
 
-	while (buf != end) {
-		val = (val << 8) ^ crc_table[(val >> 24) ^ *(uint8_t*)buf];
-		buf = (uint8_t*)buf + 1;
+#if ENABLE_FEATURE_FAST_CRC32
+	if (len >= 16) {
+		const uint32_t *t = get_slice8_table(crc_table, 1);
+		while (end - p >= 8) {
+			uint32_t one = get_unaligned_be32(p) ^ val;
+			uint32_t two = get_unaligned_be32(p + 4);
+			val = t[7*256 + (one >> 24)] ^ t[6*256 + (uint8_t)(one >> 16)]
+			    ^ t[5*256 + (uint8_t)(one >> 8)] ^ t[4*256 + (uint8_t)one]
+			    ^ t[3*256 + (two >> 24)] ^ t[2*256 + (uint8_t)(two >> 16)]
+			    ^ t[1*256 + (uint8_t)(two >> 8)] ^ t[(uint8_t)two];
+			p += 8;
+		}
+	}
+#endif
+	while (p != end) {
+		val = (val << 8) ^ crc_table[(val >> 24) ^ *p];
+		p++;
 	}
 	return val;
 }
 
 uint32_t FAST_FUNC crc32_block_endian0(uint32_t val, const void *buf, unsigned len, uint32_t *crc_table)
 {
-	const void *end = (uint8_t*)buf + len;
+	const uint8_t *p = buf;
+	const uint8_t *end = p + len;
 
-	while (buf != end) {
-		val = crc_table[(uint8_t)val ^ *(uint8_t*)buf] ^ (val >> 8);
-		buf = (uint8_t*)buf + 1;
+#if ENABLE_FEATURE_FAST_CRC32
+# if CRC32_PCLMUL
+	if (len >= 64 && pclmul_supported()) {
+		val = crc32_le_pclmul(val, p, len & ~15);
+		p += len & ~15;
+	}
+# endif
+	if (end - p >= 16) {
+		const uint32_t *t = get_slice8_table(crc_table, 0);
+		while (end - p >= 8) {
+			uint32_t one = get_unaligned_le32(p) ^ val;
+			uint32_t two = get_unaligned_le32(p + 4);
+			val = t[7*256 + (uint8_t)one] ^ t[6*256 + (uint8_t)(one >> 8)]
+			    ^ t[5*256 + (uint8_t)(one >> 16)] ^ t[4*256 + (one >> 24)]
+			    ^ t[3*256 + (uint8_t)two] ^ t[2*256 + (uint8_t)(two >> 8)]
+			    ^ t[1*256 + (uint8_t)(two >> 16)] ^ t[(two >> 24)];
+			p += 8;
+		}
+	}
+#endif
+	while (p != end) {
+		val = crc_table[(uint8_t)val ^ *p] ^ (val >> 8);
+		p++;
 	}
 	return val;
 }
@@ -692,6 +692,332 @@ static void FAST_FUNC sha256_process_block64(sha256_ctx_t *ctx)
 	ctx->hash[7] += h;
 }
 
+/*
+ * SHA1 and SHA256 using CPU instructions designed for them:
+ * SHA-NI on x86, Cryptography Extensions on ARMv8.
+ * Compiled with function-level target attributes, so that the rest
+ * of busybox does not need to be built for a CPU which has them;
+ * whether they can be used is checked at runtime, in sha1_begin()
+ * and sha256_begin().
+ */
+#define SHA_HWACCEL_X86 0
+#define SHA_HWACCEL_ARM 0
+#if ENABLE_SHA1_HWACCEL || ENABLE_SHA256_HWACCEL
+# if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) \
+  && (defined(__clang__) || __GNUC__ >= 5)
+#  undef SHA_HWACCEL_X86
+#  define SHA_HWACCEL_X86 1
+# elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__) \
+  && (defined(__clang__) || __GNUC__ >= 6)
+#  undef SHA_HWACCEL_ARM
+#  define SHA_HWACCEL_ARM 1
+# endif
+#endif
+
+#if SHA_HWACCEL_X86
+# include <cpuid.h>
+# include <immintrin.h>
+# define SHA_HW_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+/* 1: can use SHA-NI, -1: can't, 0: not checked yet */
+static smallint has_sha_hw;
+
+static int sha_hw_supported(void)
+{
+	if (has_sha_hw == 0) {
+		unsigned eax, ebx, ecx, edx;
+
+		has_sha_hw = -1;
+		if (__get_cpuid_max(0, NULL) >= 7
+		 && __get_cpuid(1, &eax, &ebx, &ecx, &edx)
+		 && (ecx & bit_SSSE3) && (ecx & bit_SSE4_1)
+		) {
+			__cpuid_count(7, 0, eax, ebx, ecx, edx);
+			if (ebx & (1 << 29)) /* SHA */
+				has_sha_hw = 1;
+		}
+	}
+	return has_sha_hw > 0;
+}
+#endif /* SHA_HWACCEL_X86 */
+
+#if SHA_HWACCEL_ARM
+# include <sys/auxv.h>
+# include <arm_neon.h>
+# ifdef __clang__
+#  define SHA_HW_TARGET __attribute__((target("crypto")))
+# else
+#  define SHA_HW_TARGET __attribute__((target("+crypto")))
+# endif
+# ifndef HWCAP_SHA1
+#  define HWCAP_SHA1 (1 << 5)
+# endif
+# ifndef HWCAP_SHA2
+#  define HWCAP_SHA2 (1 << 6)
+# endif
+
+static smallint has_sha_hw;
+
+static int sha_hw_supported(void)
+{
+	if (has_sha_hw == 0) {
+		unsigned long hwcap = getauxval(AT_HWCAP);
+		has_sha_hw = -1;
+		if ((hwcap & (HWCAP_SHA1|HWCAP_SHA2)) == (HWCAP_SHA1|HWCAP_SHA2))
+			has_sha_hw = 1;
+	}
+	return has_sha_hw > 0;
+}
+#endif /* SHA_HWACCEL_ARM */
+
+#define SHA1_HWACCEL   ((SHA_HWACCEL_X86 || SHA_HWACCEL_ARM) && ENABLE_SHA1_HWACCEL)
+#define SHA256_HWACCEL ((SHA_HWACCEL_X86 || SHA_HWACCEL_ARM) && ENABLE_SHA256_HWACCEL)
+
+#if SHA256_HWACCEL
+/* Same as upper halves of sha_K[0..63], but in a form
+ * which can be loaded into vector registers directly */
+static const uint32_t sha256_K[64] ALIGNED(16) = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+#endif
+
+/* In all four functions below, the 16-word message schedule
+ * lives in four vector registers m0..m3 used as a ring:
+ * SCHED(m0, m1, m2, m3) replaces W[i-4] (in m0) with W[i],
+ * given W[i-3], W[i-2], W[i-1] in m1, m2, m3.
+ * Unrolled by hand: instructions take immediate operands.
+ */
+#if SHA1_HWACCEL && SHA_HWACCEL_X86
+static void FAST_FUNC SHA_HW_TARGET sha1_process_block64_hw(sha1_ctx_t *ctx)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	const __m128i *words = (const __m128i *) ctx->wbuffer;
+	__m128i abcd, abcd_save, prev, e, e_save;
+	__m128i m0, m1, m2, m3;
+
+	/* a,b,c,d go into lanes 3..0, e - into lane 3 */
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) ctx->hash), 0x1b);
+	e_save = _mm_insert_epi32(_mm_setzero_si128(), ctx->hash[4], 3);
+	abcd_save = abcd;
+
+#define SCHED(m0, m1, m2, m3) \
+	m0 = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(m0, m1), m2), m3)
+#define ROUNDS4(m, f) do { \
+	e = _mm_sha1nexte_epu32(prev, m); \
+	prev = abcd; \
+	abcd = _mm_sha1rnds4_epu32(abcd, e, f); \
+} while (0)
+	m0 = _mm_shuffle_epi8(_mm_loadu_si128(words + 0), bswap);
+	m1 = _mm_shuffle_epi8(_mm_loadu_si128(words + 1), bswap);
+	m2 = _mm_shuffle_epi8(_mm_loadu_si128(words + 2), bswap);
+	m3 = _mm_shuffle_epi8(_mm_loadu_si128(words + 3), bswap);
+	/* Rounds 0..3 */
+	e = _mm_add_epi32(e_save, m0);
+	prev = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e, 0);
+	/* Rounds 4..79 */
+	ROUNDS4(m1, 0);
+	ROUNDS4(m2, 0);
+	ROUNDS4(m3, 0);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, 0);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, 1);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, 1);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, 1);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, 1);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, 1);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, 2);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, 2);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, 2);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, 2);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, 2);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, 3);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, 3);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, 3);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, 3);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, 3);
+#undef SCHED
+#undef ROUNDS4
+	/* e of the next block is rol(a,30) of 4 rounds ago, plus old e */
+	e = _mm_sha1nexte_epu32(prev, e_save);
+	abcd = _mm_add_epi32(abcd, abcd_save);
+
+	_mm_storeu_si128((__m128i *) ctx->hash, _mm_shuffle_epi32(abcd, 0x1b));
+	ctx->hash[4] = _mm_extract_epi32(e, 3);
+}
+#endif
+
+#if SHA256_HWACCEL && SHA_HWACCEL_X86
+static void FAST_FUNC SHA_HW_TARGET sha256_process_block64_hw(sha256_ctx_t *ctx)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	const __m128i *words = (const __m128i *) ctx->wbuffer;
+	const __m128i *K = (const __m128i *) sha256_K;
+	__m128i abef, cdgh, abef_save, cdgh_save, t;
+	__m128i m0, m1, m2, m3;
+
+	/* sha256rnds2 wants state as {a,b,e,f} and {c,d,g,h} */
+	t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &ctx->hash[0]), 0xb1); /* cdab */
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &ctx->hash[4]), 0x1b); /* efgh */
+	abef = _mm_alignr_epi8(t, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, t, 0xf0);
+	abef_save = abef;
+	cdgh_save = cdgh;
+
+#define SCHED(m0, m1, m2, m3) \
+	m0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), \
+			_mm_alignr_epi8(m3, m2, 4)), m3)
+#define ROUNDS4(m, i) do { \
+	t = _mm_add_epi32(m, _mm_load_si128(K + (i))); \
+	cdgh = _mm_sha256rnds2_epu32(cdgh, abef, t); \
+	abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(t, 0x0e)); \
+} while (0)
+	m0 = _mm_shuffle_epi8(_mm_loadu_si128(words + 0), bswap);
+	m1 = _mm_shuffle_epi8(_mm_loadu_si128(words + 1), bswap);
+	m2 = _mm_shuffle_epi8(_mm_loadu_si128(words + 2), bswap);
+	m3 = _mm_shuffle_epi8(_mm_loadu_si128(words + 3), bswap);
+	ROUNDS4(m0, 0);
+	ROUNDS4(m1, 1);
+	ROUNDS4(m2, 2);
+	ROUNDS4(m3, 3);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, 4);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, 5);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, 6);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, 7);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, 8);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, 9);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, 10);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, 11);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, 12);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, 13);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, 14);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, 15);
+#undef SCHED
+#undef ROUNDS4
+	abef = _mm_add_epi32(abef, abef_save);
+	cdgh = _mm_add_epi32(cdgh, cdgh_save);
+
+	t = _mm_shuffle_epi32(abef, 0x1b);    /* feba */
+	cdgh = _mm_shuffle_epi32(cdgh, 0xb1); /* dchg */
+	_mm_storeu_si128((__m128i *) &ctx->hash[0], _mm_blend_epi16(t, cdgh, 0xf0)); /* dcba */
+	_mm_storeu_si128((__m128i *) &ctx->hash[4], _mm_alignr_epi8(cdgh, t, 8));    /* hgfe */
+}
+#endif
+
+#if SHA1_HWACCEL && SHA_HWACCEL_ARM
+static void FAST_FUNC SHA_HW_TARGET sha1_process_block64_hw(sha1_ctx_t *ctx)
+{
+	const uint8_t *data = ctx->wbuffer;
+	uint32x4_t abcd, abcd_save, t;
+	uint32x4_t m0, m1, m2, m3;
+	uint32_t e, e_next, e_save;
+	uint32x4_t k;
+
+	abcd = abcd_save = vld1q_u32(ctx->hash);
+	e = e_save = ctx->hash[4];
+
+#define SCHED(m0, m1, m2, m3) \
+	m0 = vsha1su1q_u32(vsha1su0q_u32(m0, m1, m2), m3)
+#define ROUNDS4(m, op) do { \
+	t = vaddq_u32(m, k); \
+	e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0)); \
+	abcd = op(abcd, e, t); \
+	e = e_next; \
+} while (0)
+	m0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+	m1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+	m2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+	m3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+	k = vdupq_n_u32(0x5a827999);
+	ROUNDS4(m0, vsha1cq_u32);
+	ROUNDS4(m1, vsha1cq_u32);
+	ROUNDS4(m2, vsha1cq_u32);
+	ROUNDS4(m3, vsha1cq_u32);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, vsha1cq_u32);
+	k = vdupq_n_u32(0x6ed9eba1);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, vsha1pq_u32);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, vsha1pq_u32);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, vsha1pq_u32);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, vsha1pq_u32);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, vsha1pq_u32);
+	k = vdupq_n_u32(0x8f1bbcdc);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, vsha1mq_u32);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, vsha1mq_u32);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, vsha1mq_u32);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, vsha1mq_u32);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, vsha1mq_u32);
+	k = vdupq_n_u32(0xca62c1d6);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, vsha1pq_u32);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, vsha1pq_u32);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, vsha1pq_u32);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, vsha1pq_u32);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, vsha1pq_u32);
+#undef SCHED
+#undef ROUNDS4
+	vst1q_u32(ctx->hash, vaddq_u32(abcd, abcd_save));
+	ctx->hash[4] = e + e_save;
+}
+#endif
+
+#if SHA256_HWACCEL && SHA_HWACCEL_ARM
+static void FAST_FUNC SHA_HW_TARGET sha256_process_block64_hw(sha256_ctx_t *ctx)
+{
+	const uint8_t *data = ctx->wbuffer;
+	uint32x4_t abcd, efgh, abcd_save, efgh_save, t, t2;
+	uint32x4_t m0, m1, m2, m3;
+
+	abcd = abcd_save = vld1q_u32(&ctx->hash[0]);
+	efgh = efgh_save = vld1q_u32(&ctx->hash[4]);
+
+#define SCHED(m0, m1, m2, m3) \
+	m0 = vsha256su1q_u32(vsha256su0q_u32(m0, m1), m2, m3)
+#define ROUNDS4(m, i) do { \
+	t = vaddq_u32(m, vld1q_u32(&sha256_K[(i) * 4])); \
+	t2 = abcd; \
+	abcd = vsha256hq_u32(abcd, efgh, t); \
+	efgh = vsha256h2q_u32(efgh, t2, t); \
+} while (0)
+	m0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+	m1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+	m2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+	m3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+	ROUNDS4(m0, 0);
+	ROUNDS4(m1, 1);
+	ROUNDS4(m2, 2);
+	ROUNDS4(m3, 3);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, 4);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, 5);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, 6);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, 7);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, 8);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, 9);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, 10);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, 11);
+	SCHED(m0, m1, m2, m3); ROUNDS4(m0, 12);
+	SCHED(m1, m2, m3, m0); ROUNDS4(m1, 13);
+	SCHED(m2, m3, m0, m1); ROUNDS4(m2, 14);
+	SCHED(m3, m0, m1, m2); ROUNDS4(m3, 15);
+#undef SCHED
+#undef ROUNDS4
+	vst1q_u32(&ctx->hash[0], vaddq_u32(abcd, abcd_save));
+	vst1q_u32(&ctx->hash[4], vaddq_u32(efgh, efgh_save));
+}
+#endif
+
 #if NEED_SHA512
 static void FAST_FUNC sha512_process_block128(sha512_ctx_t *ctx)
 {
@@ -765,6 +1091,10 @@ void FAST_FUNC sha1_begin(sha1_ctx_t *ctx)
 	ctx->hash[4] = 0xc3d2e1f0;
 	ctx->total64 = 0;
 	ctx->process_block = sha1_process_block64;
+#if SHA1_HWACCEL
+	if (sha_hw_supported())
+		ctx->process_block = sha1_process_block64_hw;
+#endif
 }
 
 static const uint32_t init256[] = {
@@ -806,6 +1136,10 @@ void FAST_FUNC sha256_begin(sha256_ctx_t *ctx)
 	memcpy(&ctx->total64, init256, sizeof(init256));
 	/*ctx->total64 = 0; - done by prepending two 32-bit zeros to init256 */
 	ctx->process_block = sha256_process_block64;
+#if SHA256_HWACCEL
+	if (sha_hw_supported())
+		ctx->process_block = sha256_process_block64_hw;
+#endif
 }
 
 #if NEED_SHA512
@@ -877,7 +1211,14 @@ unsigned FAST_FUNC sha1_end(sha1_ctx_t *ctx, void *resbuf)
 	/* SHA stores total in BE, need to swap on LE arches: */
 	common64_end(ctx, /*swap_needed:*/ BB_LITTLE_ENDIAN);
 
-	hash_size = (ctx->process_block == sha1_process_block64) ? 5 : 8;
+	hash_size = 8;
+	if (ctx->process_block == sha1_process_block64
+#if SHA1_HWACCEL
+	 || ctx->process_block == sha1_process_block64_hw
+#endif
+	) {
+		hash_size = 5;
+	}
 	/* This way we do not impose alignment constraints on resbuf: */
 	if (BB_LITTLE_ENDIAN) {
 		unsigned i;
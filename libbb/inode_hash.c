@@ -8,28 +8,179 @@
  * Licensed under GPLv2 or later, see file LICENSE in this source tree.
  */
 #include "libbb.h"
+#if ENABLE_FEATURE_USE_THREADS
+# include <pthread.h>
+#endif
 
-typedef struct ino_dev_hash_bucket_struct {
+/* Open addressing (linear probing) table of (dev,ino) -> value,
+ * doubled when it gets 3/4 full.
+ *
+ * A slot is published by storing its value last (release),
+ * readers load the value first (acquire), so lookups need no lock
+ * even while another thread inserts. Insertions take the mutex.
+ * Growing publishes a new table; in a shared set old tables stay
+ * allocated until ino_dev_set_free(), because a reader may still
+ * be probing them (it can then miss entries added meanwhile, as if
+ * it ran a bit earlier).
+ */
+typedef struct ino_dev_slot {
 	ino_t ino;
-	dev_t dev;
-	/*
-	 * Above fields can be 64-bit, while pointer may be 32-bit.
-	 * Putting "next" field here may reduce size of this struct:
-	 */
-	struct ino_dev_hash_bucket_struct *next;
-	/*
-	 * Reportedly, on cramfs a file and a dir can have same ino.
-	 * Need to also remember "file/dir" bit:
-	 */
-	char isdir; /* bool */
-	char name[1];
-} ino_dev_hashtable_bucket_t;
-
-#define HASH_SIZE      311u   /* Should be prime */
-#define hash_inode(i)  ((unsigned)(i) % HASH_SIZE)
-
-/* array of [HASH_SIZE] elements */
-static ino_dev_hashtable_bucket_t **ino_dev_hashtable;
+	/* Reportedly, on cramfs a file and a dir can have same ino.
+	 * Need to also remember "file/dir" bit: it is the top bit of
+	 * dev (which is never used by real device numbers) */
+	uint64_t dev;
+	void *value; /* NULL: free slot */
+} ino_dev_slot;
+
+struct ino_dev_table {
+	struct ino_dev_table *prev; /* retired, smaller */
+	unsigned bits;
+	ino_dev_slot slot[];
+};
+
+struct ino_dev_set {
+	struct ino_dev_table *table;
+	size_t count;
+	smallint shared;
+#if ENABLE_FEATURE_USE_THREADS
+	pthread_mutex_t mutex;
+#endif
+};
+
+#define MIN_BITS 8
+
+static uint64_t slot_dev(const struct stat *statbuf)
+{
+	return (uint64_t)statbuf->st_dev
+		^ ((uint64_t)!!S_ISDIR(statbuf->st_mode) << 63);
+}
+
+/* Fibonacci hashing: take top bits of a multiplicative hash */
+static size_t slot_index(ino_t ino, uint64_t dev, unsigned bits)
+{
+	uint64_t h = ((uint64_t)ino ^ (dev << 29) ^ (dev >> 35)) * 0x9e3779b97f4a7c15ULL;
+	return (size_t)(h >> (64 - bits));
+}
+
+static struct ino_dev_table *new_table(unsigned bits)
+{
+	struct ino_dev_table *t;
+
+	t = xzalloc(sizeof(*t) + (sizeof(t->slot[0]) << bits));
+	t->bits = bits;
+	return t;
+}
+
+ino_dev_set* FAST_FUNC ino_dev_set_new(int shared)
+{
+	ino_dev_set *set = xzalloc(sizeof(*set));
+
+	set->table = new_table(MIN_BITS);
+	set->shared = shared;
+#if ENABLE_FEATURE_USE_THREADS
+	pthread_mutex_init(&set->mutex, NULL);
+#endif
+	return set;
+}
+
+void FAST_FUNC ino_dev_set_free(ino_dev_set *set)
+{
+	struct ino_dev_table *t, *prev;
+
+	if (!set)
+		return;
+	for (t = set->table; t; t = prev) {
+		prev = t->prev;
+		free(t);
+	}
+#if ENABLE_FEATURE_USE_THREADS
+	pthread_mutex_destroy(&set->mutex);
+#endif
+	free(set);
+}
+
+static void *find_slot(struct ino_dev_table *t, ino_t ino, uint64_t dev)
+{
+	size_t mask = ((size_t)1 << t->bits) - 1;
+	size_t i = slot_index(ino, dev, t->bits);
+
+	for (;;) {
+		ino_dev_slot *s = &t->slot[i];
+		void *value = __atomic_load_n(&s->value, __ATOMIC_ACQUIRE);
+
+		if (!value)
+			return NULL;
+		if (s->ino == ino && s->dev == dev)
+			return value;
+		i = (i + 1) & mask;
+	}
+}
+
+void* FAST_FUNC ino_dev_set_find(ino_dev_set *set, const struct stat *statbuf)
+{
+	return find_slot(__atomic_load_n(&set->table, __ATOMIC_ACQUIRE),
+			statbuf->st_ino, slot_dev(statbuf));
+}
+
+static void put_slot(struct ino_dev_table *t, ino_t ino, uint64_t dev, void *value)
+{
+	size_t mask = ((size_t)1 << t->bits) - 1;
+	size_t i = slot_index(ino, dev, t->bits);
+
+	while (t->slot[i].value)
+		i = (i + 1) & mask;
+	t->slot[i].ino = ino;
+	t->slot[i].dev = dev;
+	__atomic_store_n(&t->slot[i].value, value, __ATOMIC_RELEASE);
+}
+
+static void grow(ino_dev_set *set)
+{
+	struct ino_dev_table *old = set->table;
+	struct ino_dev_table *t = new_table(old->bits + 1);
+	size_t i;
+
+	for (i = 0; i < ((size_t)1 << old->bits); i++) {
+		ino_dev_slot *s = &old->slot[i];
+		if (s->value)
+			put_slot(t, s->ino, s->dev, s->value);
+	}
+	__atomic_store_n(&set->table, t, __ATOMIC_RELEASE);
+	if (set->shared)
+		t->prev = old;
+	else
+		free(old);
+}
+
+/* If statbuf's (dev,ino) is already in the set, return its value.
+ * Else add it with value (which must not be NULL) and return NULL */
+void* FAST_FUNC ino_dev_set_add(ino_dev_set *set, const struct stat *statbuf, void *value)
+{
+	uint64_t dev = slot_dev(statbuf);
+	void *old;
+
+#if ENABLE_FEATURE_USE_THREADS
+	if (set->shared)
+		pthread_mutex_lock(&set->mutex);
+#endif
+	old = find_slot(set->table, statbuf->st_ino, dev);
+	if (!old) {
+		/* Keep load factor below 3/4 */
+		if ((set->count + 1) * 4 > ((size_t)3 << set->table->bits))
+			grow(set);
+		put_slot(set->table, statbuf->st_ino, dev, value);
+		set->count++;
+	}
+#if ENABLE_FEATURE_USE_THREADS
+	if (set->shared)
+		pthread_mutex_unlock(&set->mutex);
+#endif
+	return old;
+}
+
+/* Single-threaded table of names, for cp and du */
+static ino_dev_set *ino_dev_hashtable;
+static char no_name[1];
 
 /*
  * Return name if statbuf->st_ino && statbuf->st_dev are recorded in
@@ -37,71 +188,45 @@ static ino_dev_hashtable_bucket_t **ino_dev_hashtable;
  */
 char* FAST_FUNC is_in_ino_dev_hashtable(const struct stat *statbuf)
 {
-	ino_dev_hashtable_bucket_t *bucket;
-
 	if (!ino_dev_hashtable)
 		return NULL;
-
-	bucket = ino_dev_hashtable[hash_inode(statbuf->st_ino)];
-	while (bucket != NULL) {
-		if ((bucket->ino == statbuf->st_ino)
-		 && (bucket->dev == statbuf->st_dev)
-		 && (bucket->isdir == !!S_ISDIR(statbuf->st_mode))
-		) {
-			return bucket->name;
-		}
-		bucket = bucket->next;
-	}
-	return NULL;
+	return ino_dev_set_find(ino_dev_hashtable, statbuf);
 }
 
 /* Add statbuf to statbuf hash table */
 void FAST_FUNC add_to_ino_dev_hashtable(const struct stat *statbuf, const char *name)
 {
-	int i;
-	ino_dev_hashtable_bucket_t *bucket;
+	char *value;
 
 #if ENABLE_FEATURE_EXTRA_FILE_DATA
 	/* ignore invalid inode numbers */
 	if (statbuf->st_ino == 0)
 		return;
 #endif
-	if (!name)
-		name = "";
-	bucket = xmalloc(sizeof(ino_dev_hashtable_bucket_t) + strlen(name));
-	bucket->ino = statbuf->st_ino;
-	bucket->dev = statbuf->st_dev;
-	bucket->isdir = !!S_ISDIR(statbuf->st_mode);
-	strcpy(bucket->name, name);
-
 	if (!ino_dev_hashtable)
-		ino_dev_hashtable = xzalloc(HASH_SIZE * sizeof(*ino_dev_hashtable));
+		ino_dev_hashtable = ino_dev_set_new(0);
 
-	i = hash_inode(statbuf->st_ino);
-	bucket->next = ino_dev_hashtable[i];
-	ino_dev_hashtable[i] = bucket;
+	value = (name && name[0]) ? xstrdup(name) : no_name;
+	if (ino_dev_set_add(ino_dev_hashtable, statbuf, value) && value != no_name)
+		free(value); /* already there */
 }
 
 #if ENABLE_FEATURE_CLEAN_UP
 /* Clear statbuf hash table */
 void FAST_FUNC reset_ino_dev_hashtable(void)
 {
-	int i;
-	ino_dev_hashtable_bucket_t *bucket, *next;
+	struct ino_dev_table *t;
+	size_t i;
 
 	if (!ino_dev_hashtable)
 		return;
 
-	for (i = 0; i < HASH_SIZE; i++) {
-		bucket = ino_dev_hashtable[i];
-
-		while (bucket != NULL) {
-			next = bucket->next;
-			free(bucket);
-			bucket = next;
-		}
+	t = ino_dev_hashtable->table;
+	for (i = 0; i < ((size_t)1 << t->bits); i++) {
+		if (t->slot[i].value != no_name)
+			free(t->slot[i].value);
 	}
-	free(ino_dev_hashtable);
+	ino_dev_set_free(ino_dev_hashtable);
 	ino_dev_hashtable = NULL;
 }
 #endif
@@ -29,6 +29,135 @@ static int FAST_FUNC true_action(const char *fileName UNUSED_PARAM,
 	return TRUE;
 }
 
+#if !ENABLE_PLATFORM_MINGW32
+/* ACTION_DIRFD mode: entries are fstatat'ed and subdirectories
+ * are openat'ed relative to their parent's fd, so the kernel
+ * does not resolve the whole path again for every entry.
+ * Names for callbacks are built in one reusable buffer,
+ * without malloc/free per entry.
+ */
+# ifndef DTTOIF
+#  define DTTOIF(dirtype) ((dirtype) << 12)
+# endif
+
+struct recurse_state {
+	unsigned flags;
+	int FAST_FUNC (*fileAction)(const char *fileName, struct stat *statbuf, void* userData, int depth);
+	int FAST_FUNC (*dirAction)(const char *fileName, struct stat *statbuf, void* userData, int depth);
+	void* userData;
+	char *path;
+	size_t path_size;
+};
+
+static int recurse_entry_at(struct recurse_state *rs, int dfd,
+		const char *name, unsigned d_type, unsigned depth);
+
+/* Run on every entry of directory fd (which is closed afterwards),
+ * rs->path holds directory's name, len chars long */
+static int recurse_dir_at(struct recurse_state *rs, int fd, size_t len, unsigned depth)
+{
+	DIR *dir;
+	struct dirent *next;
+	int status;
+
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
+		if (!(rs->flags & ACTION_QUIET))
+			bb_simple_perror_msg(rs->path);
+		return FALSE;
+	}
+	status = TRUE;
+	while ((next = readdir(dir)) != NULL) {
+		size_t i, need;
+		unsigned d_type;
+
+		if (DOT_OR_DOTDOT(next->d_name))
+			continue;
+		/* rs->path = rs->path + "/" + d_name */
+		need = len + strlen(next->d_name) + 2;
+		if (need > rs->path_size) {
+			rs->path_size = need + 256;
+			rs->path = xrealloc(rs->path, rs->path_size);
+		}
+		i = len;
+		if (i == 0 || rs->path[i - 1] != '/')
+			rs->path[i++] = '/';
+		strcpy(rs->path + i, next->d_name);
+# ifdef _DIRENT_HAVE_D_TYPE
+		d_type = next->d_type;
+# else
+		d_type = DT_UNKNOWN;
+# endif
+		if (recurse_entry_at(rs, dirfd(dir), rs->path + i, d_type, depth + 1) == FALSE)
+			status = FALSE;
+	}
+	closedir(dir);
+	rs->path[len] = '\0';
+	return status;
+}
+
+/* Same as recursive_action() body for depth > 0.
+ * name points into rs->path: it is only valid until we recurse. */
+static int recurse_entry_at(struct recurse_state *rs, int dfd,
+		const char *name, unsigned d_type, unsigned depth)
+{
+	struct stat statbuf;
+	unsigned flags = rs->flags;
+	unsigned follow = flags & ACTION_FOLLOWLINKS;
+	int status;
+	int fd;
+
+	if ((flags & ACTION_TYPE_ONLY)
+	 && d_type != DT_UNKNOWN
+	 && !(d_type == DT_LNK && follow)
+	) {
+		/* Caller needs only file type, readdir gave it to us */
+		memset(&statbuf, 0, sizeof(statbuf));
+		statbuf.st_mode = DTTOIF(d_type);
+	} else
+	if (fstatat(dfd, name, &statbuf, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {
+		if ((flags & ACTION_DANGLING_OK)
+		 && errno == ENOENT
+		 && fstatat(dfd, name, &statbuf, AT_SYMLINK_NOFOLLOW) == 0
+		) {
+			/* Dangling link */
+			return rs->fileAction(rs->path, &statbuf, rs->userData, depth);
+		}
+		goto done_nak_warn;
+	}
+
+	if (!S_ISDIR(statbuf.st_mode))
+		return rs->fileAction(rs->path, &statbuf, rs->userData, depth);
+
+	if (!(flags & ACTION_DEPTHFIRST)) {
+		status = rs->dirAction(rs->path, &statbuf, rs->userData, depth);
+		if (status == FALSE)
+			goto done_nak_warn;
+		if (status == SKIP)
+			return TRUE;
+	}
+
+	fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC
+			| (follow ? 0 : O_NOFOLLOW));
+	if (fd < 0)
+		goto done_nak_warn;
+	status = recurse_dir_at(rs, fd, strlen(rs->path), depth);
+
+	if (flags & ACTION_DEPTHFIRST) {
+		if (!rs->dirAction(rs->path, &statbuf, rs->userData, depth))
+			goto done_nak_warn;
+	}
+
+	return status;
+
+ done_nak_warn:
+	if (!(flags & ACTION_QUIET))
+		bb_simple_perror_msg(rs->path);
+	return FALSE;
+}
+#endif
+
 /* fileName is (l)stat'ed (depending on ACTION_FOLLOWLINKS[_L0]).
  *
  * If it is a file: fileAction in run on it, its return value is returned.
@@ -63,6 +192,12 @@ static int FAST_FUNC true_action(const char *fileName UNUSED_PARAM,
  * ACTION_FOLLOWLINKS mainly controls handling of links to dirs.
  * 0: lstat(statbuf). Calls fileAction on link name even if points to dir.
  * 1: stat(statbuf). Calls dirAction and optionally recurse on link to dir.
+ *
+ * ACTION_DIRFD: walk subdirectories using openat/fstatat relative
+ * to the parent directory fd. Callbacks still get full names.
+ * ACTION_TYPE_ONLY (with ACTION_DIRFD): callbacks look only at
+ * the file type bits of st_mode; when readdir reports the type,
+ * other fields of statbuf are zero and no stat is done.
  */
 
 int FAST_FUNC recursive_action(const char *fileName,
@@ -123,6 +258,25 @@ int FAST_FUNC recursive_action(const char *fileName,
 			return TRUE;
 	}
 
+#if !ENABLE_PLATFORM_MINGW32
+	if (flags & ACTION_DIRFD) {
+		struct recurse_state rs;
+		int fd;
+
+		fd = open(fileName, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0)
+			goto done_nak_warn;
+		rs.flags = flags;
+		rs.fileAction = fileAction;
+		rs.dirAction = dirAction;
+		rs.userData = userData;
+		rs.path_size = strlen(fileName) + 1;
+		rs.path = xmemdup(fileName, rs.path_size);
+		status = recurse_dir_at(&rs, fd, rs.path_size - 1, depth);
+		free(rs.path);
+		goto done;
+	}
+#endif
 	dir = opendir(fileName);
 	if (!dir) {
 		/* findutils-4.1.20 reports this */
@@ -152,6 +306,9 @@ int FAST_FUNC recursive_action(const char *fileName,
 //		}
 	}
 	closedir(dir);
+#if !ENABLE_PLATFORM_MINGW32
+ done:
+#endif
 
 	if (flags & ACTION_DEPTHFIRST) {
 		if (!dirAction(fileName, &statbuf, userData, depth))
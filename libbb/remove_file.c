@@ -8,6 +8,7 @@
  */
 #include "libbb.h"
 
+#if ENABLE_PLATFORM_MINGW32
 /* Used from NOFORK applets. Must not allocate anything */
 
 int FAST_FUNC remove_file(const char *path, int flags)
@@ -108,3 +109,314 @@ int FAST_FUNC remove_file(const char *path, int flags)
 
 	return 0;
 }
+#else
+/* Used from NOFORK applets. Must not leak.
+ *
+ * Directories are walked with fstatat/unlinkat relative to an open
+ * fd of the directory, full names are kept in one growing buffer
+ * only for messages and prompts.
+ */
+# ifndef IFTODT
+#  define IFTODT(mode) (((mode) & 0170000) >> 12)
+# endif
+
+struct rm_walk {
+	char *path;
+	size_t path_size;
+	int flags;
+	struct rm_dir *dir; /* -j: directory this task owns, else NULL */
+	smallint can_spawn; /* -j: we are in w->dir itself (or at top) */
+};
+
+static int remove_entry_at(struct rm_walk *w, int dfd, size_t name_ofs, unsigned d_type);
+
+/* rm -j N: a directory is a task. Its subdirectories become tasks
+ * of their own while the queue is short, or are removed inline.
+ * Whoever drops the last reference to a directory (its own task
+ * or the last subdirectory task) rmdirs it and drops a reference
+ * to the parent, so no worker ever waits for another.
+ */
+struct rm_dir {
+	bb_task task;
+	struct rm_dir *parent;
+	int fd;            /* this directory */
+	unsigned refs;     /* own task + unfinished subdirectory tasks */
+	smallint failed;
+	int flags;
+	size_t name_ofs;   /* name in parent is path + name_ofs */
+	char path[1];
+};
+
+static struct rm_par {
+	bb_pool *pool;
+	unsigned queued, max_queued;
+	smallint root_failed;
+} *rm_par;
+
+void FAST_FUNC remove_file_jobs(unsigned nthreads)
+{
+	if (rm_par) {
+		bb_pool_free(rm_par->pool);
+		free(rm_par);
+		rm_par = NULL;
+	}
+	if (!ENABLE_FEATURE_USE_THREADS || nthreads == 0)
+		return;
+	rm_par = xzalloc(sizeof(*rm_par));
+	rm_par->pool = bb_pool_new(nthreads);
+	rm_par->max_queued = 4 * nthreads;
+}
+
+static void rm_dir_put(struct rm_dir *d)
+{
+	while (d && __sync_sub_and_fetch(&d->refs, 1) == 0) {
+		struct rm_dir *parent = d->parent;
+		const char *name = d->path + d->name_ofs;
+
+		close(d->fd);
+		if (!d->failed) {
+			if (unlinkat(parent ? parent->fd : AT_FDCWD, name, AT_REMOVEDIR) < 0) {
+				bb_perror_msg("can't remove '%s'", d->path);
+				d->failed = 1;
+			} else if (d->flags & FILEUTILS_VERBOSE) {
+				printf("removed directory: '%s'\n", d->path);
+			}
+		}
+		if (d->failed) {
+			if (parent)
+				parent->failed = 1;
+			else
+				rm_par->root_failed = 1;
+		}
+		free(d);
+		d = parent;
+	}
+}
+
+static int remove_dir_contents(struct rm_walk *w, int fd);
+
+static void FAST_FUNC run_rm_dir(bb_task *task)
+{
+	struct rm_dir *d = (struct rm_dir *)task;
+	struct rm_walk w;
+
+	__sync_sub_and_fetch(&rm_par->queued, 1);
+	w.path_size = strlen(d->path) + 256;
+	w.path = xmalloc(w.path_size);
+	strcpy(w.path, d->path);
+	w.flags = d->flags;
+	w.dir = d;
+	w.can_spawn = 1;
+	if (remove_dir_contents(&w, dup(d->fd)) < 0)
+		d->failed = 1;
+	free(w.path);
+	rm_dir_put(d);
+}
+
+/* Start a task removing directory fd, named w->path + name_ofs in dfd.
+ * Returns 0 if the queue is full */
+static int spawn_rm_dir(struct rm_walk *w, int fd, size_t name_ofs)
+{
+	struct rm_dir *d;
+
+	if (rm_par->queued >= rm_par->max_queued)
+		return 0;
+	d = xzalloc(sizeof(*d) + strlen(w->path));
+	strcpy(d->path, w->path);
+	d->name_ofs = name_ofs;
+	d->fd = fd;
+	d->flags = w->flags;
+	d->refs = 1;
+	d->parent = w->dir;
+	if (d->parent)
+		__sync_add_and_fetch(&d->parent->refs, 1);
+	__sync_add_and_fetch(&rm_par->queued, 1);
+	d->task.run = run_rm_dir;
+	bb_pool_submit(rm_par->pool, &d->task);
+	return 1;
+}
+
+/* Remove everything in directory fd (closed afterwards),
+ * w->path holds its name */
+static int remove_dir_contents(struct rm_walk *w, int fd)
+{
+	DIR *dp;
+	struct dirent *d;
+	size_t len;
+	int status = 0;
+
+	dp = fd >= 0 ? fdopendir(fd) : NULL;
+	if (dp == NULL) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	len = strlen(w->path);
+	while ((d = readdir(dp)) != NULL) {
+		size_t i, need;
+		unsigned d_type;
+
+		if (DOT_OR_DOTDOT(d->d_name))
+			continue;
+		/* w->path = w->path + "/" + d_name */
+		need = len + strlen(d->d_name) + 2;
+		if (need > w->path_size) {
+			w->path_size = need + 256;
+			w->path = xrealloc(w->path, w->path_size);
+		}
+		i = len;
+		if (i == 0 || w->path[i - 1] != '/')
+			w->path[i++] = '/';
+		strcpy(w->path + i, d->d_name);
+# ifdef _DIRENT_HAVE_D_TYPE
+		d_type = d->d_type;
+# else
+		d_type = DT_UNKNOWN;
+# endif
+		if (remove_entry_at(w, dirfd(dp), i, d_type) < 0)
+			status = -1;
+	}
+	w->path[len] = '\0';
+
+	if (closedir(dp) < 0) {
+		bb_perror_msg("can't close '%s'", w->path);
+		return -1;
+	}
+	return status;
+}
+
+/* Remove w->path + name_ofs in directory dfd, w->path is its full name */
+static int remove_entry_at(struct rm_walk *w, int dfd, size_t name_ofs, unsigned d_type)
+{
+	int flags = w->flags;
+
+	if (d_type == DT_UNKNOWN) {
+		struct stat path_stat;
+
+		if (fstatat(dfd, w->path + name_ofs, &path_stat, AT_SYMLINK_NOFOLLOW) < 0) {
+			bb_perror_msg("can't stat '%s'", w->path);
+			return -1;
+		}
+		d_type = IFTODT(path_stat.st_mode);
+	}
+
+	if (d_type == DT_DIR) {
+		int fd;
+		int status;
+		smallint can_spawn;
+
+		if ((!(flags & FILEUTILS_FORCE)
+		     && faccessat(dfd, w->path + name_ofs, W_OK, 0) < 0
+		     && isatty(0))
+		 || (flags & FILEUTILS_INTERACTIVE)
+		) {
+			fprintf(stderr, "%s: descend into directory '%s'? ",
+					applet_name, w->path);
+			if (!bb_ask_y_confirmation())
+				return 0;
+		}
+
+		fd = openat(dfd, w->path + name_ofs,
+				O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (w->can_spawn && fd >= 0 && spawn_rm_dir(w, fd, name_ofs))
+			return 0; /* the task reports errors */
+		/* Subtasks of w->dir must be its immediate subdirectories */
+		can_spawn = w->can_spawn;
+		w->can_spawn = 0;
+		/* may realloc w->path, but restores its contents */
+		status = remove_dir_contents(w, fd);
+		w->can_spawn = can_spawn;
+
+		if (flags & FILEUTILS_INTERACTIVE) {
+			fprintf(stderr, "%s: remove directory '%s'? ",
+					applet_name, w->path);
+			if (!bb_ask_y_confirmation())
+				return status;
+		}
+
+		if (status == 0 && unlinkat(dfd, w->path + name_ofs, AT_REMOVEDIR) < 0) {
+			bb_perror_msg("can't remove '%s'", w->path);
+			return -1;
+		}
+
+		if (flags & FILEUTILS_VERBOSE) {
+			printf("removed directory: '%s'\n", w->path);
+		}
+
+		return status;
+	}
+
+	/* !ISDIR */
+	if ((!(flags & FILEUTILS_FORCE)
+	     && d_type != DT_LNK
+	     && faccessat(dfd, w->path + name_ofs, W_OK, 0) < 0
+	     && isatty(0))
+	 || (flags & FILEUTILS_INTERACTIVE)
+	) {
+		fprintf(stderr, "%s: remove '%s'? ", applet_name, w->path);
+		if (!bb_ask_y_confirmation())
+			return 0;
+	}
+
+	if (unlinkat(dfd, w->path + name_ofs, 0) < 0) {
+		bb_perror_msg("can't remove '%s'", w->path);
+		return -1;
+	}
+
+	if (flags & FILEUTILS_VERBOSE) {
+		printf("removed '%s'\n", w->path);
+	}
+
+	return 0;
+}
+
+int FAST_FUNC remove_file(const char *path, int flags)
+{
+	struct stat path_stat;
+	struct rm_walk w;
+	int status;
+
+	if (lstat(path, &path_stat) < 0) {
+		if (errno != ENOENT) {
+			bb_perror_msg("can't stat '%s'", path);
+			return -1;
+		}
+		if (!(flags & FILEUTILS_FORCE)) {
+			bb_perror_msg("can't remove '%s'", path);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (S_ISDIR(path_stat.st_mode) && !(flags & FILEUTILS_RECUR)) {
+		bb_error_msg("'%s' is a directory", path);
+		return -1;
+	}
+
+	w.path_size = strlen(path) + 256;
+	w.path = xmalloc(w.path_size);
+	strcpy(w.path, path);
+	w.flags = flags;
+	w.dir = NULL;
+	w.can_spawn = 0;
+	if (rm_par) {
+		/* Prompts can't be done from worker threads */
+		if ((flags & FILEUTILS_INTERACTIVE)
+		 || (!(flags & FILEUTILS_FORCE) && isatty(0))
+		) {
+			remove_file_jobs(0);
+		} else {
+			rm_par->root_failed = 0;
+			w.can_spawn = 1;
+		}
+	}
+	status = remove_entry_at(&w, AT_FDCWD, 0, IFTODT(path_stat.st_mode));
+	if (rm_par) {
+		bb_pool_wait(rm_par->pool, NULL);
+		if (rm_par->root_failed)
+			status = -1;
+	}
+	free(w.path);
+	return status;
+}
+#endif
@@ -0,0 +1,165 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Utility routines.
+ *
+ * Pool of worker threads for applets' parallel modes (-j N etc).
+ *
+ * Licensed under GPLv2, see file LICENSE in this source tree.
+ */
+#include "libbb.h"
+
+/* Tasks are owned by the caller (typically embedded in a larger
+ * per-item struct), so submitting a task allocates nothing.
+ * A pool with zero threads runs every task synchronously in
+ * bb_pool_submit(). Without FEATURE_USE_THREADS all pools are such.
+ */
+#if ENABLE_FEATURE_USE_THREADS
+#include <pthread.h>
+
+struct bb_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond; /* queue is not empty, or pool is being freed */
+	pthread_cond_t done_cond; /* some task finished */
+	bb_task *head, *tail;
+	unsigned pending;         /* queued + running tasks */
+	unsigned nthreads;
+	smallint exiting;
+	pthread_t thread[];
+};
+
+static void *worker(void *arg)
+{
+	bb_pool *pool = arg;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		bb_task *task;
+
+		while (!pool->head && !pool->exiting)
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+		task = pool->head;
+		if (!task)
+			break; /* exiting, and queue is drained */
+		pool->head = task->next;
+		if (!pool->head)
+			pool->tail = NULL;
+		pthread_mutex_unlock(&pool->mutex);
+
+		task->run(task);
+
+		pthread_mutex_lock(&pool->mutex);
+		task->done = 1;
+		pool->pending--;
+		pthread_cond_broadcast(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+bb_pool* FAST_FUNC bb_pool_new(unsigned nthreads)
+{
+	bb_pool *pool;
+	sigset_t set, oldset;
+	unsigned i;
+
+	pool = xzalloc(sizeof(*pool) + nthreads * sizeof(pool->thread[0]));
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	/* Signals should be handled by the main thread only */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &oldset);
+	for (i = 0; i < nthreads; i++) {
+		int err = pthread_create(&pool->thread[i], NULL, worker, pool);
+		if (err) {
+			/* Not fatal unless we have no threads at all:
+			 * then tasks would be run synchronously, but the caller
+			 * asked for parallelism for a reason (and may rely on it) */
+			if (i == 0) {
+				errno = err;
+				bb_simple_perror_msg_and_die("can't create thread");
+			}
+			break;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	pool->nthreads = i;
+	return pool;
+}
+
+void FAST_FUNC bb_pool_submit(bb_pool *pool, bb_task *task)
+{
+	task->next = NULL;
+	task->done = 0;
+	if (pool->nthreads == 0) {
+		task->run(task);
+		task->done = 1;
+		return;
+	}
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->tail)
+		pool->tail->next = task;
+	else
+		pool->head = task;
+	pool->tail = task;
+	pool->pending++;
+	pthread_cond_signal(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void FAST_FUNC bb_pool_wait(bb_pool *pool, bb_task *task)
+{
+	if (pool->nthreads == 0)
+		return;
+	pthread_mutex_lock(&pool->mutex);
+	while (task ? !task->done : pool->pending != 0)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void FAST_FUNC bb_pool_free(bb_pool *pool)
+{
+	unsigned i;
+
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->mutex);
+	pool->exiting = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->thread[i], NULL);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+#else
+
+struct bb_pool {
+	unsigned nthreads;
+};
+
+bb_pool* FAST_FUNC bb_pool_new(unsigned nthreads UNUSED_PARAM)
+{
+	return xzalloc(sizeof(bb_pool));
+}
+
+void FAST_FUNC bb_pool_submit(bb_pool *pool UNUSED_PARAM, bb_task *task)
+{
+	task->run(task);
+	task->done = 1;
+}
+
+void FAST_FUNC bb_pool_wait(bb_pool *pool UNUSED_PARAM, bb_task *task UNUSED_PARAM)
+{
+}
+
+void FAST_FUNC bb_pool_free(bb_pool *pool)
+{
+	free(pool);
+}
+
+#endif
@@ -0,0 +1,66 @@
+# Helpers for throughput benchmarks
+#
+# Licensed under GPLv2, see file LICENSE in this source tree.
+#
+# These are not part of "make check": they do not test correctness,
+# only measure how fast an applet chews through its input.
+# Run them by hand, e.g.:
+#
+#	cd testsuite/bench && bindir=/path/to/objdir ./hashsum 512
+#
+# Every benchmark takes an optional size of its input in megabytes,
+# and prints one "NAME: SECONDS s, SPEED MB/s" line per measurement.
+# Set $bb_ref to a different busybox binary to compare with it:
+# its results are printed on "ref:"-prefixed lines.
+
+test x"$bindir" != x"" || bindir=$(cd ../.. && pwd)
+BB="$bindir/busybox"
+test -x "$BB" || { echo "$BB not found, set \$bindir" >&2; exit 1; }
+
+size_mb=${1:-256}
+BENCH_TMP=$(mktemp -d "${TMPDIR:-/tmp}/bb_bench.XXXXXX") || exit 1
+trap 'rm -rf "$BENCH_TMP"' EXIT
+
+# bench_file NAME SIZE_MB KIND - create test input, KIND is one of:
+# random - incompressible data
+# text   - lines of log-like text
+bench_file()
+{
+	case "$3" in
+	random)
+		"$BB" dd if=/dev/urandom of="$BENCH_TMP/$1" bs=1M count="$2" 2>/dev/null
+		;;
+	text)
+		# Seed with varied lines, then double it up to the size
+		"$BB" seq 1 20000 | "$BB" awk '{
+			printf "%s host%03d GET /path/to/item/%d?q=%x HTTP/1.1 %d %d \"agent %s\"\n",
+				$1 * 7919 % 1000000, $1 % 97, $1 * 31, $1 * 2654435761 % 4294967296,
+				200 + ($1 % 5) * 100, $1 * 13 % 65536, substr("abcdefghijklmnopqrstuvwxyz", $1 % 26 + 1)
+		}' >"$BENCH_TMP/$1"
+		while test $("$BB" stat -c %s "$BENCH_TMP/$1") -lt $(($2 * 1024 * 1024)); do
+			cat "$BENCH_TMP/$1" "$BENCH_TMP/$1" >"$BENCH_TMP/$1.tmp"
+			mv "$BENCH_TMP/$1.tmp" "$BENCH_TMP/$1"
+		done
+		"$BB" truncate -s $(($2 * 1024 * 1024)) "$BENCH_TMP/$1"
+		;;
+	esac
+}
+
+# bench_run NAME SIZE_MB CMD... - run CMD (with "busybox" prepended),
+# report its wall clock time and throughput for SIZE_MB of input
+# (only the time if SIZE_MB is "-").
+bench_run()
+{
+	local name="$1" mb="$2" bin
+	shift 2
+	for bin in "$BB" $bb_ref; do
+		"$BB" time -o "$BENCH_TMP/time" -f %e "$bin" "$@" >/dev/null
+		# time's last line is the time, there may be "exited with status" before
+		"$BB" awk -v name="$name" -v mb="$mb" -v ref="$(test "$bin" = "$BB" || echo "ref:")" 'END {
+			if (mb == "-")
+				printf "%s%s: %.2f s\n", ref, name, $1
+			else
+				printf "%s%s: %.2f s, %.1f MB/s\n", ref, name, $1, ($1 > 0 ? mb / $1 : 0)
+		}' "$BENCH_TMP/time"
+	done
+}
@@ -0,0 +1,128 @@
+/*
+ * Driver for testsuite/bench/inode_hash: times the (dev,ino) table
+ * of libbb/inode_hash.c on synthetic inode numbers.
+ *
+ * Licensed under GPLv2, see file LICENSE in this source tree.
+ */
+#include "libbb.h"
+
+/* Older libbb has only the single-threaded API */
+#pragma weak ino_dev_set_new
+
+const char *applet_name = "inode_hash";
+
+static unsigned count;
+static unsigned long long start_us;
+
+/* Files are spread over a few devices, inode numbers are
+ * dense on each of them (like on a freshly populated fs) */
+static void synth(struct stat *st, unsigned i)
+{
+	st->st_dev = 0x801 + (i & 3);
+	st->st_ino = 12 + (i >> 2) * 3;
+	st->st_mode = (i % 64) ? S_IFREG : S_IFDIR;
+}
+
+static void start(void)
+{
+	start_us = monotonic_us();
+}
+
+static void report(const char *name)
+{
+	double sec = (monotonic_us() - start_us) / 1e6;
+	printf("%s: %.2f s, %.1f M/s\n", name, sec, sec > 0 ? count / sec / 1e6 : 0);
+	fflush_all();
+}
+
+#if ENABLE_FEATURE_USE_THREADS
+struct set_task {
+	bb_task task;
+	ino_dev_set *set;
+	unsigned first, step;
+};
+
+/* Add every step'th pair (taking ones added by others as dups),
+ * then look all of them up without locks */
+static void FAST_FUNC set_work(bb_task *task)
+{
+	struct set_task *t = (struct set_task *)task;
+	struct stat st;
+	unsigned i;
+
+	memset(&st, 0, sizeof(st));
+	for (i = t->first; i < count; i += t->step) {
+		synth(&st, i);
+		ino_dev_set_add(t->set, &st, t);
+	}
+	for (i = 0; i < count; i++) {
+		synth(&st, i);
+		if (!ino_dev_set_find(t->set, &st) && i % t->step == t->first)
+			bb_error_msg_and_die("lost %u", i);
+	}
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	struct stat st;
+	unsigned i, found;
+
+	count = (argc > 1 ? atoi(argv[1]) : 10) * 1000000;
+	memset(&st, 0, sizeof(st));
+
+	start();
+	for (i = 0; i < count; i++) {
+		synth(&st, i);
+		if (!is_in_ino_dev_hashtable(&st))
+			add_to_ino_dev_hashtable(&st, NULL);
+	}
+	report("add");
+
+	start();
+	found = 0;
+	for (i = 0; i < count; i++) {
+		synth(&st, i);
+		found += !!is_in_ino_dev_hashtable(&st);
+	}
+	report("find");
+	if (found != count)
+		bb_error_msg_and_die("found %u of %u", found, count);
+
+	start();
+	for (i = 0; i < count; i++) {
+		synth(&st, i);
+		st.st_dev += 16; /* not there */
+		if (is_in_ino_dev_hashtable(&st))
+			bb_simple_error_msg_and_die("false hit");
+	}
+	report("miss");
+
+#if ENABLE_FEATURE_CLEAN_UP
+	start();
+	reset_ino_dev_hashtable();
+	report("reset");
+#endif
+
+#if ENABLE_FEATURE_USE_THREADS
+	if (ino_dev_set_new) {
+		enum { NTHREADS = 4 };
+		struct set_task t[NTHREADS];
+		bb_pool *pool = bb_pool_new(NTHREADS);
+
+		start();
+		for (i = 0; i < NTHREADS; i++) {
+			t[i].set = i ? t[0].set : ino_dev_set_new(/*shared:*/ 1);
+			t[i].first = i;
+			t[i].step = NTHREADS;
+			t[i].task.run = set_work;
+			bb_pool_submit(pool, &t[i].task);
+		}
+		bb_pool_wait(pool, NULL);
+		report("shared add+find, 4 threads");
+		ino_dev_set_free(t[0].set);
+		bb_pool_free(pool);
+	}
+#endif
+	return 0;
+}